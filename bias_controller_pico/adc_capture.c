@@ -0,0 +1,194 @@
+#include "pico/stdlib.h"
+#include "hardware/adc.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "adc_capture.h"
+
+#define ADC_DMA_CHUNK             (ADC_RING_SIZE << 16)  //Transfers per DMA run, a multiple of the ring so indices stay aligned (~18 min)
+
+//DMA ring wrap needs the buffer aligned to its own size in bytes
+static volatile uint16_t adc_samples[ADC_RING_SIZE] __attribute__((aligned(ADC_RING_SIZE * sizeof(uint16_t))));
+
+adc_ring_t adc_ring;
+
+static adc_cic_t adc_cic[ADC_CAPTURE_MAX_INPUTS];
+static int cic_order = 0;                                 //0: decimator off
+static uint32_t cic_head = 0;                             //Samples fed to the decimators so far
+static uint cic_slot = 0;                                 //Input of the sample at cic_head
+static uint cic_inputs = 1;
+
+static adc_hampel_t adc_hampel[ADC_CAPTURE_MAX_INPUTS];   //A robust read restarts its input's window, the counts carry on
+static int hampel_window = 0;                             //0: outlier rejection off
+
+static int dma_chan = -1;
+static volatile uint32_t dma_base = 0;                    //Samples written by completed DMA runs
+
+static void adc_dma_isr()
+{
+    dma_channel_acknowledge_irq0(dma_chan);
+    dma_base += ADC_DMA_CHUNK;
+
+    //Write address carries on from where the ring left off, only the count needs reloading
+    dma_channel_set_trans_count(dma_chan, ADC_DMA_CHUNK, true);
+}
+
+void adc_capture_init(uint inputs)
+{
+    adc_init();
+    for (uint input = 0; input < inputs; input++)
+    {
+        adc_gpio_init(26 + input);
+    }
+    adc_select_input(0);                          //First sample is input 0, the ring counts the rotation from there
+    adc_set_round_robin(inputs > 1 ? (1u << inputs) - 1 : 0);
+    adc_set_clkdiv(0);                            //96 ADC clocks per sample, 500 ksps
+
+    //One sample per FIFO entry, DREQ as soon as one is available, no error bit, keep full 12 bits
+    adc_fifo_setup(true, true, 1, false, false);
+
+    adc_ring_init(&adc_ring, adc_samples, inputs);
+    cic_inputs = inputs ? inputs : 1;
+
+    dma_chan = dma_claim_unused_channel(true);
+    dma_channel_config cfg = dma_channel_get_default_config(dma_chan);
+    channel_config_set_transfer_data_size(&cfg, DMA_SIZE_16);
+    channel_config_set_read_increment(&cfg, false);
+    channel_config_set_write_increment(&cfg, true);
+    channel_config_set_ring(&cfg, true, ADC_RING_BITS + 1);  //Wrap the write address every 2^(bits+1) bytes
+    channel_config_set_dreq(&cfg, DREQ_ADC);
+
+    dma_channel_configure(dma_chan, &cfg, adc_samples, &adc_hw->fifo, ADC_DMA_CHUNK, false);
+
+    dma_channel_set_irq0_enabled(dma_chan, true);
+    irq_set_exclusive_handler(DMA_IRQ_0, adc_dma_isr);
+    irq_set_enabled(DMA_IRQ_0, true);
+
+    adc_fifo_drain();
+    dma_channel_start(dma_chan);
+    adc_run(true);
+}
+
+uint32_t adc_capture_produced()
+{
+    uint32_t base;
+    uint32_t remaining;
+
+    //Re-read if the completion interrupt reloaded the channel between the two reads
+    do
+    {
+        base = dma_base;
+        remaining = dma_channel_hw_addr(dma_chan)->transfer_count;
+    } while (base != dma_base);
+
+    return base + (ADC_DMA_CHUNK - remaining);
+}
+
+void adc_capture_wait(uint32_t n)
+{
+    uint32_t start = adc_capture_produced();
+
+    while ((adc_capture_produced() - start) < n)
+    {
+        tight_loop_contents();
+    }
+}
+
+adc_q16_t adc_capture_mean(uint input, uint32_t n)
+{
+    adc_ring_consume(&adc_ring, adc_capture_produced());
+    return adc_ring_slot_mean(&adc_ring, input, n);
+}
+
+void adc_capture_filter(int order, int shift)
+{
+    cic_order = 0;                                //Nothing is fed while the stages are set up
+    if (order <= 0) return;
+
+    for (uint input = 0; input < cic_inputs; input++)
+    {
+        adc_cic_init(&adc_cic[input], order, shift);
+    }
+    adc_ring_consume(&adc_ring, adc_capture_produced());
+    cic_head = adc_ring.head;                     //The ring knows which input that sample came from
+    cic_slot = adc_ring.head_slot;
+    cic_order = order;
+}
+
+adc_q16_t adc_capture_filtered(uint input, uint32_t n)
+{
+    uint32_t produced = adc_capture_produced();
+    uint32_t pending = produced - cic_head;
+
+    if (cic_order == 0) return adc_capture_mean(input, n);
+
+    //Lapped by the DMA: the samples in between are gone, start the stages over on what is left
+    if (pending > ADC_RING_SIZE - ADC_RING_GUARD)
+    {
+        uint32_t skipped = pending - (ADC_RING_SIZE - ADC_RING_GUARD);
+
+        cic_head += skipped;
+        cic_slot = (cic_slot + skipped % cic_inputs) % cic_inputs;
+        for (uint i = 0; i < cic_inputs; i++) adc_cic_restart(&adc_cic[i]);
+    }
+
+    while (cic_head != produced)
+    {
+        adc_cic_push(&adc_cic[cic_slot], adc_samples[cic_head & ADC_RING_MASK]);
+        cic_head++;
+        if (++cic_slot == cic_inputs) cic_slot = 0;
+    }
+
+    uint32_t outputs = n >> adc_cic[input].shift;
+    return adc_cic_mean(&adc_cic[input], outputs ? outputs : 1);
+}
+
+void adc_capture_outliers(int window, float k)
+{
+    hampel_window = 0;
+    if (window <= 0) return;
+
+    for (uint input = 0; input < ADC_CAPTURE_MAX_INPUTS; input++)
+    {
+        adc_hampel_init(&adc_hampel[input], window, k);
+    }
+    hampel_window = adc_hampel[0].window;
+}
+
+adc_q16_t adc_capture_robust(uint input, uint32_t n)
+{
+    if (hampel_window == 0) return adc_capture_mean(input, n);
+
+    adc_ring_consume(&adc_ring, adc_capture_produced());
+
+    uint32_t available;
+    uint32_t end = adc_ring_slot_end(&adc_ring, input, &available);
+    uint32_t stride = adc_ring.stride;
+
+    if (n > available) n = available;
+
+    uint32_t prime = available - n;
+    if (prime > (uint32_t)hampel_window - 1) prime = hampel_window - 1;
+
+    //Oldest first: the filter is faster than the ADC, so it only gets further from the DMA write
+    uint32_t index = end - (n + prime) * stride;
+    uint32_t sum = 0;
+    adc_hampel_t *hampel = &adc_hampel[input];
+
+    adc_hampel_restart(hampel);
+    for (; prime > 0; prime--, index += stride)
+    {
+        adc_hampel_insert(hampel, adc_samples[index & ADC_RING_MASK]);
+    }
+    for (; index != end; index += stride)
+    {
+        sum += adc_hampel_push(hampel, adc_samples[index & ADC_RING_MASK]);
+    }
+
+    return q16_mean(sum, n);
+}
+
+uint32_t adc_capture_rejected(uint input, uint32_t *samples)
+{
+    *samples = adc_hampel[input].samples;
+    return adc_hampel[input].rejected;
+}
@@ -0,0 +1,37 @@
+#ifndef ADC_CAPTURE_H
+#define ADC_CAPTURE_H
+
+#include <stdint.h>
+#include "adc_ring.h"
+#include "adc_cic.h"
+#include "adc_hampel.h"
+
+/*
+Free-running ADC capture: the ADC runs back to back (500 ksps) into its FIFO and a DMA channel copies
+every sample into a 16 KB ring. With more than one input the ADC rotates through inputs 0 .. inputs - 1
+(round robin), so the ring holds them interleaved and each gets 500 / inputs ksps. Nothing here blocks
+except adc_capture_wait().
+
+With the decimator on (adc_capture_filter()) every sample consumed also goes through its input's CIC
+stage (adc_cic.h), catching up from where the last read left off.
+
+With outlier rejection on (adc_capture_outliers()) a robust read runs the Hampel filter (adc_hampel.h) over
+just the samples it averages, primed with the window - 1 samples before them, oldest first so it stays ahead
+of the DMA. The cost is per sample read, not per sample captured.
+*/
+
+#define ADC_CAPTURE_MAX_INPUTS    4                  //RP2040 ADC inputs on GPIO 26 .. 29
+
+extern adc_ring_t adc_ring;
+
+void adc_capture_init(uint inputs);           //Start the ADC on inputs 0 .. inputs - 1, FIFO and DMA ring
+uint32_t adc_capture_produced(void);          //Total samples written by DMA since start (wraps)
+void adc_capture_wait(uint32_t n);            //Block until n samples newer than the call have been captured
+adc_q16_t adc_capture_mean(uint input, uint32_t n);   //Mean of the last n samples of one input in ADC counts (Q16.16), non-blocking
+void adc_capture_filter(int order, int shift);        //CIC decimator on every input, order 0 for none
+adc_q16_t adc_capture_filtered(uint input, uint32_t n);   //Mean of the CIC outputs spanning the last n samples of one input, non-blocking
+void adc_capture_outliers(int window, float k);           //Hampel filter of window samples and k MADs for robust reads, window 0 for none
+adc_q16_t adc_capture_robust(uint input, uint32_t n);     //Mean of the last n samples of one input with the outliers replaced, non-blocking
+uint32_t adc_capture_rejected(uint input, uint32_t *samples);   //Samples of one input replaced since adc_capture_outliers(), and tested in *samples
+
+#endif
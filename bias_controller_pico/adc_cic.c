@@ -0,0 +1,36 @@
+#include "adc_cic.h"
+
+void adc_cic_init(adc_cic_t *cic, int order, int shift)
+{
+    if (order < 1) order = 1;
+    if (order > ADC_CIC_MAX_ORDER) order = ADC_CIC_MAX_ORDER;
+    if (shift < 0) shift = 0;
+    if (shift > ADC_CIC_MAX_SHIFT) shift = ADC_CIC_MAX_SHIFT;
+
+    cic->order = order;
+    cic->shift = shift;
+    adc_cic_restart(cic);
+}
+
+void adc_cic_restart(adc_cic_t *cic)
+{
+    for (int i = 0; i < ADC_CIC_MAX_ORDER; i++)
+    {
+        cic->integrator[i] = 0;
+        cic->comb[i] = 0;
+    }
+    cic->phase = 0;
+    cic->outputs = 0;
+    cic->valid = 0;
+    cic->prefix[(cic->order - 1) & ADC_CIC_OUTPUT_MASK] = 0;   //Before the first settled output
+}
+
+adc_q16_t adc_cic_mean(const adc_cic_t *cic, uint32_t n)
+{
+    if (n > cic->valid) n = cic->valid;
+    if (n == 0) return 0;
+
+    uint64_t sum = cic->prefix[cic->outputs & ADC_CIC_OUTPUT_MASK] - cic->prefix[(cic->outputs - n) & ADC_CIC_OUTPUT_MASK];
+
+    return (adc_q16_t)((sum + n / 2) / n);
+}
@@ -0,0 +1,87 @@
+#ifndef ADC_CIC_H
+#define ADC_CIC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "fixed_point.h"
+
+/*
+CIC (cascaded integrator comb) decimator for one ADC input: order integrators at the sample rate, order
+combs at the output rate, decimation 2^shift. Each output is the mean of the last order * 2^shift samples
+weighted by a box (order 1), triangle (2) or parabola (3), so the filter has nulls at every multiple of the
+output rate and the higher orders suppress the noise between them better than the plain boxcar of
+adc_ring.h. The PWM carrier (1.9 kHz) is only rejected once the output rate is at or below it, 2^shift =
+256; at the higher output rates the controller's mean over many outputs does that.
+
+The registers are uint64_t and wrap, only differences are used. The gain 2^(order * shift) is divided out
+by a shift into Q16.16 counts, nothing is truncated above 1/65536 of a count. Every factor 4 of decimation
+halves the white noise of an output, but what that buys depends on the noise there is: adc_ring_stub
+measures it, with 1.5 counts of noise and order 2 2^shift = 16 is worth about 11.9 effective bits and 256
+about 13.9, not the 14 and 16 the factors alone suggest.
+
+Outputs go to a ring with a prefix sum, so the mean of the last n outputs is O(1) like adc_ring_mean().
+*/
+
+#define ADC_CIC_MAX_ORDER         3
+#define ADC_CIC_MAX_SHIFT         8                  //Decimation 256, about 14 effective bits with 1.5 counts of noise
+#define ADC_CIC_OUTPUT_BITS       9                  //512 outputs of history, more than a control tick at any setting
+#define ADC_CIC_OUTPUTS           (1u << ADC_CIC_OUTPUT_BITS)
+#define ADC_CIC_OUTPUT_MASK       (ADC_CIC_OUTPUTS - 1u)
+
+typedef struct {
+    int order;                        //1 .. ADC_CIC_MAX_ORDER
+    int shift;                        //log2 of the decimation
+    uint64_t integrator[ADC_CIC_MAX_ORDER];
+    uint64_t comb[ADC_CIC_MAX_ORDER]; //Each comb stage's input at the previous output
+    uint32_t phase;                   //Samples into the current output
+    uint32_t outputs;                 //Outputs written since the start (wraps)
+    uint32_t valid;                   //Settled outputs in the ring, < ADC_CIC_OUTPUTS
+    uint64_t prefix[ADC_CIC_OUTPUTS]; //Sum of the Q16 outputs before each output index
+} adc_cic_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void adc_cic_init(adc_cic_t *cic, int order, int shift);
+void adc_cic_restart(adc_cic_t *cic);                 //Forget the history, e.g. after samples were lost
+adc_q16_t adc_cic_mean(const adc_cic_t *cic, uint32_t n);   //Mean of the last n outputs, Q16.16 counts
+
+#ifdef __cplusplus
+}
+#endif
+
+//Feed one sample. Returns true when it completed an output.
+static inline bool adc_cic_push(adc_cic_t *cic, uint16_t sample)
+{
+    uint64_t value = sample;
+
+    for (int i = 0; i < cic->order; i++)
+    {
+        cic->integrator[i] += value;
+        value = cic->integrator[i];
+    }
+
+    if (++cic->phase < (1u << cic->shift)) return false;
+    cic->phase = 0;
+
+    for (int i = 0; i < cic->order; i++)
+    {
+        uint64_t previous = cic->comb[i];
+        cic->comb[i] = value;
+        value -= previous;
+    }
+
+    //The first order - 1 outputs still hold samples from before the start
+    cic->outputs++;
+    if (cic->outputs < (uint32_t)cic->order) return false;
+
+    int gain = cic->order * cic->shift;
+    uint64_t out = (gain <= 16) ? value << (16 - gain) : (value + (1ull << (gain - 17))) >> (gain - 16);
+
+    cic->prefix[cic->outputs & ADC_CIC_OUTPUT_MASK] = cic->prefix[(cic->outputs - 1) & ADC_CIC_OUTPUT_MASK] + out;
+    if (cic->valid < ADC_CIC_OUTPUTS - 1) cic->valid++;
+    return true;
+}
+
+#endif
@@ -0,0 +1,22 @@
+#include "adc_hampel.h"
+
+#define MAD_TO_SIGMA              1.4826f            //Standard deviation over median absolute deviation, normal noise
+
+void adc_hampel_init(adc_hampel_t *h, int window, float k)
+{
+    if (window < 3) window = 3;
+    if (window > ADC_HAMPEL_MAX_WINDOW) window = ADC_HAMPEL_MAX_WINDOW;
+    if (k < 0.0f) k = 0.0f;
+
+    h->window = window | 1;            //Odd, the median is a sample
+    h->threshold = (uint32_t)(k * MAD_TO_SIGMA * (1 << ADC_HAMPEL_K_SHIFT) + 0.5f);
+    h->samples = 0;
+    h->rejected = 0;
+    adc_hampel_restart(h);
+}
+
+void adc_hampel_restart(adc_hampel_t *h)
+{
+    h->count = 0;
+    h->oldest = 0;
+}
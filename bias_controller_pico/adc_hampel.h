@@ -0,0 +1,122 @@
+#ifndef ADC_HAMPEL_H
+#define ADC_HAMPEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+Hampel filter for raw ADC samples: each sample is compared with the median of a sliding window of the last
+window samples (itself included) and replaced by that median when it is further from it than k times the
+window's scaled median absolute deviation (1.4826 MAD, sigma for normal noise). A single glitch, a laser mode
+hop or a ground spike, never moves the median, so it is caught up to window / 2 samples long. Clean samples
+are not all kept: the tail of the noise past k MADs is replaced too, with 1.5 counts of noise and 3 MADs
+adc_ring_stub counts 3.5% of them at window 3, 1.6% at 7 and 0.6% at 15. They are replaced by the median,
+a few counts away, so a mean of them keeps its resolution.
+
+Deviations up to ADC_HAMPEL_FLOOR counts are always kept, a quiet input has a MAD of 0 and would otherwise
+lose every sample off the median. Those are most samples, they cost the window update and one compare.
+
+Allocation free and incremental: the window is kept in arrival order and sorted, a new sample takes out the
+oldest and is inserted in O(window), the MAD is a merge of the deviations below and above the median, O(window)
+and only for the samples past the floor. Integer only.
+*/
+
+#define ADC_HAMPEL_MAX_WINDOW     15
+#define ADC_HAMPEL_FLOOR          2                  //Counts from the median always kept
+#define ADC_HAMPEL_K_SHIFT        8                  //threshold is Q8
+
+typedef struct {
+    int window;                       //Samples in the window, odd, 3 .. ADC_HAMPEL_MAX_WINDOW
+    uint32_t threshold;               //k * 1.4826 in Q8, times the MAD the largest deviation kept
+    int count;                        //Samples in the window so far, up to window
+    int oldest;                       //Index in ring of the oldest sample once full
+    uint16_t ring[ADC_HAMPEL_MAX_WINDOW];     //The window in arrival order
+    uint16_t sorted[ADC_HAMPEL_MAX_WINDOW];   //The same samples ascending
+    uint32_t samples;                 //Samples tested since init (wraps)
+    uint32_t rejected;                //Of those, replaced by the median
+} adc_hampel_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void adc_hampel_init(adc_hampel_t *h, int window, float k);  //Window of 3 .. ADC_HAMPEL_MAX_WINDOW samples, k in MADs
+void adc_hampel_restart(adc_hampel_t *h);                     //Empty the window, the counts are kept
+
+#ifdef __cplusplus
+}
+#endif
+
+//Add a sample to the window, dropping the oldest once it is full
+static inline void adc_hampel_insert(adc_hampel_t *h, uint16_t sample)
+{
+    int n = h->count;
+    int i = 0;
+
+    if (n == h->window)
+    {
+        uint16_t old = h->ring[h->oldest];
+
+        while (h->sorted[i] != old) i++;
+        for (n--; i < n; i++) h->sorted[i] = h->sorted[i + 1];
+
+        h->ring[h->oldest] = sample;
+        if (++h->oldest == h->window) h->oldest = 0;
+    }
+    else
+    {
+        h->ring[n] = sample;
+        h->count++;
+    }
+
+    for (i = n; i > 0 && h->sorted[i - 1] > sample; i--) h->sorted[i] = h->sorted[i - 1];
+    h->sorted[i] = sample;
+}
+
+//Median absolute deviation of the window around its median, sorted[m]: the deviations below and above it
+//each grow going outwards, the count / 2 smallest of the two merged (after the median's own 0) is the median
+static inline uint32_t adc_hampel_mad(const adc_hampel_t *h, int m)
+{
+    uint32_t median = h->sorted[m];
+    uint32_t deviation = 0;
+    int below = m - 1;
+    int above = m + 1;
+
+    for (int i = 0; i < h->count / 2; i++)
+    {
+        uint32_t low = (below >= 0) ? median - h->sorted[below] : UINT32_MAX;
+        uint32_t high = (above < h->count) ? h->sorted[above] - median : UINT32_MAX;
+
+        if (low <= high)
+        {
+            deviation = low;
+            below--;
+        }
+        else
+        {
+            deviation = high;
+            above++;
+        }
+    }
+
+    return deviation;
+}
+
+//Feed one sample. Returns it, or the window's median if it is an outlier.
+static inline uint16_t adc_hampel_push(adc_hampel_t *h, uint16_t sample)
+{
+    adc_hampel_insert(h, sample);
+    h->samples++;
+
+    int m = h->count / 2;
+    uint16_t median = h->sorted[m];
+    uint32_t deviation = (sample > median) ? (uint32_t)(sample - median) : (uint32_t)(median - sample);
+
+    if (deviation <= ADC_HAMPEL_FLOOR) return sample;
+    if ((deviation << ADC_HAMPEL_K_SHIFT) <= h->threshold * adc_hampel_mad(h, m)) return sample;
+
+    h->rejected++;
+    return median;
+}
+
+#endif
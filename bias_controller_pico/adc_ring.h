@@ -0,0 +1,132 @@
+#ifndef ADC_RING_H
+#define ADC_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "fixed_point.h"
+
+/*
+Ring buffer of raw 12-bit ADC samples with an O(1) mean over the last N samples of each input.
+
+The producer (DMA on the Pico, a plain loop on the host) writes sample k into samples[k & ADC_RING_MASK]
+and keeps a monotonic count of samples written. With several inputs captured in rotation (round robin)
+sample k comes from input k % stride. The consumer calls adc_ring_consume() with that count, which folds
+every new sample into a parallel prefix ring that sums every stride-th sample:
+
+    prefix[k & ADC_RING_MASK] = sample[k - 1] + sample[k - 1 - stride] + ...
+
+so prefix[j] - prefix[j - N * stride] is the sum of N samples of one input, where j is one past that input's
+newest sample. With a single input (stride 1) this is the plain running sum of every sample.
+All sums are uint32_t and wrap, which is harmless because only differences are used (N * 4095 < 2^32).
+
+This header has no Pico SDK dependency so the same maths can be built and benchmarked on the host.
+*/
+
+#define ADC_RING_BITS             13                                 //8192 samples, 16.4 ms of history at 500 ksps
+#define ADC_RING_SIZE             (1u << ADC_RING_BITS)
+#define ADC_RING_MASK             (ADC_RING_SIZE - 1u)
+#define ADC_RING_GUARD            256u                               //Samples kept clear of the producer when catching up
+
+typedef struct {
+    volatile uint16_t *samples;      //Sample storage, ADC_RING_SIZE entries, filled by the producer
+    uint32_t prefix[ADC_RING_SIZE];  //Sum of every stride-th sample before each sample index
+    uint32_t head;                   //Number of samples consumed so far (monotonic, wraps)
+    uint32_t valid;                  //Contiguous samples available for averaging (< ADC_RING_SIZE)
+    uint32_t overruns;               //Times the consumer fell too far behind and skipped samples
+    uint32_t stride;                 //Inputs captured in rotation, 1 for a single input
+    uint32_t head_slot;              //Input the sample at head comes from, 0 .. stride - 1
+} adc_ring_t;
+
+//Start the prefix chain of every input at zero just before head
+static inline void adc_ring_restart(adc_ring_t *ring)
+{
+    for (uint32_t i = 0; i < ring->stride; i++)
+    {
+        ring->prefix[(ring->head - i) & ADC_RING_MASK] = 0;
+    }
+    ring->valid = 0;
+}
+
+static inline void adc_ring_init(adc_ring_t *ring, volatile uint16_t *samples, uint32_t stride)
+{
+    ring->samples     = samples;
+    ring->head        = 0;
+    ring->overruns    = 0;
+    ring->stride      = stride ? stride : 1;
+    ring->head_slot   = 0;
+    adc_ring_restart(ring);
+}
+
+//Fold every sample written since the last call into the prefix ring. produced is the producer's total sample count.
+static inline void adc_ring_consume(adc_ring_t *ring, uint32_t produced)
+{
+    uint32_t pending = produced - ring->head;
+
+    //Samples older than one ring length (minus a guard for the in-flight DMA write) are gone, restart the window
+    if (pending > ADC_RING_SIZE - ADC_RING_GUARD)
+    {
+        uint32_t skipped = pending - (ADC_RING_SIZE - ADC_RING_GUARD);
+
+        ring->head += skipped;
+        ring->head_slot = (ring->head_slot + skipped % ring->stride) % ring->stride;
+        adc_ring_restart(ring);
+        ring->overruns++;
+    }
+
+    const uint32_t back = ring->stride - 1;   //prefix[head + 1] continues prefix[head + 1 - stride]
+
+    while (ring->head != produced)
+    {
+        uint32_t sum = ring->samples[ring->head & ADC_RING_MASK] + ring->prefix[(ring->head - back) & ADC_RING_MASK];
+
+        ring->head++;
+        ring->prefix[ring->head & ADC_RING_MASK] = sum;
+
+        if (++ring->head_slot == ring->stride)
+        {
+            ring->head_slot = 0;
+        }
+
+        if (ring->valid < ADC_RING_SIZE - 1)
+        {
+            ring->valid++;
+        }
+    }
+}
+
+//Sample index one past the newest consumed sample of one input, and how many of its samples are available
+static inline uint32_t adc_ring_slot_end(const adc_ring_t *ring, uint32_t slot, uint32_t *available)
+{
+    //Samples consumed since the newest one of this input
+    uint32_t since = (ring->head_slot + ring->stride - 1 - slot) % ring->stride;
+
+    *available = (ring->valid > since) ? (ring->valid - since) / ring->stride : 0;
+    return ring->head - since;
+}
+
+//Sum of the last n consumed samples of one input. n is clamped to what is available.
+static inline uint32_t adc_ring_slot_sum(const adc_ring_t *ring, uint32_t slot, uint32_t *n)
+{
+    uint32_t available;
+    uint32_t end = adc_ring_slot_end(ring, slot, &available);
+
+    if (*n > available) *n = available;
+
+    return ring->prefix[end & ADC_RING_MASK] - ring->prefix[(end - *n * ring->stride) & ADC_RING_MASK];
+}
+
+//Mean of the last n consumed samples of one input in ADC counts (Q16.16), 0 if nothing has been captured yet
+static inline adc_q16_t adc_ring_slot_mean(const adc_ring_t *ring, uint32_t slot, uint32_t n)
+{
+    uint32_t sum = adc_ring_slot_sum(ring, slot, &n);
+
+    return q16_mean(sum, n);
+}
+
+//Single input ring (stride 1)
+static inline adc_q16_t adc_ring_mean(const adc_ring_t *ring, uint32_t n)
+{
+    return adc_ring_slot_mean(ring, 0, n);
+}
+
+#endif
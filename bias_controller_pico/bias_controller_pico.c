@@ -2,27 +2,85 @@
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
-#include "pico/stdlib.h"
-#include "hardware/pwm.h"
-#include "hardware/adc.h"
-#include "hardware/flash.h"
-#include "hardware/sync.h"
+#include "hal.h"
+#include "bias_controller_pico.h"
+#include "lockin.h"
+#include "pid.h"
+#include "sweep_fit.h"
+#include "console.h"
+#include "control_tick.h"
+#include "param_journal.h"
+#include "telemetry.h"
+#include "control_bench.h"
+#include "drift_kalman.h"
+#include "noise_estimator.h"
+#include "adc_cic.h"
+#include "adc_hampel.h"
 
 #define FLASH_TARGET_OFFSET (1 * 1024 * 1024)  // 1MB offset from start of flash
+#define PARAM_JOURNAL_SECTORS 4                // Sectors the parameter journal rotates through (32 saves per erase cycle)
 //#define FLASH_SECTOR_SIZE   4096
 //#define FLASH_PAGE_SIZE     256
 
-#define PARAM_MAGIC 0xABCD1234 // Magic number to identify valid parameter block
+#define PARAM_MAGIC 0xABCD1243 // Magic number to identify valid parameter block (bumped when the layout changes)
+#define CALIBRATION_VALID 0x5EEDCA1Bu // Marks a calibration record written by a sweep
+
+// Result of the last good sweep, enough to put the bias straight back on its lock point at boot
+typedef struct {
+    uint32_t valid;            // CALIBRATION_VALID once a sweep has been stored
+    adc_q16_t null_setpoint;   // Setpoint voltages, Q16 ADC counts
+    adc_q16_t peak_setpoint;
+    adc_q16_t quad_setpoint;
+    int null_step;             // DAC step of each lock point
+    int peak_step;
+    int quad_plus_step;
+    int quad_minus_step;
+    int vpi_steps;             // Fitted half period in DAC steps
+} sweep_calibration_t;
+
+// Settings of one channel, in flash and in the channel's slot. X(type, name) for each, the names are the
+// globals the controller code works on (see channel_select())
+#define CHANNEL_PARAMS(X) \
+    X(enum setPoint, set_point)          /* Jumpers override it for channel 0 at boot */ \
+    X(adc_q16_t, tolerance)              /* Q16 ADC counts */ \
+    X(int, quad_buffer) \
+    X(int, null_buffer) \
+    X(int, peak_buffer) \
+    X(int, lockin_dither) \
+    X(int, lockin_periods) \
+    X(int, lockin_samples) \
+    X(int, quad_pid) \
+    X(float, kp) \
+    X(float, ki) \
+    X(float, kd) \
+    X(int, sweep_fit_enabled) \
+    X(int, sweep_average) \
+    X(int, coarse_points) \
+    X(int, refine_window) \
+    X(int, quad_window) \
+    X(int, tick_max_step) \
+    X(int, drift_tracker_enabled) \
+    X(int, auto_tune_enabled) \
+    X(sweep_calibration_t, calibration)
+
+#define CHANNEL_FIELD(type, name) type name;
+
+typedef struct {
+    CHANNEL_PARAMS(CHANNEL_FIELD)
+} channel_params_t;
 
 // Structure to hold persistent parameters
 typedef struct {
     uint32_t magic;            // Magic number to validate stored data
-    float tolerance;
-    int quad_buffer;
-    int null_buffer;
-    int peak_buffer;
-    uint32_t checksum;         // Simple checksum for data integrity
-} persistent_params_t;
+    int control_rate;
+    int dac_mode;
+    int adc_oversample;
+    int cic_order;
+    int outlier_window;
+    float outlier_k;
+    int channel_count;
+    channel_params_t channels[CONTROLLER_CHANNELS];
+} persistent_params_t;         // Stored as a param_journal record, which carries the CRC32
 
 /*
 SUGGESTED RANGE FOR MODIFIED VARIABLES/ORIGINAL VALUES
@@ -32,50 +90,68 @@ QUAD_BUFFER: 5 -> 100    : ORIGINAL VALUE 10     : INCREASE THIS VALUE IF WRONG
 NULL_BUFFER: 25 -> 500   : ORIGINAL VALUE 50    : INCREASE THIS VALUE IF NULL DOESNT SETTLE, DECREASE THIS VALUE IF THERE IS TO MUCH NOISE WHILE NULL LOCKED 
 PEAK_BUFFER: 25 -> 500   : ORIGINAL VALUE 50   : SAME AS ABOVE BUT FOR PEAK
 GAIN: 8->32              : ORIGINAL VALUE 8      : NOT ADVISED TO CHANGE, INCREASE FOR FASTER CONVERGENCE TIME TO SETPOINT
+QUAD_PID: 0/1            : ORIGINAL VALUE 0      : 1 REPLACES THE FIXED GAIN QUAD LOOP WITH THE PID BELOW
+KP: 0 -> 20000           : ORIGINAL VALUE 2000   : DAC STEPS PER VOLT OF ERROR, INCREASE FOR FASTER RESPONSE, DECREASE IF QUAD OVERSHOOTS
+KI: 0 -> 20000           : ORIGINAL VALUE 4000   : DAC STEPS PER VOLT PER ITERATION, ~0.5 / (QUAD SLOPE IN V PER STEP) SETTLES IN ~10 ITERATIONS
+KD: 0 -> 20000           : ORIGINAL VALUE 0      : ONLY NEEDED IF THE RC FILTER LAG CAUSES RINGING
+SWEEP_FIT: 0/1           : ORIGINAL VALUE 1      : 0 RETURNS TO RAW MAX/MIN DETECTION WITH FULL AVERAGING PER SWEEP POINT
+SWEEP_AVERAGE: 16->4000  : ORIGINAL VALUE 64     : INCREASE IF THE FIT IS REJECTED ON A NOISY SETUP, DECREASE FOR A FASTER SWEEP
+COARSE_POINTS: 0,16->1024: ORIGINAL VALUE 128    : 0 SWEEPS ALL 4096 POINTS, INCREASE IF THE COARSE PASS MISSES THE PEAK OR NULL
+REFINE_WINDOW: 64->8192  : ORIGINAL VALUE 512    : DAC STEPS EITHER SIDE OF THE COARSE PEAK/NULL SWEPT AT FULL RESOLUTION, KEEP >= 65536 / COARSE_POINTS
+QUAD_WINDOW: 0->8192     : ORIGINAL VALUE 128    : SAME AS ABOVE AROUND EACH QUAD CROSSING, 0 INTERPOLATES QUAD FROM THE COARSE PASS
+CONTROL_RATE: 0,10->5000 : ORIGINAL VALUE 100    : CONTROL TICKS PER SECOND, 0 RETURNS TO THE ONCE A SECOND POLLING LOOP. LOWER IT IF STATUS SHOWS OVERRUNS
+TICK_MAX_STEP: 1->4096   : ORIGINAL VALUE 64     : LARGEST DAC CORRECTION IN ONE TICK, INCREASE TO FOLLOW FASTER DRIFT
+DAC_MODE: 0/1            : ORIGINAL VALUE 0      : 1 DITHERED 488 KHZ PWM, ~10X SMALLER RC CAPACITOR THEN SETTLES 10X FASTER WITH THE SAME RIPPLE
+DRIFT_TRACKER: 0/1       : ORIGINAL VALUE 1      : KALMAN ESTIMATE OF THE DRIFT FED FORWARD EVERY CONTROL TICK, 0 IF THE ESTIMATE FIGHTS THE LOOP
+OVERSAMPLE: 0->4         : ORIGINAL VALUE 0      : ABOVE 0 READS THROUGH A CIC DECIMATOR OF 4^N, EACH STEP HALVES THE NOISE OF ONE OUTPUT AND QUARTERS THE OUTPUT RATE. 4 ALSO REJECTS THE PWM CARRIER
+CIC_ORDER: 1->3          : ORIGINAL VALUE 2      : CIC STAGES, HIGHER REJECTS THE PWM CARRIER BETTER BUT EACH OUTPUT SPANS ORDER x DECIMATION SAMPLES
+OUTLIERS: 0,3->15        : ORIGINAL VALUE 0      : HAMPEL WINDOW IN SAMPLES, REPLACES GLITCHES UP TO HALF OF IT LONG BEFORE THE MEAN. ABOUT 1 US PER SAMPLE READ (SEE BENCH), TAKES OVER FROM THE CIC
+OUTLIER_K: 1->10         : ORIGINAL VALUE 3      : MADS FROM THE WINDOW MEDIAN A SAMPLE MAY BE, LOWER REJECTS MORE BUT STARTS CLIPPING THE NOISE ITSELF
+AUTO: 0/1                : ORIGINAL VALUE 0      : 1 DERIVES TOLERANCE AND THE QUAD/NULL/PEAK BUFFERS FROM THE MEASURED NOISE AND SLOPE, NO HAND TUNING NEEDED
+CHANNELS: 1->3           : ORIGINAL VALUE 1      : MODULATORS DRIVEN, CHANNEL N ON ADC INPUT N. SAVE AND REBOOT TO APPLY, EACH CHANNEL GETS 1/N OF THE ADC SAMPLES
 */
 
 //MODIFY THESE--------------------------------------------------------------------------------------------------------------------------------------------------------
-float tolerance           = 0.05f;              //Tolerance for reaching setpoint in volts. 
+adc_q16_t tolerance       = VOLTS_Q16(0.05f);   //Tolerance for reaching setpoint, set in volts, held in Q16 ADC counts 
 int quad_buffer           = 10;                   //Buffer for quad + / - search. Requires x # of measurments that fall within tolerance and slope conditions before it is deemed valid. Mitigates noise
 int peak_buffer           = 50;                  //Buffer for peak control loop. Requires x # of measurments with growing error before changing direction. Mitigates noise
 int null_buffer           = 50;                  //Same as above but for null
 #define GAIN                8                     //Gain of overall control loop. At each calculation DAC will correct x amount of voltage steps. Change not recommended.
+int quad_pid              = 0;                   //Use the PID controller for quad plus / minus instead of fixed GAIN steps
+float kp                  = 2000.0f;             //PID proportional gain, DAC steps per volt of error
+float ki                  = 4000.0f;             //PID integral gain, DAC steps per volt of error per iteration
+float kd                  = 0.0f;                //PID derivative gain, DAC steps per volt of change per iteration
+int sweep_fit_enabled     = 1;                   //Take setpoints from a model fit of the sweep instead of the raw max/min
+int sweep_average         = 64;                  //ADC samples per sweep point while the fit is enabled, the fit does the rest of the averaging
+int coarse_points         = 128;                 //Points of the coarse sweep pass, 0 for the original full resolution sweep
+int refine_window         = 512;                 //DAC steps either side of the coarse peak and null re-swept at full resolution
+int quad_window           = 128;                 //DAC steps either side of each coarse quad crossing re-swept at full resolution
+int control_rate          = 100;                 //Control ticks per second from the hardware timer, 0 for the original polling loop
+int tick_max_step         = 64;                  //Largest DAC correction made in one control tick
+int dac_mode              = HAL_DAC_PWM;         //PWM DAC back end, HAL_DAC_PWM (16-bit, 1.9 kHz) or HAL_DAC_DITHER (dithered 488 kHz)
+int adc_oversample        = 0;                   //Decimation 4^n, above 0 the reads come from the CIC decimator (adc_cic.h)
+int cic_order             = 2;                   //Stages of that decimator
+int outlier_window        = 0;                   //Hampel filter window on the samples of every read (adc_hampel.h), 0 off
+float outlier_k           = 3.0f;                //Its threshold in scaled median absolute deviations
+int drift_tracker_enabled = 1;                   //Track the lock point drift with a Kalman filter and feed it forward (control tick only)
+int auto_tune_enabled     = 0;                   //Derive tolerance and the buffers from the measured noise ('set auto on'), see auto_tune()
+int channel_count         = 1;                   //Modulators driven, each with the settings above as its own copy ('ch' command)
 //--------------------------------------------------------------------------------------------------------------------------------------------------------------------
 
-enum setPoint {
-    NULL_POINT,
-    QUAD_MINUS,
-    QUAD_PLUS, 
-    PEAK_POINT   
-};
-
 enum setPoint set_point = NULL_POINT;
 
 // Serial command buffer
-#define MAX_CMD_LEN               100
+#define MAX_CMD_LEN               CONSOLE_LINE_LEN
 char cmd_buffer[MAX_CMD_LEN];
-int cmd_index = 0;
-bool cmd_ready = false;
 
 // Parameter change flags
 //bool params_changed = false;
 
-#define PWM_PIN                   15                 //PIN 20
-#define BUTTON_PIN                14                 //PIN 19
-#define LED_PIN                   13
-#define NULL_PIN                  18
-#define QUAD_PLUS_PIN             19
-#define QUAD_MINUS_PIN            20
-#define PEAK_PIN                  21
-#define ADC_INPUT                 0                  //GPIO 26/PIN 31
-#define MAX_VOLTAGE_STEP          65535              //Maximum voltage step DAC
-#define MIN_VOLTAGE_STEP          0                  //Minimum voltage step DAC
-#define MAX_VOLTAGE               3.3f
-#define MIN_VOLTAGE               0.0f
-#define NOISE_FLOOR               0.01f              //Noise floor (for null bias)
-#define MAX_8BIT_STEPS            256                //Max value for 8-bit
-#define MAX_12BIT_STEPS           4096               //Max value for 12-bit 
-#define MAX_16BIT_STEPS           65536              //Max value for 16-bit 
+#define ADC_SAMPLES_PER_US        0.5f               //ADC free-running at 500 ksps, shared by the inputs in rotation
+#define DAC_SETTLE_MS             100                //RC filter settling for the 1.9 kHz carrier
+#define DAC_SETTLE_MS_DITHER      10                 //With the RC corner raised for the 488 kHz dithered carrier
+#define DAC_SETTLE_TAUS           11                 //RC time constants in DAC_SETTLE_MS, 16 bits of settling
+
 #define MOVE_RIGHT                1
 #define MOVE_LEFT                 0
 
@@ -83,155 +159,563 @@ const int average_per_read      = 4000;                 //Amount of averaged ADC
 const int array_size            = MAX_12BIT_STEPS;      //Array size for sweep_pwm
 
 //Initializing variable
-float null_setpoint             = 0.0f; 
-float peak_setpoint             = 0.0f;
-float quad_setpoint             = 0.0f;
-float selected_setpoint         = 0.0f;
-float current_input_voltage     = 0.0f;
+adc_q16_t null_setpoint         = 0;                    //Setpoints and readings in Q16 ADC counts (fixed_point.h)
+adc_q16_t peak_setpoint         = 0;
+adc_q16_t quad_setpoint         = 0;
+adc_q16_t selected_setpoint     = 0;
+adc_q16_t current_input_voltage = 0;
 int current_output_voltage_step = 0;
+int peak_voltage_step           = 0;                    //DAC step of the peak found by the last sweep
+int null_voltage_step           = 0;                    //DAC step of the null found by the last sweep
+int vpi_steps                   = 26000;                //DAC steps between peak and null (half a period), measured by sweep
 
-volatile bool button_pressed = false;
+volatile bool button_pressed = false;      // Sweep the active channel (its copy is in the channel slot)
+volatile bool sweep_all_pressed = false;   // Button, sweep every channel
 volatile bool null_pin = false;
 volatile bool quad_minus_pin = false;
 volatile bool quad_plus_pin = false;
 volatile bool peak_pin = false;
 
 volatile bool save_pending = false; // Flag to indicate a pending save
+bool sweep_active = false;          // Reads are sweep points, flagged as such in telemetry
+
+sweep_calibration_t calibration = {0};   // Last good sweep, saved with the parameters and used to warm start
+
+#define SWEEP_INDEX_MAX           FIT_MAX_POINTS     //Lock points of each kind kept
+
+// DAC step of every lock point the last sweep saw, see build_sweep_index()
+typedef struct {
+    int null_steps[SWEEP_INDEX_MAX];
+    int peak_steps[SWEEP_INDEX_MAX];
+    int quad_plus_steps[SWEEP_INDEX_MAX];
+    int quad_minus_steps[SWEEP_INDEX_MAX];
+    int null_count;
+    int peak_count;
+    int quad_plus_count;
+    int quad_minus_count;
+} sweep_index_t;
+
+sweep_index_t sweep_index = {0};
+
+#define WARM_START_CONFIRM_MS     5000               //Time tracking gets after a warm start to bring the output inside tolerance
+#define WARM_START_CONFIRM_READS  3                  //Consecutive reads inside tolerance that confirm the cached lock point
+
+bool warm_start_pending = false;        // Booted from the calibration, lock not confirmed yet
+int warm_start_hits = 0;
+uint64_t warm_start_us = 0;             // When the cached step was applied
+uint32_t warm_start_lock_ms = 0;        // Time to the confirmed lock, 0 if the last boot swept
+
+#define DRIFT_PROCESS_NOISE       100.0f             //(DAC steps / s)^2 per second, how fast the drift rate is allowed to change
+
+drift_kalman_t drift_tracker = {.q = DRIFT_PROCESS_NOISE};   // Lock point and drift estimate, see drift_tracker_tick()
+
+noise_estimator_t noise_estimator = {0};   // Noise of the loop's readings, see auto_tune()
+
+// Working state of one channel, from the last sweep and the loop, not saved
+#define CHANNEL_STATE(X) \
+    X(adc_q16_t, null_setpoint) \
+    X(adc_q16_t, peak_setpoint) \
+    X(adc_q16_t, quad_setpoint) \
+    X(adc_q16_t, selected_setpoint) \
+    X(adc_q16_t, current_input_voltage) \
+    X(int, current_output_voltage_step) \
+    X(int, peak_voltage_step) \
+    X(int, null_voltage_step) \
+    X(int, vpi_steps) \
+    X(bool, button_pressed)              /* Sweep this channel */ \
+    X(sweep_index_t, sweep_index) \
+    X(sweep_fit_t, last_fit) \
+    X(bool, last_fit_ok) \
+    X(bool, warm_start_pending) \
+    X(int, warm_start_hits) \
+    X(uint64_t, warm_start_us) \
+    X(uint32_t, warm_start_lock_ms) \
+    X(drift_kalman_t, drift_tracker) \
+    X(noise_estimator_t, noise_estimator) \
+    X(rail_stats_t, rail_stats) \
+    X(bool, rail_recovering) \
+    X(uint64_t, rail_hit_us) \
+    X(pid_controller_t, quad_controller) \
+    X(bool, tick_tracking) \
+    X(bool, tick_direction) \
+    X(bool, tick_probing) \
+    X(adc_q16_t, tick_probe_read) \
+    X(int, tick_probe_start) \
+    X(int, tick_probe_steps) \
+    X(int, tick_buffer) \
+    X(int, tick_rail_count) \
+    X(adc_q16_t, tick_prev_difference) \
+    X(adc_q16_t, tick_last_difference) \
+    X(enum setPoint, tick_mode) \
+    X(adc_q16_t, tick_setpoint) \
+    X(lockin_state_t, lockin_state)
+
+// One modulator. The controller code works on the globals, which hold the active channel: channel_select()
+// copies them out to the active channel's slot and the next channel's slot in, ~1 KB each way.
+typedef struct {
+    CHANNEL_PARAMS(CHANNEL_FIELD)
+    CHANNEL_STATE(CHANNEL_FIELD)
+} channel_t;
+
+channel_t channels[CONTROLLER_CHANNELS];
+int active_channel = 0;                 // Channel the globals belong to, 0 outside the per channel loops
+static int channels_running = 1;        // channel_count at boot, the ADC rotation is set up once
+static bool channels_ready = false;     // Slots filled with the defaults
+static const unsigned int channel_pwm_pins[CONTROLLER_CHANNELS] = CHANNEL_PWM_PINS;
+
+void channel_sync();    // Globals to the active channel's slot, defined with the control tick below
+void channel_restore(); // And back
 //------------------------------------------------------------------------------------------------------------------
 
-// Function to calculate simple checksum
-uint32_t calculate_checksum(persistent_params_t *params) {
-    uint32_t sum = 0;
-    uint8_t *data = (uint8_t *)params;
-    // Sum all bytes except the checksum field itself
-    for (int i = 0; i < offsetof(persistent_params_t, checksum); i++) {
-        sum += data[i];
+#define CHANNEL_PARAM_COPY(type, name) to->name = from->name;
+
+// The parameters as they are now, with the calibration from the last sweep
+void current_params(persistent_params_t* params) {
+    memset(params, 0, sizeof(*params)); // Padding too, the record is CRC'd
+    params->magic = PARAM_MAGIC;
+    params->control_rate = control_rate;
+    params->dac_mode = dac_mode;
+    params->adc_oversample = adc_oversample;
+    params->cic_order = cic_order;
+    params->outlier_window = outlier_window;
+    params->outlier_k = outlier_k;
+    params->channel_count = channel_count;
+
+    channel_sync();
+    for (int i = 0; i < CONTROLLER_CHANNELS; i++) {
+        channel_params_t* to = &params->channels[i];
+        const channel_t* from = &channels[i];
+        CHANNEL_PARAMS(CHANNEL_PARAM_COPY)
     }
-    return sum;
 }
 
 void save_params_to_flash() {
-    // Create the parameter structure
-    persistent_params_t params = {
-        .magic = PARAM_MAGIC,
-        .tolerance = tolerance,
-        .quad_buffer = quad_buffer,
-        .null_buffer = null_buffer,
-        .peak_buffer = peak_buffer
-    };
-    params.checksum = calculate_checksum(&params);
-
-    // Save and disable interrupts before flash operations
-    uint32_t ints = save_and_disable_interrupts();
-    
-    // Erase the sector first
-    flash_range_erase(FLASH_TARGET_OFFSET, FLASH_SECTOR_SIZE);
-    
-    // Then program the data
-    flash_range_program(FLASH_TARGET_OFFSET, (uint8_t*)&params, sizeof(params));
-    
-    // Restore interrupts AFTER flash operations
-    restore_interrupts(ints);
-    
-    // Add a small delay to ensure the message is printed before continuing
-    sleep_ms(100);
+    persistent_params_t params;
+
+    current_params(&params);
+
+    // Append to the journal, one program. Erasing is left to param_journal_maintain() at a quiet moment.
+    if (!param_journal_save(&params, sizeof(params))) {
+        console_printf("Parameter save did not verify\n");
+    }
+}
+
+// Store the active channel's calibration with the parameters as they were last saved, so a sweep does not
+// make unsaved 'set' changes persistent. With nothing saved yet the parameters in use are stored.
+void save_calibration_to_flash() {
+    persistent_params_t params;
+
+    if (param_journal_stats.slots == 0) return;   //No journal, a host tool sweeping without controller_setup()
+
+    if (!param_journal_load(&params, sizeof(params)) || params.magic != PARAM_MAGIC) {
+        current_params(&params);
+    }
+    params.channels[active_channel].calibration = calibration;
+
+    if (!param_journal_save(&params, sizeof(params))) {
+        console_printf("Calibration save did not verify\n");
+    }
 }
 
 // Load parameters from flash
 bool load_params_from_flash() {
-    // Access flash memory through XIP base address
-    persistent_params_t* stored_params = (persistent_params_t*)(XIP_BASE + FLASH_TARGET_OFFSET);
-    
-    // Check if the stored data is valid
-    if (stored_params->magic == PARAM_MAGIC) {
-        // Verify checksum
-        uint32_t calculated_checksum = calculate_checksum(stored_params);
-        if (calculated_checksum == stored_params->checksum) {
-            tolerance = stored_params->tolerance;
-            quad_buffer = stored_params->quad_buffer;
-            null_buffer = stored_params->null_buffer;
-            peak_buffer = stored_params->peak_buffer;
-            printf("Parameters loaded from flash\n");
+    persistent_params_t stored;
+    const persistent_params_t* stored_params = &stored;
+
+    // Find the newest record that passes its CRC, then check it has the current layout
+    param_journal_init(FLASH_TARGET_OFFSET, PARAM_JOURNAL_SECTORS);
+
+    if (param_journal_load(&stored, sizeof(stored))) {
+        if (stored_params->magic == PARAM_MAGIC) {
+            control_rate = stored_params->control_rate;
+            dac_mode = stored_params->dac_mode;
+            adc_oversample = stored_params->adc_oversample;
+            cic_order = stored_params->cic_order;
+            outlier_window = stored_params->outlier_window;
+            outlier_k = stored_params->outlier_k;
+            channel_count = stored_params->channel_count;
+
+            channel_sync();
+            for (int i = 0; i < CONTROLLER_CHANNELS; i++) {
+                channel_t* to = &channels[i];
+                const channel_params_t* from = &stored_params->channels[i];
+                CHANNEL_PARAMS(CHANNEL_PARAM_COPY)
+            }
+            channel_restore();
+            console_printf("Parameters loaded from flash\n");
             return true;
         }
     }
-    printf("No valid parameters found in flash\n");
+    console_printf("No valid parameters found in flash\n");
     return false;
 }
 
+int tick_samples(); // Defined with the control tick below
+int dac_settle_ms();
+void apply_dac_mode();
+void apply_adc_filter();
+void log_rail_stats(); // Defined with the rail wrap below
+void log_auto_tune(); // Defined with auto_tune() below
+void log_adc_filter(); // Defined with initialize_adc()
+adc_q16_t move(int voltage_step);
+
 void process_command(char* cmd) {
     char param_name[20];
     float param_value;
+    int channel;
+    int offset = 0;
     
+    // Route "ch N <command>" to channel N, everything else goes to the active channel (0 at the console)
+    if (sscanf(cmd, "ch %d %n", &channel, &offset) == 1 && offset > 0) {
+        if (channel < 0 || channel >= channels_running) {
+            console_printf("Invalid channel. Range: 0 to %d\n", channels_running - 1);
+            return;
+        }
+        int previous = active_channel;
+        channel_select(channel);
+        process_command(cmd + offset);
+        channel_select(previous);
+    }
+    else if (sscanf(cmd, "set auto %19s", param_name) == 1) {
+        if (strcmp(param_name, "on") == 0 || strcmp(param_name, "1") == 0) auto_tune_enabled = 1;
+        else if (strcmp(param_name, "off") == 0 || strcmp(param_name, "0") == 0) auto_tune_enabled = 0;
+        else {
+            console_printf("Usage: set auto on|off\n");
+            return;
+        }
+        console_printf("Auto tuning %s\n", auto_tune_enabled ? "on, tolerance and buffers follow the noise" : "off, the last values stay");
+    }
     // Parse command for parameter updates
-    if (sscanf(cmd, "set %19s %f", param_name, &param_value) == 2) {
+    else if (sscanf(cmd, "set %19s %f", param_name, &param_value) == 2) {
         if (strcmp(param_name, "tolerance") == 0) {
             if (param_value >= 0.0f && param_value <= 0.1f) { //was 0.0032f before for param_value >= etc..
-                tolerance = param_value;
-                printf("Tolerance set to: %.4f V\n", tolerance);
+                tolerance = volts_to_q16(param_value);
+                console_printf("Tolerance set to: %.4f V\n", q16_to_volts(tolerance));
+                if (auto_tune_enabled) console_printf("Auto tuning is on and will replace it, 'set auto off' first\n");
                 //params_changed = true;
             } else {
-                printf("Invalid tolerance value. Range: 0.0032 to 0.1\n");
+                console_printf("Invalid tolerance value. Range: 0.0032 to 0.1\n");
             }
         } 
         else if (strcmp(param_name, "quad_buffer") == 0) {
             if (param_value >= 1 && param_value <= 100) { //was 1 before for param_value >=
                 quad_buffer = (int)param_value;
-                printf("Quad buffer set to: %d\n", quad_buffer);
+                console_printf("Quad buffer set to: %d\n", quad_buffer);
+                if (auto_tune_enabled) console_printf("Auto tuning is on and will replace it, 'set auto off' first\n");
                 //params_changed = true;
             } else {
-                printf("Invalid quad_buffer value. Range: 5 to 100\n");
+                console_printf("Invalid quad_buffer value. Range: 5 to 100\n");
             }
         } 
         else if (strcmp(param_name, "null_buffer") == 0) {
             if (param_value >= 1 && param_value <= 500) { //was 25 before param_value >=
                 null_buffer = (int)param_value;
-                printf("Null buffer set to: %d\n", null_buffer);
+                console_printf("Null buffer set to: %d\n", null_buffer);
+                if (auto_tune_enabled) console_printf("Auto tuning is on and will replace it, 'set auto off' first\n");
                 //params_changed = true;
             } else {
-                printf("Invalid null_buffer value. Range: 25 to 500\n");
+                console_printf("Invalid null_buffer value. Range: 25 to 500\n");
             }
         } 
         else if (strcmp(param_name, "peak_buffer") == 0) {
             if (param_value >= 1 && param_value <= 500) { //was 25 before param_value >=
                 peak_buffer = (int)param_value;
-                printf("Peak buffer set to: %d\n", peak_buffer);
+                console_printf("Peak buffer set to: %d\n", peak_buffer);
+                if (auto_tune_enabled) console_printf("Auto tuning is on and will replace it, 'set auto off' first\n");
                 //params_changed = true;
             } else {
-                printf("Invalid peak_buffer value. Range: 25 to 500\n");
+                console_printf("Invalid peak_buffer value. Range: 25 to 500\n");
+            }
+        } 
+        else if (strcmp(param_name, "dither") == 0) {
+            if (param_value >= 16 && param_value <= 4096) {
+                lockin_dither = (int)param_value;
+                console_printf("Lock-in dither set to: %d steps\n", lockin_dither);
+            } else {
+                console_printf("Invalid dither value. Range: 16 to 4096\n");
+            }
+        } 
+        else if (strcmp(param_name, "lockin_periods") == 0) {
+            if (param_value >= 1 && param_value <= 64) {
+                lockin_periods = (int)param_value;
+                console_printf("Lock-in periods set to: %d\n", lockin_periods);
+            } else {
+                console_printf("Invalid lockin_periods value. Range: 1 to 64\n");
+            }
+        } 
+        else if (strcmp(param_name, "lockin_samples") == 0) {
+            if (param_value >= 16 && param_value <= 4000) {
+                lockin_samples = (int)param_value;
+                console_printf("Lock-in samples set to: %d\n", lockin_samples);
+            } else {
+                console_printf("Invalid lockin_samples value. Range: 16 to 4000\n");
+            }
+        } 
+        else if (strcmp(param_name, "quad_pid") == 0) {
+            quad_pid = (param_value != 0.0f);
+            console_printf("Quad PID %s\n", quad_pid ? "enabled" : "disabled");
+        } 
+        else if (strcmp(param_name, "kp") == 0 || strcmp(param_name, "ki") == 0 || strcmp(param_name, "kd") == 0) {
+            if (param_value >= 0.0f && param_value <= 20000.0f) {
+                if (param_name[1] == 'p') kp = param_value;
+                else if (param_name[1] == 'i') ki = param_value;
+                else kd = param_value;
+                console_printf("%s set to: %.1f\n", param_name, param_value);
+            } else {
+                console_printf("Invalid %s value. Range: 0 to 20000\n", param_name);
+            }
+        } 
+        else if (strcmp(param_name, "fit") == 0) {
+            sweep_fit_enabled = (param_value != 0.0f);
+            console_printf("Sweep fit %s\n", sweep_fit_enabled ? "enabled" : "disabled");
+        } 
+        else if (strcmp(param_name, "sweep_average") == 0) {
+            if (param_value >= 16 && param_value <= 4000) {
+                sweep_average = (int)param_value;
+                console_printf("Sweep average set to: %d samples\n", sweep_average);
+            } else {
+                console_printf("Invalid sweep_average value. Range: 16 to 4000\n");
+            }
+        } 
+        else if (strcmp(param_name, "coarse_points") == 0) {
+            int points = (int)param_value;
+            //Power of two so the coarse grid lands on the full resolution grid
+            if (points == 0 || (points >= 16 && points <= 1024 && (points & (points - 1)) == 0)) {
+                coarse_points = points;
+                console_printf("Coarse points set to: %d%s\n", coarse_points, coarse_points ? "" : " (full sweep)");
+            } else {
+                console_printf("Invalid coarse_points value. 0 or a power of two from 16 to 1024\n");
+            }
+        } 
+        else if (strcmp(param_name, "refine_window") == 0) {
+            if (param_value >= 64 && param_value <= 8192) {
+                refine_window = (int)param_value;
+                console_printf("Refine window set to: %d steps\n", refine_window);
+            } else {
+                console_printf("Invalid refine_window value. Range: 64 to 8192\n");
+            }
+        } 
+        else if (strcmp(param_name, "quad_window") == 0) {
+            if (param_value >= 0 && param_value <= 8192) {
+                quad_window = (int)param_value;
+                console_printf("Quad window set to: %d steps\n", quad_window);
+            } else {
+                console_printf("Invalid quad_window value. Range: 0 to 8192\n");
+            }
+        } 
+        else if (strcmp(param_name, "rate") == 0) {
+            if (param_value == 0 || (param_value >= 10 && param_value <= 5000)) {
+                control_rate = (int)param_value;
+                if (control_rate) console_printf("Control rate set to: %d Hz\n", control_rate);
+                else console_printf("Control rate set to: polling once a second\n");
+            } else {
+                console_printf("Invalid rate value. 0 or 10 to 5000 Hz\n");
+            }
+        } 
+        else if (strcmp(param_name, "max_step") == 0) {
+            if (param_value >= 1 && param_value <= 4096) {
+                tick_max_step = (int)param_value;
+                console_printf("Max step per tick set to: %d\n", tick_max_step);
+            } else {
+                console_printf("Invalid max_step value. Range: 1 to 4096\n");
+            }
+        } 
+        else if (strcmp(param_name, "dac") == 0) {
+            dac_mode = (param_value != 0.0f) ? HAL_DAC_DITHER : HAL_DAC_PWM;
+            apply_dac_mode();
+            console_printf("DAC set to: %s\n", dac_mode == HAL_DAC_DITHER ? "dithered 488 kHz PWM" : "16-bit PWM");
+        } 
+        else if (strcmp(param_name, "oversample") == 0) {
+            if (param_value >= 0 && param_value <= ADC_CIC_MAX_SHIFT / 2) {
+                adc_oversample = (int)param_value;
+                apply_adc_filter();
+                log_adc_filter();
+            } else {
+                console_printf("Invalid oversample value. Range: 0 to %d\n", ADC_CIC_MAX_SHIFT / 2);
+            }
+        } 
+        else if (strcmp(param_name, "cic_order") == 0) {
+            if (param_value >= 1 && param_value <= ADC_CIC_MAX_ORDER) {
+                cic_order = (int)param_value;
+                apply_adc_filter();
+                log_adc_filter();
+            } else {
+                console_printf("Invalid cic_order value. Range: 1 to %d\n", ADC_CIC_MAX_ORDER);
+            }
+        } 
+        else if (strcmp(param_name, "outliers") == 0) {
+            if (param_value == 0.0f || (param_value >= 3 && param_value <= ADC_HAMPEL_MAX_WINDOW)) {
+                outlier_window = (int)param_value | (param_value != 0.0f);   //Odd, the median is a sample
+                apply_adc_filter();
+                log_adc_filter();
+            } else {
+                console_printf("Invalid outliers value. Range: 0 (off), 3 to %d samples\n", ADC_HAMPEL_MAX_WINDOW);
+            }
+        } 
+        else if (strcmp(param_name, "outlier_k") == 0) {
+            if (param_value >= 1.0f && param_value <= 10.0f) {
+                outlier_k = param_value;
+                apply_adc_filter();
+                log_adc_filter();
+            } else {
+                console_printf("Invalid outlier_k value. Range: 1 to 10 MADs\n");
+            }
+        } 
+        else if (strcmp(param_name, "drift_tracker") == 0) {
+            drift_tracker_enabled = (param_value != 0.0f);
+            drift_kalman_reset(&drift_tracker, DRIFT_PROCESS_NOISE);
+            console_printf("Drift tracker set to: %s\n", drift_tracker_enabled ? "on" : "off");
+        } 
+        else if (strcmp(param_name, "channels") == 0) {
+            if (param_value >= 1 && param_value <= CONTROLLER_CHANNELS) {
+                channel_count = (int)param_value;
+                console_printf("Channels set to: %d, save and reboot to apply\n", channel_count);
+            } else {
+                console_printf("Invalid channels value. Range: 1 to %d\n", CONTROLLER_CHANNELS);
             }
         } 
         else {
-            printf("Unknown parameter: %s\n", param_name);
+            console_printf("Unknown parameter: %s\n", param_name);
         }
         
     } 
     else if (strcmp(cmd, "status") == 0) {
         // Print current parameter values
-        printf("\n--- CURRENT PARAMETERS ---\n");
-        printf("Tolerance    : %.4f\n", tolerance);
-        printf("Quad Buffer  : %d\n", quad_buffer);
-        printf("Null Buffer  : %d\n", null_buffer);
-        printf("Peak Buffer  : %d\n", peak_buffer);
-        printf("Gain         : %d (fixed)\n", GAIN);
-        printf("------------------------\n\n");
+        console_printf("\n--- CURRENT PARAMETERS ---\n");
+        console_printf("Channel      : %d of %d (ADC input %d, PWM GPIO %u)", active_channel, channels_running, active_channel, channel_pwm_pins[active_channel]);
+        if (channel_count != channels_running) console_printf(", %d after reboot", channel_count);
+        console_printf("\n");
+        console_printf("Tolerance    : %.4f%s\n", q16_to_volts(tolerance), auto_tune_enabled ? " (auto)" : "");
+        console_printf("Quad Buffer  : %d%s\n", quad_buffer, auto_tune_enabled ? " (auto)" : "");
+        console_printf("Null Buffer  : %d%s\n", null_buffer, auto_tune_enabled ? " (auto)" : "");
+        console_printf("Peak Buffer  : %d%s\n", peak_buffer, auto_tune_enabled ? " (auto)" : "");
+        log_auto_tune();
+        console_printf("Gain         : %d (fixed)\n", GAIN);
+        console_printf("Dither       : %d steps x %d periods, %d samples\n", lockin_dither, lockin_periods, lockin_samples);
+        console_printf("Vpi          : %d steps\n", vpi_steps);
+        console_printf("Sweep index  : %d null, %d peak, %d quad+, %d quad- lock points\n",
+            sweep_index.null_count, sweep_index.peak_count, sweep_index.quad_plus_count, sweep_index.quad_minus_count);
+        console_printf("Quad PID     : %s (kp %.1f, ki %.1f, kd %.1f)\n", quad_pid ? "on" : "off", kp, ki, kd);
+        console_printf("Sweep fit    : %s (%d samples per point)\n", sweep_fit_enabled ? "on" : "off", sweep_average);
+        if (coarse_points) console_printf("Sweep        : %d coarse points, refine +/-%d steps, quad +/-%d steps\n", coarse_points, refine_window, quad_window);
+        else console_printf("Sweep        : full resolution\n");
+        if (control_rate) {
+            console_printf("Control tick : %d Hz per channel (%d updates/s in all), max %d steps, %d samples per read\n",
+                control_rate, control_rate * channels_running, tick_max_step, tick_samples());
+            console_printf("Tick stats   : %lu ticks, %lu overruns, late mean %.1f us / jitter %.1f us / max %lu us, busy max %lu us\n",
+                (unsigned long)control_tick_stats.ticks, (unsigned long)control_tick_stats.overruns,
+                control_tick_stats.late_mean_us, control_tick_jitter_us(), (unsigned long)control_tick_stats.late_max_us,
+                (unsigned long)control_tick_stats.busy_max_us);
+        }
+        else console_printf("Control tick : off, polling once a second\n");
+        if (!drift_tracker_enabled) console_printf("Drift tracker: off\n");
+        else if (!drift_tracker.valid) console_printf("Drift tracker: on, waiting for a measurement\n");
+        else {
+            console_printf("Drift tracker: lock point %.0f steps (+/-%.0f), drift %+.1f +/-%.1f steps/s (%+.5f rad/s)\n",
+                drift_tracker.position, sqrtf(drift_tracker.p00), drift_tracker.rate, sqrtf(drift_tracker.p11), drift_tracker.rate * PI / vpi_steps);
+            console_printf("Drift updates: %lu, %lu gated out, last innovation %.1f steps\n",
+                (unsigned long)drift_tracker.updates, (unsigned long)drift_tracker.rejected, drift_tracker.innovation);
+        }
+        console_printf("Rail edges   : %lu wrapped, %lu searched, last recovery %lu ms, max %lu ms ('edges' for the histogram)\n",
+            (unsigned long)rail_stats.wraps, (unsigned long)rail_stats.searches, (unsigned long)rail_stats.last_ms, (unsigned long)rail_stats.max_ms);
+        console_printf("Param journal: record %lu in slot %d of %d, %lu erases (%lu forced)%s\n",
+            (unsigned long)param_journal_stats.sequence, param_journal_stats.newest_slot, param_journal_stats.slots,
+            (unsigned long)param_journal_stats.erases, (unsigned long)param_journal_stats.forced_erases,
+            param_journal_erase_pending() ? ", erase pending" : "");
+        console_printf("DAC          : %s, %d ms settle\n", dac_mode == HAL_DAC_DITHER ? "dithered 488 kHz PWM" : "16-bit PWM", dac_settle_ms());
+        log_adc_filter();
+        console_printf("Console      : %lu bytes dropped\n", (unsigned long)console_dropped());
+        console_printf("Telemetry    : %s, %lu frames, %lu dropped\n", telemetry_enabled ? "streaming" : "off",
+            (unsigned long)telemetry_frames(), (unsigned long)telemetry_dropped());
+        if (calibration.valid != CALIBRATION_VALID)
+            console_printf("Calibration  : none stored, boot sweeps\n");
+        else if (warm_start_pending)
+            console_printf("Calibration  : stored, warm start waiting for the lock\n");
+        else if (warm_start_lock_ms > 0)
+            console_printf("Calibration  : stored, warm start locked in %lu ms\n", (unsigned long)warm_start_lock_ms);
+        else
+            console_printf("Calibration  : stored, vpi %d steps, quad+ %d, quad- %d\n", calibration.vpi_steps, calibration.quad_plus_step, calibration.quad_minus_step);
+        log_selected_setpoint();
+        console_printf("------------------------\n\n");
     } 
     else if (strcmp(cmd, "help") == 0) {
-        printf("\n--- COMMAND HELP ---\n");
-        printf("set tolerance [value]    - Set tolerance (0.0032 to 0.1)\n");
-        printf("set quad_buffer [value]  - Set quad buffer (5 to 100)\n");
-        printf("set null_buffer [value]  - Set null buffer (25 to 500)\n");
-        printf("set peak_buffer [value]  - Set peak buffer (25 to 500)\n");
-        printf("save                     - Save current parameters to flash memory\n");
-        printf("status                   - Show current parameter values\n");
-        printf("sweep                    - Force a new sweep operation\n");
-        printf("help                     - Show this help menu\n");
-        printf("TIP: Add --save to any set command to immediately save to flash\n");
-        printf("     Example: set tolerance 0.01 --save\n");
-        printf("--------------------\n\n");
+        console_printf("\n--- COMMAND HELP ---\n");
+        console_printf("set tolerance [value]    - Set tolerance (0.0032 to 0.1)\n");
+        console_printf("set quad_buffer [value]  - Set quad buffer (5 to 100)\n");
+        console_printf("set null_buffer [value]  - Set null buffer (25 to 500)\n");
+        console_printf("set peak_buffer [value]  - Set peak buffer (25 to 500)\n");
+        console_printf("set dither [value]       - Set lock-in dither amplitude in DAC steps (16 to 4096)\n");
+        console_printf("set lockin_periods [val] - Set dither periods per lock-in correction (1 to 64)\n");
+        console_printf("set lockin_samples [val] - Set ADC samples per dither half period (16 to 4000)\n");
+        console_printf("set quad_pid [0/1]       - Use the PID controller for quad locking\n");
+        console_printf("set kp|ki|kd [value]     - Set quad PID gains (0 to 20000)\n");
+        console_printf("set fit [0/1]            - Fit the transfer function to the sweep for the setpoints\n");
+        console_printf("set sweep_average [val]  - ADC samples per sweep point with the fit on (16 to 4000)\n");
+        console_printf("set coarse_points [val]  - Coarse sweep points (power of two 16 to 1024, 0 for a full sweep)\n");
+        console_printf("set refine_window [val]  - DAC steps re-swept either side of the coarse peak/null (64 to 8192)\n");
+        console_printf("set quad_window [val]    - DAC steps re-swept either side of each quad crossing (0 to 8192)\n");
+        console_printf("set rate [Hz]            - Control ticks per second (10 to 5000, 0 for 1 s polling)\n");
+        console_printf("set max_step [val]       - Largest DAC correction per control tick (1 to 4096)\n");
+        console_printf("set dac [0/1]            - 0 for the 16-bit PWM DAC, 1 for the dithered 488 kHz PWM\n");
+        console_printf("set oversample [0-4]     - CIC decimation 4^n on every read, 0 for the plain mean\n");
+        console_printf("set cic_order [1-3]      - Stages of the CIC decimator\n");
+        console_printf("set outliers [0,3-15]    - Hampel filter window on the samples of every read, 0 off\n");
+        console_printf("set outlier_k [MADs]     - Deviation from the window median that counts as an outlier (1 to 10)\n");
+        console_printf("set drift_tracker [0/1]  - Feed the Kalman drift estimate forward every control tick\n");
+        console_printf("set auto on|off          - Derive tolerance and the buffers from the measured noise and slope\n");
+        console_printf("set channels [1-%d]       - Modulators driven, one per ADC input (save and reboot to apply)\n", CONTROLLER_CHANNELS);
+        console_printf("ch [n] [command]         - Run a set, mode, status, sweep or edges command on channel n\n");
+        console_printf("mode [name]              - Select null, peak, quad+, quad-, null_lockin or peak_lockin\n");
+        console_printf("stream on|off            - Binary telemetry frame for every ADC read (telemetry.h)\n");
+        console_printf("edges                    - DAC rail wrap count and recovery time histogram\n");
+        console_printf("bench [iterations]       - Cycles per control iteration, float against fixed point (default 2000)\n");
+        console_printf("save                     - Save current parameters to flash memory\n");
+        console_printf("status                   - Show current parameter values\n");
+        console_printf("sweep                    - Force a new sweep operation\n");
+        console_printf("help                     - Show this help menu\n");
+        console_printf("TIP: Add --save to any set command to immediately save to flash\n");
+        console_printf("     Example: set tolerance 0.01 --save\n");
+        console_printf("--------------------\n\n");
+    }
+    else if (sscanf(cmd, "mode %19s", param_name) == 1) {
+        if (strcmp(param_name, "null") == 0) set_point = NULL_POINT;
+        else if (strcmp(param_name, "peak") == 0) set_point = PEAK_POINT;
+        else if (strcmp(param_name, "quad+") == 0) set_point = QUAD_PLUS;
+        else if (strcmp(param_name, "quad-") == 0) set_point = QUAD_MINUS;
+        else if (strcmp(param_name, "null_lockin") == 0) set_point = NULL_LOCKIN;
+        else if (strcmp(param_name, "peak_lockin") == 0) set_point = PEAK_LOCKIN;
+        else {
+            console_printf("Unknown mode: %s\n", param_name);
+            return;
+        }
+        //Same jump to the new lock point as after a sweep, the control loop only tracks from there
+        go_to_desired_setpoint();
+        log_selected_setpoint();
+        if (control_tick_stats.rate_hz) control_tick_resync(); //The move is not a loop overrun
+    }
+    else if (sscanf(cmd, "stream %19s", param_name) == 1) {
+        if (strcmp(param_name, "on") == 0) telemetry_enabled = true;
+        else if (strcmp(param_name, "off") == 0) telemetry_enabled = false;
+        else {
+            console_printf("Usage: stream on|off\n");
+            return;
+        }
+        console_printf("Telemetry stream %s\n", telemetry_enabled ? "on" : "off");
+    }
+    else if (strncmp(cmd, "bench", 5) == 0 && (cmd[5] == '\0' || cmd[5] == ' ')) {
+        int iterations = 2000;
+        sscanf(cmd + 5, "%d", &iterations);
+        if (iterations < 64 || iterations > 100000) {
+            console_printf("Iterations must be between 64 and 100000\n");
+            return;
+        }
+        control_bench_run(iterations);
+    }
+    else if (strcmp(cmd, "edges") == 0) {
+        log_rail_stats();
     }
     else if (strcmp(cmd, "sweep") == 0) {
-        printf("Initiating manual sweep...\n");
+        console_printf("Initiating manual sweep...\n");
         button_pressed = true;
     }
     else if (strcmp(cmd, "save") == 0) {
@@ -240,82 +724,85 @@ void process_command(char* cmd) {
         save_pending = true;
     }
     else if (strcmp(cmd, "reset") == 0) {
-        printf("Resetting parameters to defaults...\n");
-        tolerance = 0.05f;
+        console_printf("Resetting parameters to defaults...\n");
+        tolerance = VOLTS_Q16(0.05f);
         quad_buffer = 10;
         peak_buffer = 50;
         null_buffer = 50;
+        lockin_dither = 256;
+        lockin_periods = 4;
+        lockin_samples = 500;
+        quad_pid = 0;
+        kp = 2000.0f;
+        ki = 4000.0f;
+        kd = 0.0f;
+        sweep_fit_enabled = 1;
+        sweep_average = 64;
+        coarse_points = 128;
+        refine_window = 512;
+        quad_window = 128;
+        control_rate = 100;
+        tick_max_step = 64;
+        dac_mode = HAL_DAC_PWM;
+        adc_oversample = 0;
+        cic_order = 2;
+        outlier_window = 0;
+        outlier_k = 3.0f;
+        drift_tracker_enabled = 1;
+        auto_tune_enabled = 0;
+        apply_dac_mode();
+        apply_adc_filter();
         //params_changed = true;
-        printf("Parameters reset. Type 'save' to store in flash.\n");
+        console_printf("Parameters reset. Type 'save' to store in flash.\n");
     }
     else {
-        printf("Unknown command. Type 'help' for available commands.\n");
+        console_printf("Unknown command. Type 'help' for available commands.\n");
     }
 }
 
-// Process any received characters and handle commands
+// Run every command line core 0 has queued since the last call
 void check_serial_input() {
-    int c;
-    
-    // Non-blocking check for any available characters
-    while ((c = getchar_timeout_us(0)) != PICO_ERROR_TIMEOUT) {
-        // Echo received character back to terminal
-        putchar(c);
-        
-        if (c == '\r' || c == '\n') {
-            if (cmd_index > 0) {
-                cmd_buffer[cmd_index] = '\0';  // Null terminate
-                cmd_ready = true;
-                putchar('\n');  // Echo newline
-            }
-        } 
-        else if (c == 8 || c == 127) {  // Backspace or Delete
-            if (cmd_index > 0) {
-                cmd_index--;
-                // Echo backspace-space-backspace to erase character on terminal
-                putchar(8);
-                putchar(' ');
-                putchar(8);
-            }
-        } 
-        else if (cmd_index < MAX_CMD_LEN - 1) {
-            cmd_buffer[cmd_index++] = c;
-        }
-    }
-    
-    if (cmd_ready) {
+#ifdef BIAS_HOST_BUILD
+    console_service(); // No second core on the host, read the input here
+#endif
+
+    // Commands without 'ch' are for channel 0, whichever channel this is called from
+    int previous = active_channel;
+
+    while (console_next_command(cmd_buffer, MAX_CMD_LEN)) {
+        channel_select(0);
         process_command(cmd_buffer);
-        cmd_index = 0;
-        cmd_ready = false;
     }
+    channel_select(previous);
 }
+
 //LOGGING
 
 void log_index_error(int index) 
 {
-    printf("Indexing error: invalid index %d encountered. Please check array bounds.\n", index);
-    printf("\n");
+    console_printf("Indexing error: invalid index %d encountered. Please check array bounds.\n", index);
+    console_printf("\n");
 }
 
 void log_pwm_scan_complete() 
 {
-    printf("PWM SCAN COMPLETE\n");
+    console_printf("PWM SCAN COMPLETE\n");
 
-    printf("%-10s: %.4f V\n", "PEAK", peak_setpoint);
-    printf("%-10s: %.4f V\n", "NULL", null_setpoint);
-    printf("%-10s: %.4f V\n", "QUAD", quad_setpoint);
+    console_printf("%-10s: %.4f V\n", "PEAK", q16_to_volts(peak_setpoint));
+    console_printf("%-10s: %.4f V\n", "NULL", q16_to_volts(null_setpoint));
+    console_printf("%-10s: %.4f V\n", "QUAD", q16_to_volts(quad_setpoint));
 
-    printf("\n");
+    console_printf("\n");
 }
 
 void log_incompatible_array_size(int expected_size, int actual_size) 
 {
-    printf("ARRAY SIZE ERROR\n");
+    console_printf("ARRAY SIZE ERROR\n");
 
-    printf("%-20s: %d\n", "Expected size", expected_size);
-    printf("%-20s: %d\n", "Actual size", actual_size);
+    console_printf("%-20s: %d\n", "Expected size", expected_size);
+    console_printf("%-20s: %d\n", "Actual size", actual_size);
 
-    printf("\n");
+    console_printf("\n");
 }
 
 void log_selected_setpoint() 
@@ -323,129 +810,219 @@ void log_selected_setpoint()
     //Check which setpoint was selected and log it
     if (set_point == PEAK_POINT) 
     {
-        printf("SELECTED SETPOINT: PEAK\n");
+        console_printf("SELECTED SETPOINT: PEAK\n");
     }
     else if (set_point == QUAD_PLUS) 
     {
-        printf("SELECTED SETPOINT: QUAD PLUS\n");
+        console_printf("SELECTED SETPOINT: QUAD PLUS\n");
     }
     else if (set_point == QUAD_MINUS) 
     {
-        printf("SELECTED SETPOINT: QUAD MINUS\n");
+        console_printf("SELECTED SETPOINT: QUAD MINUS\n");
     }
     else if (set_point == NULL_POINT) 
     {
-        printf("SELECTED SETPOINT: NULL\n");
+        console_printf("SELECTED SETPOINT: NULL\n");
+    }
+    else if (set_point == NULL_LOCKIN) 
+    {
+        console_printf("SELECTED SETPOINT: NULL (LOCK-IN)\n");
+    }
+    else if (set_point == PEAK_LOCKIN) 
+    {
+        console_printf("SELECTED SETPOINT: PEAK (LOCK-IN)\n");
     }
     else 
     {
         //If set_point does not match known values, log an error
-        printf("SELECTED SETPOINT: UNKNOWN\n");
+        console_printf("SELECTED SETPOINT: UNKNOWN\n");
     }
 
-    printf("\n");
+    console_printf("\n");
 }
 
-void log_setpoint_reached(float read, float difference) 
+void log_setpoint_reached(adc_q16_t read, adc_q16_t difference)
 {
 
-    printf("Setpoint reached   :\n");
-    printf("Selected setpoint  : %.4f V\n", selected_setpoint);
-    printf("Read value         : %.4f V\n", read);
-    printf("Tolerance          : %.4f V\n", tolerance);
-    printf("Difference         : %.4f V\n", difference);
+    console_printf("Setpoint reached   :\n");
+    console_printf("Selected setpoint  : %.4f V\n", q16_to_volts(selected_setpoint));
+    console_printf("Read value         : %.4f V\n", q16_to_volts(read));
+    console_printf("Tolerance          : %.4f V\n", q16_to_volts(tolerance));
+    console_printf("Difference         : %.4f V\n", q16_to_volts(difference));
 
     // Add an extra newline at the end of the log for separation
-    printf("\n");
+    console_printf("\n");
 }
 
 void display_startup_message() {
-    printf("\n\n");
-    printf("==========================================\n");
-    printf("     PWM Control System with Serial UI    \n");
-    printf("==========================================\n");
-    printf("Current Parameters:\n");
-    printf("  Tolerance    : %.4f\n", tolerance);
-    printf("  Quad Buffer  : %d\n", quad_buffer);
-    printf("  Null Buffer  : %d\n", null_buffer);
-    printf("  Peak Buffer  : %d\n", peak_buffer);
-    printf("  Gain         : %d (fixed)\n", GAIN);
-    printf("\n");
-    printf("Type 'help' for available commands\n");
-    printf("==========================================\n\n");
+    console_printf("\n\n");
+    console_printf("==========================================\n");
+    console_printf("     PWM Control System with Serial UI    \n");
+    console_printf("==========================================\n");
+    console_printf("Current Parameters:\n");
+    console_printf("  Tolerance    : %.4f\n", q16_to_volts(tolerance));
+    console_printf("  Quad Buffer  : %d\n", quad_buffer);
+    console_printf("  Null Buffer  : %d\n", null_buffer);
+    console_printf("  Peak Buffer  : %d\n", peak_buffer);
+    console_printf("  Gain         : %d (fixed)\n", GAIN);
+    console_printf("\n");
+    console_printf("Type 'help' for available commands\n");
+    console_printf("==========================================\n\n");
 }
 
 //-------------------------------------------------------------------------------------------------------------------
 
 //Functional Code
 
-float set_precision(float value) //truncate all values to third decimal place (reason: ADC: 0.0008 resolution, truncate to 0.000)
+void initialize_adc() 
 {
-    value = value * 1000.0f;
-    value = floor(value);
-    value = value / 1000.0f;
-    
-    return value;
+    hal_adc_init(channels_running);  // Free-running at max rate, inputs 0 (GPIO 26) .. channels - 1 in rotation
+    apply_adc_filter();
 }
 
-void initialize_adc() 
+// Decimation of the CIC stage as a shift. Each factor 4 halves the noise of an output, how many bits that is
+// worth depends on the noise there is to dither with, adc_ring_stub measures it.
+static int adc_filter_shift()
+{
+    return 2 * adc_oversample;
+}
+
+void apply_adc_filter()
+{
+    hal_adc_filter(adc_oversample > 0 ? cic_order : 0, adc_filter_shift());
+    hal_adc_outliers(outlier_window, outlier_k);
+}
+
+void log_adc_filter()
+{
+    if (outlier_window > 0)
+    {
+        uint32_t samples;
+        uint32_t rejected = hal_adc_rejected(&samples);
+
+        console_printf("ADC          : 12 bits, Hampel window %d, %.1f MADs, %lu of %lu samples of input %d rejected%s\n", outlier_window,
+            outlier_k, (unsigned long)rejected, (unsigned long)samples, active_channel, adc_oversample > 0 ? " (CIC off while on)" : "");
+    }
+    else if (adc_oversample == 0)
+    {
+        console_printf("ADC          : 12 bits, plain mean of each read\n");
+    }
+    else
+    {
+        console_printf("ADC          : 12 bits, CIC order %d decimating %d, %.0f outputs/s per input\n",
+            cic_order, 1 << adc_filter_shift(), ADC_SAMPLES_PER_US * 1e6f / channels_running / (1 << adc_filter_shift()));
+    }
+}
+
+// Samples to wait for so that a read of n samples only holds samples taken after the wait started: with the
+// decimator that is whole outputs, plus the order - 1 outputs an output reaches back, with the outlier filter
+// the window - 1 samples it is primed with, or the first samples after a DAC step would be taken for outliers
+int adc_span(int samples)
 {
-    adc_init();  
-    adc_select_input(ADC_INPUT);  // Select ADC input 0 (GPIO 26)
-    //adc_set_clkdiv(96000);        // Set sampling rate to 500 samples per second
-    adc_set_clkdiv(1); // Set sampling rate to max
+    if (outlier_window > 0) return samples + outlier_window - 1;
+    if (adc_oversample == 0) return samples;
+
+    int shift = adc_filter_shift();
+    int outputs = samples >> shift;
+
+    if (outputs < 1) outputs = 1;
+    return (outputs + cic_order) << shift;
 }
 
 void initialize_pwm() 
 {
-    gpio_set_function(PWM_PIN, GPIO_FUNC_PWM);
-    uint slice_num = pwm_gpio_to_slice_num(PWM_PIN);
-    pwm_config config = pwm_get_default_config();
-    pwm_config_set_clkdiv(&config, 1.f); // Set to fastest frequency to work with external RC filter
-    pwm_init(slice_num, &config, true);  // Start PWM with the config
+    for (int i = 0; i < channels_running; i++)
+    {
+        hal_pwm_init(channel_pwm_pins[i]);    // Fastest PWM clock to work with external RC filter
+    }
 }
 
 void initialize_button()
 {
-    gpio_init(BUTTON_PIN);
-    gpio_set_dir(BUTTON_PIN, GPIO_IN);
-    gpio_pull_up(BUTTON_PIN);
+    hal_gpio_init_input(BUTTON_PIN, true);
 }
 
 void initialize_led()
 {
-    gpio_init(LED_PIN);
-    gpio_set_dir(LED_PIN, GPIO_OUT);
+    hal_gpio_init_output(LED_PIN);
 }
 
 void initialize_shorts()
 {
-    gpio_init(NULL_PIN);
-    gpio_init(QUAD_PLUS_PIN);
-    gpio_init(QUAD_MINUS_PIN);
-    gpio_init(QUAD_PLUS_PIN);
-    gpio_set_dir(NULL_PIN, GPIO_IN);
-    gpio_set_dir(QUAD_MINUS_PIN, GPIO_IN);
-    gpio_set_dir(QUAD_PLUS_PIN, GPIO_IN);
-    gpio_set_dir(PEAK_PIN, GPIO_IN);
+    hal_gpio_init_input(NULL_PIN, false);
+    hal_gpio_init_input(QUAD_MINUS_PIN, false);
+    hal_gpio_init_input(QUAD_PLUS_PIN, false);
+    hal_gpio_init_input(PEAK_PIN, false);
 }
 
-float read_voltage() 
+// Mean of the samples already captured from the active channel's input, through the outlier filter or the
+// decimator when one is on. Every reading goes through here, the lock-in's too.
+adc_q16_t read_adc_captured(int samples)
 {
-    uint16_t raw_value = adc_read(); 
-    
-    const float conversion_factor = MAX_VOLTAGE / MAX_12BIT_STEPS;  // 12-bit ADC, range is 4096 bits
-    
-    float total_voltage = 0;
-    
-    for (int i = 0; i < average_per_read; i++) {
-        float voltage = raw_value * conversion_factor;
-        total_voltage += voltage;
-        //sleep_ms(2); //Allow ADC to settle 
-        //removed sleep for higher sample rate but higher average
+    if (outlier_window > 0) return hal_adc_robust(samples);
+    if (adc_oversample > 0) return hal_adc_filtered(samples);
+    return hal_adc_mean(samples);
+}
+
+// The same as a reading of the control loop, streamed to telemetry. The control tick waits once for all the
+// channels, read_voltage_averaged() waits first.
+adc_q16_t read_voltage_captured(int samples)
+{
+    adc_q16_t counts = read_adc_captured(samples);
+
+    if (telemetry_enabled)
+    {
+        telemetry_sample(current_output_voltage_step, counts, counts - selected_setpoint,
+            set_point | (active_channel << TELEMETRY_CHANNEL_SHIFT),
+            (sweep_active ? TELEMETRY_FLAG_SWEEP : 0) | (rail_recovering ? TELEMETRY_FLAG_RAIL : 0));
     }
 
-    return set_precision(total_voltage / average_per_read);
+    return counts;
+}
+
+// Mean detector level in Q16 ADC counts. No float on the sample path, and the mean keeps 1/65536 of a count
+// where the old set_precision() truncated every reading to the millivolt.
+adc_q16_t read_voltage_averaged(int samples)
+{
+    //Wait for samples taken after the last DAC change, then average them from the DMA ring
+    hal_adc_wait(adc_span(samples));
+
+    return read_voltage_captured(samples);
+}
+
+// The channels share the ADC, each gets its share of the samples so a read takes as long as with one
+adc_q16_t read_voltage()  
+{
+    return read_voltage_averaged(average_per_read / channels_running);
+}
+
+// Full scale settling time of the RC filter behind the selected DAC back end, only channel 0 can dither
+int dac_settle_ms()
+{
+    return (dac_mode == HAL_DAC_DITHER && active_channel == 0) ? DAC_SETTLE_MS_DITHER : DAC_SETTLE_MS;
+}
+
+// One RC time constant of the same filter in ADC samples per input, what hal_adc_wait() counts
+int dac_tau_samples()
+{
+    return (int)(ADC_SAMPLES_PER_US * 1000.0f * dac_settle_ms() / DAC_SETTLE_TAUS / channels_running);
+}
+
+// Time the ADC takes for that many samples of every input
+uint32_t adc_samples_us(int samples)
+{
+    return (uint32_t)(samples * channels_running / ADC_SAMPLES_PER_US);
+}
+
+// Switch channel 0's pin to the selected DAC back end and put its level back
+void apply_dac_mode()
+{
+    int previous = active_channel;
+
+    channel_select(0);
+    hal_pwm_set_mode(PWM_PIN, dac_mode);
+    set_pwm_dac(current_output_voltage_step);
+    channel_select(previous);
 }
 
 void set_pwm_dac(int voltage_step) 
@@ -457,21 +1034,21 @@ void set_pwm_dac(int voltage_step)
     // Truncate the last 4 bits to make it a 12-bit value
     //voltage_step &= 0xFFF0;  // Mask out the last 4 bits
 
-    //Set the PWM level on the GPIO pin
-    pwm_set_gpio_level(PWM_PIN, voltage_step);
+    //Set the PWM level on the active channel's GPIO pin
+    hal_pwm_set(channel_pwm_pins[active_channel], voltage_step);
 
     current_output_voltage_step = voltage_step;
 
 }
 
-void detect_peak(const float* result_array, size_t arraySize) 
+void detect_peak(const adc_q16_t* result_array, size_t arraySize)
 {
-    
+
     peak_setpoint = 0; //Reset peak setpoint in the case of another sweep
-    
+
     //Initialize variables
-    float current_read = 0.0f;
-    float previous_read = 0.0f;
+    adc_q16_t current_read = 0;
+    adc_q16_t previous_read = 0;
      
     //Ensure the array size is valid
     if (result_array == NULL || arraySize <= 1) 
@@ -497,6 +1074,7 @@ void detect_peak(const float* result_array, size_t arraySize)
         if (current_read > peak_setpoint) 
         {
                 peak_setpoint = current_read;
+                peak_voltage_step = i * (MAX_16BIT_STEPS / arraySize);
         }
 
         previous_read = current_read;  //Record previous read for next iteration
@@ -505,13 +1083,13 @@ void detect_peak(const float* result_array, size_t arraySize)
            
 }
 
-void detect_null(const float* result_array, size_t arraySize) {
+void detect_null(const adc_q16_t* result_array, size_t arraySize) {
+
+    null_setpoint = MAX_12BIT_STEPS * Q16_ONE; //Reset null setpoint and initialize to full scale to narrow to it's minimum
 
-    null_setpoint = MAX_VOLTAGE; //Reset null setpoint and initialize to MAX_VOLTAGE to narrow to it's minimum
-    
     //Initialize variables
-    float current_read  = 0.0f;
-    float previous_read = 0.0f;
+    adc_q16_t current_read  = 0;
+    adc_q16_t previous_read = 0;
 
     // Ensure the array size is valid
     if (result_array == NULL || arraySize <= 1) 
@@ -538,13 +1116,14 @@ void detect_null(const float* result_array, size_t arraySize) {
         {
 
                 //Ignore values under the noise floor of the external circuit
-                if (current_read < NOISE_FLOOR) {
+                if (current_read < NOISE_FLOOR_Q16) {
                     
                 }
 
                 else {
 
                 null_setpoint = current_read;
+                null_voltage_step = i * (MAX_16BIT_STEPS / arraySize);
 
                 }        
         }
@@ -561,116 +1140,448 @@ void detect_quad()
     quad_setpoint = peak_setpoint / 2;
 }
 
-void sweep() 
+sweep_fit_t last_fit;          //Model from the last sweep, valid when last_fit_ok
+bool last_fit_ok = false;
+
+void log_sweep_fit(uint32_t elapsed_us)
 {
+    console_printf("SWEEP FIT (%lu ms)\n", (unsigned long)(elapsed_us / 1000));
+    console_printf("%-10s: %.4f V\n", "OFFSET", last_fit.offset);
+    console_printf("%-10s: %.4f V\n", "AMPLITUDE", last_fit.amplitude);
+    console_printf("%-10s: %d steps\n", "VPI", (int)last_fit.vpi_steps);
+    console_printf("%-10s: %.4f V\n", "RESIDUAL", last_fit.rms_residual);
+    console_printf("%-10s: %d peak, %d null, %d quad+, %d quad-\n", "POINTS",
+           last_fit.peak_count, last_fit.null_count, last_fit.quad_plus_count, last_fit.quad_minus_count);
+    console_printf("\n");
+}
 
-    const int step_size = MAX_16BIT_STEPS / array_size; //Scale to array size
-    
-    float result_array[array_size]; // Create the array locally with float type
-    float read = 0.0f;
+// Replace the raw max/min setpoints with the ones from the model fit. Keeps the raw ones if the fit is rejected.
+// The fit is the one float stage, run once per sweep on a copy of the sweep in volts.
+void apply_sweep_fit(const adc_q16_t* result_array, int step_size)
+{
+    static float volts[MAX_12BIT_STEPS];
+    uint64_t start = hal_time_us();
 
-    for (int pwm_value = MIN_VOLTAGE_STEP; pwm_value < array_size; pwm_value++) 
+    for (int i = 0; i < array_size; i++)
     {
+        volts[i] = q16_to_volts(result_array[i]);
+    }
 
-        int dac_value = pwm_value * step_size;
-        
-        set_pwm_dac(dac_value);
-        //printf("%d:", dac_value);
-        read = read_voltage();  
-        //printf("%.4f\n", read);
-    
-        result_array[pwm_value] = read;
+    last_fit_ok = sweep_fit(volts, array_size, step_size, &last_fit);
 
+    if (!last_fit_ok)
+    {
+        console_printf("SWEEP FIT REJECTED (residual %.4f V, amplitude %.4f V), using raw peak/null\n\n", last_fit.rms_residual, last_fit.amplitude);
+        return;
     }
 
-    set_pwm_dac(MIN_VOLTAGE_STEP);
+    peak_setpoint = volts_to_q16(last_fit.peak_voltage);
+    null_setpoint = (last_fit.null_voltage < NOISE_FLOOR) ? NOISE_FLOOR_Q16 : volts_to_q16(last_fit.null_voltage); //Same noise floor rule as detect_null
+    quad_setpoint = volts_to_q16(last_fit.quad_voltage);
+    vpi_steps = (int)last_fit.vpi_steps;
 
-    //Pass the array as a reference to the functions to avoid duplication
-    detect_peak(result_array, array_size); 
-    detect_null(result_array, array_size);  
-    detect_quad();                          
+    if (last_fit.peak_count > 0) peak_voltage_step = sweep_fit_closest_to_mid(last_fit.peak_steps, last_fit.peak_count);
+    if (last_fit.null_count > 0) null_voltage_step = sweep_fit_closest_to_mid(last_fit.null_steps, last_fit.null_count);
 
-    //log_pwm_scan_complete();
+    log_sweep_fit((uint32_t)(hal_time_us() - start));
+}
+
+// Move the DAC to one sweep point and read it once the RC filter has followed. The dwell comes from the time
+// constant, not from the samples read: ln(jump / step_size) of them leave less than a point of the jump, a
+// neighbouring point still gets one. The read itself is the end of the dwell.
+static adc_q16_t sweep_read(int dac_value, int step_size, int samples)
+{
+    int jump = abs(dac_value - current_output_voltage_step);
+    float taus = (jump > step_size) ? logf((float)jump / step_size) : 1.0f;
+    int dwell = (int)(taus * dac_tau_samples()) - adc_span(samples);
 
+    set_pwm_dac(dac_value);
+    if (jump > 0 && dwell > 0) hal_adc_wait(dwell);
+
+    return read_voltage_averaged(samples);
 }
 
-void go_to_setpoint() 
+// Measure one full resolution sweep point unless the coarse or an earlier window already did
+static void sweep_point(adc_q16_t* result_array, uint8_t* measured, int index, int step_size, int samples)
 {
-    float read        = 0.0f;
-    float difference  = 0.0f;
-    int voltage_step  = 2500;
-    int step_size     = MAX_16BIT_STEPS / MAX_12BIT_STEPS; //Use 12-bit step size for faster convergence
-    
-    log_selected_setpoint();
+    if (measured[index]) return;
 
-    set_pwm_dac(voltage_step); 
-    
-    sleep_ms(100); //Allow DAC to settle (REASON: PWM signal from MAX voltage to MIN voltage takes some time to settle through the external RC circuit)
+    result_array[index] = sweep_read(index * step_size, step_size, samples);
+    measured[index] = 1;
+}
 
-    read = read_voltage();
- 
-    voltage_step++;
+// Re-sweep the full resolution points within half_width DAC steps of center. The jump from wherever the
+// previous window ended gets the full settling time first.
+static void sweep_window(adc_q16_t* result_array, uint8_t* measured, int center, int half_width, int step_size, int samples)
+{
+    int first = (center - half_width) / step_size;
+    int last = (center + half_width) / step_size;
 
-    difference = fabs(read - selected_setpoint);
+    if (first < 0) first = 0;
+    if (last > array_size - 1) last = array_size - 1;
 
-    while (difference > tolerance) 
-    { 
-        
-        //Ensure voltage values stay within limits
-        if (voltage_step < MIN_VOLTAGE_STEP) 
-        {
-            log_index_error(voltage_step);
-            break;
-        }
+    set_pwm_dac(first * step_size);
+    hal_sleep_ms(dac_settle_ms());
 
-        if (voltage_step > MAX_VOLTAGE_STEP) 
-        {  
-            log_index_error(voltage_step);
-            break;
-        }
-        
-        //Keep adjusting output until setpoint is reached
-        set_pwm_dac(voltage_step);
-        read = read_voltage();
-        difference = fabs(read - selected_setpoint);
-        voltage_step += step_size;
+    for (int i = first; i <= last; i++)
+    {
+        sweep_point(result_array, measured, i, step_size, samples);
     }
-
-    log_setpoint_reached(read, difference);
-    
 }
 
-void go_to_quad_plus() 
+#define SWEEP_EXTREMUM_SPAN       2                  //Coarse points either side a coarse peak or null has to beat
+
+// Coarse pass every array_size / coarse_points points, then full resolution windows around every coarse peak, null
+// and quad crossing. The points in between are linearly interpolated, which is where the curve is smooth, so
+// detect_* and the fit see a full array. Returns the number of points measured.
+static int sweep_coarse_to_fine(adc_q16_t* result_array, int step_size, int samples)
 {
-    float read        = 0.0f;
-    float difference  = 0.0f;
-    float prev_read   = 0.0f;
-    int voltage_step  = 0;
-    int step_size     = MAX_16BIT_STEPS / MAX_12BIT_STEPS; //Use 12-bit step size for faster convergence
-    int buffer        = 0;
-    
-    log_selected_setpoint();
+    static uint8_t measured[MAX_12BIT_STEPS];
+    const int stride = array_size / coarse_points;
+    int count = 0;
 
-    set_pwm_dac(voltage_step); 
-    
-    sleep_ms(100); //Allow DAC to settle (REASON: PWM signal from MAX voltage to MIN voltage takes some time to settle through the external RC circuit)
+    memset(measured, 0, sizeof(measured));
 
-    read = read_voltage();
- 
-    voltage_step++;
+    for (int i = 0; i < array_size; i += stride)
+    {
+        sweep_point(result_array, measured, i, step_size, samples);
+    }
+    sweep_point(result_array, measured, array_size - 1, step_size, samples); //Close the last interval
 
-    difference = fabs(read - selected_setpoint);
+    adc_q16_t coarse_max = result_array[0];
+    adc_q16_t coarse_min = result_array[0];
+    for (int i = stride; i < array_size; i += stride)
+    {
+        if (result_array[i] > coarse_max) coarse_max = result_array[i];
+        if (result_array[i] < coarse_min) coarse_min = result_array[i];
+    }
+    const adc_q16_t mid = (coarse_max + coarse_min) / 2;
+    const adc_q16_t band = (coarse_max - coarse_min) / 4;
 
-    bool is_plus = false;
+    //Local extrema of the coarse pass in the outer quarters of the swing, edges included since the rail may cut a slope.
+    //Each must beat its neighbours within SWEEP_EXTREMUM_SPAN coarse points, strictly on the right so a flat top or a
+    //null sitting on the ADC floor gets one window instead of one per noisy dip.
+    for (int i = 0; i < array_size; i += stride)
+    {
+        adc_q16_t value = result_array[i];
+        bool is_peak = (value > coarse_max - band);
+        bool is_null = (value < coarse_min + band);
 
-    while ((difference > tolerance) && (is_plus == false)) 
-    { 
-        
-        //Ensure voltage values stay within limits
-        if (voltage_step < MIN_VOLTAGE_STEP) 
+        for (int k = 1; k <= SWEEP_EXTREMUM_SPAN && (is_peak || is_null); k++)
         {
-            log_index_error(voltage_step);
-            break;
+            int left = i - k * stride;
+            int right = i + k * stride;
+
+            if (left >= 0)
+            {
+                is_peak = is_peak && (value >= result_array[left]);
+                is_null = is_null && (value <= result_array[left]);
+            }
+            if (right < array_size)
+            {
+                is_peak = is_peak && (value > result_array[right]);
+                is_null = is_null && (value < result_array[right]);
+            }
+        }
+
+        if (is_peak || is_null)
+        {
+            sweep_window(result_array, measured, i * step_size, refine_window, step_size, samples);
+        }
+    }
+
+    //Quad crossings of the mid level between coarse points
+    if (quad_window > 0)
+    {
+        for (int i = 0; i + stride < array_size; i += stride)
+        {
+            int64_t a = result_array[i] - mid;
+            int64_t b = result_array[i + stride] - mid;
+
+            if ((a < 0) != (b < 0))
+            {
+                int center = (int)((i + stride * a / (a - b)) * step_size);
+                sweep_window(result_array, measured, center, quad_window, step_size, samples);
+            }
+        }
+    }
+
+    //Fill the gaps between measured points
+    int previous = -1;
+    for (int i = 0; i < array_size; i++)
+    {
+        if (!measured[i]) continue;
+        count++;
+
+        for (int j = previous + 1; j < i && previous >= 0; j++)
+        {
+            result_array[j] = result_array[previous] + (adc_q16_t)((int64_t)(result_array[i] - result_array[previous]) * (j - previous) / (i - previous));
+        }
+        previous = i;
+    }
+
+    console_printf("COARSE TO FINE SWEEP: %d of %d points measured\n", count, array_size);
+    return count;
+}
+
+//SWEEP INDEX: DAC step of every lock point the last sweep saw, so acquiring a lock is one jump and a short
+//local refine instead of a linear search through the DAC range
+#define DAC_RAMP_LAG_STEPS        2048               //DAC steps moved per RC time constant while ramping, the lag left at the end
+
+static void index_add(int* steps, int* count, int step)
+{
+    if (*count < SWEEP_INDEX_MAX) steps[(*count)++] = step;
+}
+
+// Extremum of result_array[first..last] as a peak or null, unless it sits on the end of the sweep where the
+// curve may just have been cut off
+static void index_extremum(const adc_q16_t* result_array, int first, int last, bool peak, int step_size)
+{
+    int best = first;
+
+    for (int i = first + 1; i <= last; i++)
+    {
+        if (peak ? (result_array[i] > result_array[best]) : (result_array[i] < result_array[best])) best = i;
+    }
+
+    if (best == 0 || best == array_size - 1) return;
+
+    if (peak) index_add(sweep_index.peak_steps, &sweep_index.peak_count, best * step_size);
+    else index_add(sweep_index.null_steps, &sweep_index.null_count, best * step_size);
+}
+
+// Fill sweep_index. The fit already lists every lock point it refined. Without it the raw sweep is walked
+// with a hysteresis of an eighth of the swing around the quad level: each rising or falling crossing is a
+// quad plus or minus, and the extremum between two crossings is a peak or null.
+static void build_sweep_index(const adc_q16_t* result_array, int step_size)
+{
+    memset(&sweep_index, 0, sizeof(sweep_index));
+
+    if (sweep_fit_enabled && last_fit_ok)
+    {
+        for (int i = 0; i < last_fit.null_count; i++) index_add(sweep_index.null_steps, &sweep_index.null_count, last_fit.null_steps[i]);
+        for (int i = 0; i < last_fit.peak_count; i++) index_add(sweep_index.peak_steps, &sweep_index.peak_count, last_fit.peak_steps[i]);
+        for (int i = 0; i < last_fit.quad_plus_count; i++) index_add(sweep_index.quad_plus_steps, &sweep_index.quad_plus_count, last_fit.quad_plus_steps[i]);
+        for (int i = 0; i < last_fit.quad_minus_count; i++) index_add(sweep_index.quad_minus_steps, &sweep_index.quad_minus_count, last_fit.quad_minus_steps[i]);
+        return;
+    }
+
+    const adc_q16_t hysteresis = (peak_setpoint - null_setpoint) / 8;
+    int side = 0;                 //+1 above quad + hysteresis, -1 below quad - hysteresis, 0 not known yet
+    int last_at_or_below = 0;     //Last point at or below the quad level, where a rising crossing happened
+    int last_above = 0;
+    int segment_start = 0;        //Previous crossing, start of the current half period
+
+    for (int i = 0; i < array_size; i++)
+    {
+        adc_q16_t value = result_array[i];
+
+        if (value <= quad_setpoint) last_at_or_below = i; else last_above = i;
+
+        if (value > quad_setpoint + hysteresis && side <= 0)
+        {
+            if (side < 0)
+            {
+                index_extremum(result_array, segment_start, i, false, step_size);
+                index_add(sweep_index.quad_plus_steps, &sweep_index.quad_plus_count, last_at_or_below * step_size + step_size / 2);
+            }
+            side = 1;
+            segment_start = last_at_or_below;
+        }
+        else if (value < quad_setpoint - hysteresis && side >= 0)
+        {
+            if (side > 0)
+            {
+                index_extremum(result_array, segment_start, i, true, step_size);
+                index_add(sweep_index.quad_minus_steps, &sweep_index.quad_minus_count, last_above * step_size + step_size / 2);
+            }
+            side = -1;
+            segment_start = last_above;
+        }
+    }
+
+    //The half period after the last crossing has no closing crossing
+    if (side != 0) index_extremum(result_array, segment_start, array_size - 1, side > 0, step_size);
+}
+
+// DAC step of a quad crossing on the given slope (+1 quad plus). From the sweep index, otherwise half way
+// between the sweep's null and peak, moved half a period for the other slope.
+static int quad_step(int slope)
+{
+    int step = (slope > 0) ? sweep_fit_closest_to_mid(sweep_index.quad_plus_steps, sweep_index.quad_plus_count)
+                           : sweep_fit_closest_to_mid(sweep_index.quad_minus_steps, sweep_index.quad_minus_count);
+
+    if (step >= 0) return step;
+
+    step = (null_voltage_step + peak_voltage_step) / 2;
+
+    int rising = (null_voltage_step < peak_voltage_step) ? 1 : -1;
+
+    if (rising != slope)
+    {
+        step += (step < MAX_16BIT_STEPS / 2) ? vpi_steps : -vpi_steps;
+    }
+    return step;
+}
+
+// Keep the sweep result for the next boot. A sweep that found no swing between null and peak is not kept.
+static void store_calibration()
+{
+    if (peak_setpoint - null_setpoint <= 2 * tolerance)
+    {
+        console_printf("Sweep swing too small, calibration not stored\n\n");
+        return;
+    }
+
+    calibration.valid = CALIBRATION_VALID;
+    calibration.null_setpoint = null_setpoint;
+    calibration.peak_setpoint = peak_setpoint;
+    calibration.quad_setpoint = quad_setpoint;
+    calibration.null_step = null_voltage_step;
+    calibration.peak_step = peak_voltage_step;
+    calibration.quad_plus_step = quad_step(1);
+    calibration.quad_minus_step = quad_step(-1);
+    calibration.vpi_steps = vpi_steps;
+
+    save_calibration_to_flash();
+}
+
+void sweep() 
+{
+
+    const int step_size = MAX_16BIT_STEPS / array_size; //Scale to array size
+    const int samples = sweep_fit_enabled ? sweep_average : average_per_read; //The fit averages across points, so each point needs far fewer samples
+    
+    static adc_q16_t result_array[MAX_12BIT_STEPS]; //Static, 16 KB is far more than the default stack
+    adc_q16_t read = 0;
+
+    sweep_active = true;
+
+    if (coarse_points > 0)
+    {
+        sweep_coarse_to_fine(result_array, step_size, samples);
+    }
+    else
+    {
+        for (int pwm_value = MIN_VOLTAGE_STEP; pwm_value < array_size; pwm_value++) 
+        {
+
+            int dac_value = pwm_value * step_size;
+            
+            //console_printf("%d:", dac_value);
+            read = sweep_read(dac_value, step_size, samples);  
+            //console_printf("%.4f\n", read);
+        
+            result_array[pwm_value] = read;
+
+        }
+    }
+
+    set_pwm_dac(MIN_VOLTAGE_STEP);
+    sweep_active = false;
+
+    //Pass the array as a reference to the functions to avoid duplication
+    detect_peak(result_array, array_size); 
+    detect_null(result_array, array_size);  
+    detect_quad();                          
+
+    //Peak to null is half a period of the transfer function
+    if (peak_voltage_step != null_voltage_step)
+    {
+        vpi_steps = abs(peak_voltage_step - null_voltage_step);
+    }
+
+    if (sweep_fit_enabled)
+    {
+        apply_sweep_fit(result_array, step_size);
+    }
+
+    build_sweep_index(result_array, step_size);
+    store_calibration();
+
+    //log_pwm_scan_complete();
+
+}
+
+// Linear searches from the bottom of the DAC range, only used when the sweep index has no lock point of the
+// kind wanted
+static void search_setpoint() 
+{
+    adc_q16_t read        = 0;
+    adc_q16_t difference  = 0;
+    int voltage_step  = 2500;
+    int step_size     = MAX_16BIT_STEPS / MAX_12BIT_STEPS; //Use 12-bit step size for faster convergence
+    
+    log_selected_setpoint();
+
+    set_pwm_dac(voltage_step); 
+    
+    hal_sleep_ms(dac_settle_ms()); //Allow DAC to settle (REASON: PWM signal from MAX voltage to MIN voltage takes some time to settle through the external RC circuit)
+
+    read = read_voltage();
+ 
+    voltage_step++;
+
+    difference = q16_abs(read - selected_setpoint);
+
+    while (difference > tolerance) 
+    { 
+        
+        //Ensure voltage values stay within limits
+        if (voltage_step < MIN_VOLTAGE_STEP) 
+        {
+            log_index_error(voltage_step);
+            break;
+        }
+
+        if (voltage_step > MAX_VOLTAGE_STEP) 
+        {  
+            log_index_error(voltage_step);
+            break;
+        }
+        
+        //Keep adjusting output until setpoint is reached
+        set_pwm_dac(voltage_step);
+        read = read_voltage();
+        difference = q16_abs(read - selected_setpoint);
+        voltage_step += step_size;
+    }
+
+    log_setpoint_reached(read, difference);
+    
+}
+
+static void search_quad_plus() 
+{
+    adc_q16_t read        = 0;
+    adc_q16_t difference  = 0;
+    adc_q16_t prev_read   = 0;
+    int voltage_step  = 0;
+    int step_size     = MAX_16BIT_STEPS / MAX_12BIT_STEPS; //Use 12-bit step size for faster convergence
+    int buffer        = 0;
+    
+    log_selected_setpoint();
+
+    set_pwm_dac(voltage_step); 
+    
+    hal_sleep_ms(dac_settle_ms()); //Allow DAC to settle (REASON: PWM signal from MAX voltage to MIN voltage takes some time to settle through the external RC circuit)
+
+    read = read_voltage();
+ 
+    voltage_step++;
+
+    difference = q16_abs(read - selected_setpoint);
+
+    bool is_plus = false;
+
+    while ((difference > tolerance) && (is_plus == false)) 
+    { 
+        
+        //Ensure voltage values stay within limits
+        if (voltage_step < MIN_VOLTAGE_STEP) 
+        {
+            log_index_error(voltage_step);
+            break;
         }
 
         if (voltage_step > MAX_VOLTAGE_STEP) 
@@ -692,7 +1603,7 @@ void go_to_quad_plus()
         //Keep adjusting output until setpoint is reached
         set_pwm_dac(voltage_step);
         read = read_voltage();
-        difference = fabs(read - selected_setpoint);
+        difference = q16_abs(read - selected_setpoint);
         voltage_step += step_size;
         prev_read = read;
     }
@@ -701,11 +1612,11 @@ void go_to_quad_plus()
     
 }
 
-void go_to_quad_minus() 
+static void search_quad_minus() 
 {
-    float read        = 0.0f;
-    float difference  = 0.0f;
-    float prev_read   = 0.0f;
+    adc_q16_t read        = 0;
+    adc_q16_t difference  = 0;
+    adc_q16_t prev_read   = 0;
     int voltage_step  = 0;
     int step_size     = MAX_16BIT_STEPS / MAX_12BIT_STEPS; //Use 12-bit step size for faster convergence
     int buffer        = 0;
@@ -714,13 +1625,13 @@ void go_to_quad_minus()
 
     set_pwm_dac(voltage_step); 
     
-    sleep_ms(100); //Allow DAC to settle (REASON: PWM signal from MAX voltage to MIN voltage takes some time to settle through the external RC circuit)
+    hal_sleep_ms(dac_settle_ms()); //Allow DAC to settle (REASON: PWM signal from MAX voltage to MIN voltage takes some time to settle through the external RC circuit)
 
     read = read_voltage();
  
     voltage_step++;
 
-    difference = fabs(read - selected_setpoint);
+    difference = q16_abs(read - selected_setpoint);
 
     bool is_minus = false;
 
@@ -753,7 +1664,7 @@ void go_to_quad_minus()
         //Keep adjusting output until setpoint is reached
         set_pwm_dac(voltage_step);
         read = read_voltage();
-        difference = fabs(read - selected_setpoint);
+        difference = q16_abs(read - selected_setpoint);
         voltage_step += step_size;
         prev_read = read;
     }
@@ -762,119 +1673,349 @@ void go_to_quad_minus()
     
 }
 
-void process_quad_minus() {
-    float read = 0.0f;
-    float difference = 0.0f;
-    int gain = 8;
-    
-    difference = fabs(current_input_voltage - selected_setpoint);
-
-    // Iterate until the difference is within the tolerance
-    while (difference > tolerance) 
-    {
-        // Move the index depending on whether the value is increasing or decreasing
-        
-        if (current_input_voltage > selected_setpoint) 
-        {
-            
-            current_output_voltage_step += gain;
-            set_pwm_dac(current_output_voltage_step);
-            current_input_voltage = read_voltage();
-
-        }
-   
-        else 
-        {
-            
-            current_output_voltage_step -= gain;
-            set_pwm_dac(current_output_voltage_step);
-            current_input_voltage = read_voltage();
-
-        }
+// Walk the DAC to target in steps of DAC_RAMP_LAG_STEPS, one per RC time constant, so the filter output
+// follows the ramp and arrives within about DAC_RAMP_LAG_STEPS instead of settling from a full scale jump
+static void ramp_dac(int target)
+{
+    int tau_ms = dac_settle_ms() / DAC_SETTLE_TAUS;
+    int step = current_output_voltage_step;
 
-        //Handle edge case 
-        if (current_output_voltage_step <= MIN_VOLTAGE_STEP || current_output_voltage_step >= MAX_VOLTAGE_STEP) 
-        {
-            gpio_put(LED_PIN, 1);
-            go_to_quad_minus();
-            printf("EDGE CASE\n");
-            
-        }
+    if (tau_ms < 1) tau_ms = 1;
 
-        difference = fabs(current_input_voltage - selected_setpoint);
-        //printf("Difference:      %.4f\n", difference);
+    while (step != target)
+    {
+        if (target > step) step = (target - step > DAC_RAMP_LAG_STEPS) ? step + DAC_RAMP_LAG_STEPS : target;
+        else step = (step - target > DAC_RAMP_LAG_STEPS) ? step - DAC_RAMP_LAG_STEPS : target;
 
+        set_pwm_dac(step);
+        hal_sleep_ms(tau_ms);
     }
-
-    //printf("\n");
-
 }
 
-void process_quad_plus() {
-    float read = 0.0f;
-    float difference = 0.0f;
-    int gain = 8;
-    
-    difference = fabs(current_input_voltage - selected_setpoint);
+#define REFINE_ITERATIONS         4                  //Corrections of the local refine after the jump
+#define REFINE_PI_NUM             355                //pi as 355 / 113 for the integer slope at the quad crossing
+#define REFINE_PI_DEN             113
 
-    // Iterate until the difference is within the tolerance
-    while (difference > tolerance) 
+// Correct the jump locally. Quad: the error over the slope of the curve at the crossing (swing / 2 * pi / vpi
+// counts per step). Peak and null: the vertex of a parabola through three reads an eighth of vpi apart.
+// Both stop once the reading is inside a quarter of the tolerance.
+static void refine_lock_point()
+{
+    adc_q16_t swing = peak_setpoint - null_setpoint;
+    adc_q16_t read = read_voltage();
+    adc_q16_t difference = q16_abs(read - selected_setpoint);
+
+    for (int i = 0; i < REFINE_ITERATIONS && difference > tolerance / 4 && swing > 0 && vpi_steps > 0; i++)
     {
-        // Move the index depending on whether the value is increasing or decreasing
-        
-        if (current_input_voltage > selected_setpoint) 
+        int step = current_output_voltage_step;
+        int limit = vpi_steps / 8;
+        int64_t correction;
+
+        if (set_point == QUAD_PLUS || set_point == QUAD_MINUS)
         {
-            
-            current_output_voltage_step -= gain;
-            set_pwm_dac(current_output_voltage_step);
-            current_input_voltage = read_voltage();
+            int slope = (set_point == QUAD_PLUS) ? 1 : -1;
 
+            correction = slope * (int64_t)(selected_setpoint - read) * 2 * vpi_steps * REFINE_PI_DEN / ((int64_t)swing * REFINE_PI_NUM);
         }
-   
-        else if (current_input_voltage < selected_setpoint)
+        else
         {
-            
-            current_output_voltage_step += gain;
-            set_pwm_dac(current_output_voltage_step);
-            current_input_voltage = read_voltage();
+            bool peak = (set_point == PEAK_POINT || set_point == PEAK_LOCKIN);
+            adc_q16_t below = move(step - limit);
+            adc_q16_t above = move(step + limit);
+            int64_t curvature = (int64_t)below - 2 * (int64_t)read + above;
 
+            //A peak bends down and a null up, anything else is noise or the wrong side of the curve
+            if (peak ? (curvature >= 0) : (curvature <= 0))
+            {
+                set_pwm_dac(step);
+                break;
+            }
+            correction = limit * ((int64_t)below - above) / (2 * curvature);
         }
 
-        //Handle edge case 
-        if (current_output_voltage_step <= MIN_VOLTAGE_STEP || current_output_voltage_step >= MAX_VOLTAGE_STEP) 
-        {
-            gpio_put(LED_PIN, 1);
-            go_to_quad_plus();
-            printf("EDGE CASE\n");
-            
-        }
+        if (correction > limit) correction = limit;
+        if (correction < -limit) correction = -limit;
+
+        read = move(step + (int)correction);
+        difference = q16_abs(read - selected_setpoint);
+    }
 
-        difference = fabs(current_input_voltage - selected_setpoint);
-        //printf("Difference:      %.4f\n", difference);
+    log_setpoint_reached(read, difference);
+}
+
+// Ramp to the lock point nearest mid-range in the sweep index and refine it, the linear search if there is none
+static void go_to_indexed(const int* steps, int count, void (*search)(void))
+{
+    int target = sweep_fit_closest_to_mid(steps, count);
 
+    if (target < 0)
+    {
+        search();
+        return;
     }
 
-    //printf("\n");
+    log_selected_setpoint();
+    ramp_dac(target);
+    refine_lock_point();
+}
 
+void go_to_setpoint()
+{
+    if (set_point == PEAK_POINT || set_point == PEAK_LOCKIN)
+    {
+        go_to_indexed(sweep_index.peak_steps, sweep_index.peak_count, search_setpoint);
+    }
+    else
+    {
+        go_to_indexed(sweep_index.null_steps, sweep_index.null_count, search_setpoint);
+    }
 }
 
-float move(int voltage_step) 
+void go_to_quad_plus()
 {
-    set_pwm_dac(voltage_step);
-    return read_voltage();
+    go_to_indexed(sweep_index.quad_plus_steps, sweep_index.quad_plus_count, search_quad_plus);
 }
 
-bool process_slope_peak()
+void go_to_quad_minus()
 {
+    go_to_indexed(sweep_index.quad_minus_steps, sweep_index.quad_minus_count, search_quad_minus);
+}
 
-    bool move_right = MOVE_RIGHT;
-    bool move_left = MOVE_LEFT;
+//RAIL WRAP: the transfer function repeats every period (2 * vpi_steps), so a lock point pushed onto a DAC rail
+//by drift has an equivalent one a period towards mid-range, same level and same slope
+#define RAIL_HIST_FIRST_MS        16                 //Upper edge of the first recovery time bin, the bins double from there
 
-    int initial_output_voltage_step = 0;
+rail_stats_t rail_stats = {0};
+bool rail_recovering = false;          // Left a rail, output not back inside tolerance yet
+static uint64_t rail_hit_us = 0;
+
+// Leave a DAC rail by jumping a whole period back towards mid-range. The drift tracker keeps its rate and
+// has its lock point moved by the same jump. search is the old linear search for the mode, only used when
+// the period is unknown or no equivalent lock point fits in the DAC range.
+void leave_rail(void (*search)(void))
+{
+    int step = current_output_voltage_step;
+    int period = 2 * vpi_steps;
+    int target = (step >= MAX_16BIT_STEPS / 2) ? step - period : step + period;
+
+    hal_gpio_put(LED_PIN, 1);
+    if (!rail_recovering)
+    {
+        rail_hit_us = hal_time_us();
+        rail_recovering = true;
+    }
+
+    if (vpi_steps <= 0 || target < MIN_VOLTAGE_STEP || target > MAX_VOLTAGE_STEP)
+    {
+        rail_stats.searches++;
+        search();
+        drift_kalman_reset(&drift_tracker, DRIFT_PROCESS_NOISE);
+        console_printf("EDGE CASE: no lock point a period from step %d, searched\n", step);
+        return;
+    }
+
+    rail_stats.wraps++;
+    set_pwm_dac(target);
+    hal_sleep_ms(dac_settle_ms()); //A period is most of the DAC range, let the RC filter catch up
+    drift_tracker.position += target - step;
+    console_printf("EDGE CASE: rail at step %d, wrapped a period to %d\n", step, target);
+}
+
+// Called with every new reading after leave_rail() until the output is back inside tolerance, which ends the
+// recovery and puts its duration in the histogram
+void rail_recovery_check()
+{
+    if (!rail_recovering || q16_abs(current_input_voltage - selected_setpoint) > tolerance) return;
+
+    uint32_t ms = (uint32_t)((hal_time_us() - rail_hit_us) / 1000);
+    int bin = 0;
+
+    for (uint32_t edge = RAIL_HIST_FIRST_MS; bin < RAIL_HIST_BINS - 1 && ms >= edge; edge <<= 1)
+    {
+        bin++;
+    }
+
+    rail_recovering = false;
+    rail_stats.recoveries++;
+    rail_stats.histogram[bin]++;
+    rail_stats.last_ms = ms;
+    if (ms > rail_stats.max_ms) rail_stats.max_ms = ms;
+}
+
+void log_rail_stats()
+{
+    uint32_t edge = RAIL_HIST_FIRST_MS;
+
+    console_printf("\n--- RAIL EDGE CASES ---\n");
+    console_printf("Wrapped      : %lu, searched %lu, recovering %s\n", (unsigned long)rail_stats.wraps,
+        (unsigned long)rail_stats.searches, rail_recovering ? "now" : "no");
+    console_printf("Recovery     : %lu done, last %lu ms, max %lu ms\n", (unsigned long)rail_stats.recoveries,
+        (unsigned long)rail_stats.last_ms, (unsigned long)rail_stats.max_ms);
+
+    for (int i = 0; i < RAIL_HIST_BINS; i++, edge <<= 1)
+    {
+        if (i < RAIL_HIST_BINS - 1) console_printf("  < %5lu ms : %lu\n", (unsigned long)edge, (unsigned long)rail_stats.histogram[i]);
+        else console_printf("  >= %4lu ms : %lu\n", (unsigned long)(edge >> 1), (unsigned long)rail_stats.histogram[i]);
+    }
+    console_printf("-----------------------\n\n");
+}
+
+pid_controller_t quad_controller;
+
+#define PID_MAX_ITERATIONS        200                //Updates per call before handing back to the main loop
+#define PID_RAIL_LIMIT            3                  //Consecutive updates pinned at a rail before falling back to the quad search
+
+// PID replacement for the fixed gain quad loops. slope is +1 for quad plus (more DAC, more light), -1 for quad minus
+void process_quad_pid(int slope)
+{
+    adc_q16_t difference = q16_abs(current_input_voltage - selected_setpoint);
+    int rail_count = 0;
+
+    // Work in "signed" counts so a positive error always means move the DAC up
+    pid_init(&quad_controller, per_volt_to_q16(kp), per_volt_to_q16(ki), per_volt_to_q16(kd), MIN_VOLTAGE_STEP, MAX_VOLTAGE_STEP);
+    pid_reset(&quad_controller, current_output_voltage_step, slope * current_input_voltage);
+
+    for (int i = 0; (difference > tolerance) && (i < PID_MAX_ITERATIONS); i++)
+    {
+        adc_q16_t measurement = slope * current_input_voltage;
+        set_pwm_dac(pid_update(&quad_controller, slope * selected_setpoint - measurement, measurement));
+        current_input_voltage = read_voltage();
+
+        //Handle edge case: pinned at a rail means this quad is out of range, find the next one
+        rail_count = quad_controller.saturated ? rail_count + 1 : 0;
+
+        if (rail_count >= PID_RAIL_LIMIT)
+        {
+            leave_rail(slope > 0 ? go_to_quad_plus : go_to_quad_minus);
+
+            current_input_voltage = read_voltage();
+            pid_reset(&quad_controller, current_output_voltage_step, slope * current_input_voltage);
+            rail_count = 0;
+        }
+
+        difference = q16_abs(current_input_voltage - selected_setpoint);
+    }
+}
+
+void process_quad_minus() {
+    adc_q16_t difference = 0;
+    int gain = 8;
+
+    if (quad_pid)
+    {
+        process_quad_pid(-1);
+        return;
+    }
+    
+    difference = q16_abs(current_input_voltage - selected_setpoint);
+
+    // Iterate until the difference is within the tolerance
+    while (difference > tolerance) 
+    {
+        // Move the index depending on whether the value is increasing or decreasing
+        
+        if (current_input_voltage > selected_setpoint) 
+        {
+            
+            current_output_voltage_step += gain;
+            set_pwm_dac(current_output_voltage_step);
+            current_input_voltage = read_voltage();
+
+        }
+   
+        else 
+        {
+            
+            current_output_voltage_step -= gain;
+            set_pwm_dac(current_output_voltage_step);
+            current_input_voltage = read_voltage();
+
+        }
+
+        //Handle edge case: the equivalent quad a period away
+        if (current_output_voltage_step <= MIN_VOLTAGE_STEP || current_output_voltage_step >= MAX_VOLTAGE_STEP) 
+        {
+            leave_rail(go_to_quad_minus);
+            current_input_voltage = read_voltage();
+        }
+
+        difference = q16_abs(current_input_voltage - selected_setpoint);
+        //console_printf("Difference:      %.4f\n", difference);
+
+    }
+
+    //console_printf("\n");
+
+}
+
+void process_quad_plus() {
+    adc_q16_t difference = 0;
+    int gain = 8;
+
+    if (quad_pid)
+    {
+        process_quad_pid(1);
+        return;
+    }
+    
+    difference = q16_abs(current_input_voltage - selected_setpoint);
+
+    // Iterate until the difference is within the tolerance
+    while (difference > tolerance) 
+    {
+        // Move the index depending on whether the value is increasing or decreasing
+        
+        if (current_input_voltage > selected_setpoint) 
+        {
+            
+            current_output_voltage_step -= gain;
+            set_pwm_dac(current_output_voltage_step);
+            current_input_voltage = read_voltage();
+
+        }
+   
+        else if (current_input_voltage < selected_setpoint)
+        {
+            
+            current_output_voltage_step += gain;
+            set_pwm_dac(current_output_voltage_step);
+            current_input_voltage = read_voltage();
+
+        }
+
+        //Handle edge case: the equivalent quad a period away
+        if (current_output_voltage_step <= MIN_VOLTAGE_STEP || current_output_voltage_step >= MAX_VOLTAGE_STEP) 
+        {
+            leave_rail(go_to_quad_plus);
+            current_input_voltage = read_voltage();
+        }
+
+        difference = q16_abs(current_input_voltage - selected_setpoint);
+        //console_printf("Difference:      %.4f\n", difference);
+
+    }
+
+    //console_printf("\n");
+
+}
+
+adc_q16_t move(int voltage_step)  
+{
+    set_pwm_dac(voltage_step);
+    return read_voltage();
+}
+
+bool process_slope_peak()
+{
+
+    bool move_right = MOVE_RIGHT;
+    bool move_left = MOVE_LEFT;
+
+    int initial_output_voltage_step = 0;
     int i = 1; //This value keeps tracks of read in the case that the initial read equals the next read
 
-    float initial_read = 0.0f;
-    float next_read = 0.0f;
+    adc_q16_t initial_read = 0;
+    adc_q16_t next_read = 0;
 
     initial_output_voltage_step = current_output_voltage_step;
     
@@ -885,7 +2026,7 @@ bool process_slope_peak()
     {
         next_read = move(current_output_voltage_step + GAIN);
         i++;
-        //printf("i: %d\n", i);
+        //console_printf("i: %d\n", i);
     }
 
     if (initial_read > next_read)
@@ -903,12 +2044,12 @@ bool process_slope_peak()
 
 void process_peak()
 {
-    float difference = 0.0f;
-    float prev_difference = 0.0;
-    float read = 0.0f;
+    adc_q16_t difference = 0;
+    adc_q16_t prev_difference = 0;
+    adc_q16_t read = 0;
     int buffer = 0;
 
-    difference = fabs(selected_setpoint - current_input_voltage);
+    difference = q16_abs(selected_setpoint - current_input_voltage);
     
     bool direction = process_slope_peak();
 
@@ -929,12 +2070,12 @@ void process_peak()
             prev_difference = difference;
         }
 
-        difference = fabs(selected_setpoint - read);
+        difference = q16_abs(selected_setpoint - read);
 
         if (difference > prev_difference)
         {
             buffer++;
-            //printf("J\n");
+            //console_printf("J\n");
             
             if ((direction == MOVE_RIGHT) && (buffer == peak_buffer))
             {
@@ -949,14 +2090,12 @@ void process_peak()
                 
             }
         }
-        //printf("difference = %.4f\n", difference);
+        //console_printf("difference = %.4f\n", difference);
 
         if (current_output_voltage_step <= MIN_VOLTAGE_STEP || current_output_voltage_step >= MAX_VOLTAGE_STEP) 
         {
-            gpio_put(LED_PIN, 1);
-            go_to_setpoint();
-            printf("EDGE CASE\n");
-            
+            leave_rail(go_to_setpoint);
+            current_input_voltage = read_voltage();
         }
 
     }
@@ -972,8 +2111,8 @@ bool process_slope_null()
     int initial_output_voltage_step = 0;
     int i = 1;
 
-    float initial_read = 0.0f;
-    float next_read = 0.0f;
+    adc_q16_t initial_read = 0;
+    adc_q16_t next_read = 0;
 
     initial_output_voltage_step = current_output_voltage_step;
     
@@ -984,7 +2123,7 @@ bool process_slope_null()
     {
         next_read = move(current_output_voltage_step + GAIN);
         i++;
-        //printf("i: %d\n", i);
+        //console_printf("i: %d\n", i);
     }
 
     if (initial_read > next_read)
@@ -1002,12 +2141,12 @@ bool process_slope_null()
 
 void process_null() 
 {
-    float difference = 0.0f;
-    float prev_difference = 0.0;
-    float read = 0.0f;
+    adc_q16_t difference = 0;
+    adc_q16_t prev_difference = 0;
+    adc_q16_t read = 0;
     int buffer = 0;
 
-    difference = fabs(selected_setpoint - current_input_voltage);
+    difference = q16_abs(selected_setpoint - current_input_voltage);
     
     bool direction = process_slope_null();
 
@@ -1028,12 +2167,12 @@ void process_null()
             prev_difference = difference;
         }
 
-        difference = fabs(selected_setpoint - read);
+        difference = q16_abs(selected_setpoint - read);
 
         if (difference > prev_difference)
         {
             buffer++;
-            //printf("J\n");
+            //console_printf("J\n");
             
             if ((direction == MOVE_RIGHT) && (buffer == null_buffer))
             {
@@ -1048,24 +2187,39 @@ void process_null()
                 
             }
         }
-        //printf("difference = %.4f\n", difference);
+        //console_printf("difference = %.4f\n", difference);
 
 
         //EDGE CASE HANDELING
         if (current_output_voltage_step <= MIN_VOLTAGE_STEP || current_output_voltage_step >= MAX_VOLTAGE_STEP) 
         {
-            gpio_put(LED_PIN, 1);
-            go_to_setpoint();
-            printf("EDGE CASE\n");
-            
+            leave_rail(go_to_setpoint);
+            current_input_voltage = read_voltage();
         }
 
     }
 }
 
+// Pick the voltage the selected mode locks to
+void select_setpoint()
+{
+    if (set_point == PEAK_POINT || set_point == PEAK_LOCKIN) 
+    {
+        selected_setpoint = peak_setpoint;
+    }
+    else if (set_point == QUAD_PLUS || set_point == QUAD_MINUS)
+    {
+        selected_setpoint = quad_setpoint;
+    }
+    else 
+    {
+        selected_setpoint = null_setpoint;
+    }
+}
+
 void go_to_desired_setpoint()
 {
-    if (set_point == PEAK_POINT) 
+    if (set_point == PEAK_POINT || set_point == PEAK_LOCKIN) 
     {
         selected_setpoint = peak_setpoint;
         go_to_setpoint();
@@ -1083,39 +2237,39 @@ void go_to_desired_setpoint()
         go_to_quad_minus();
     }
 
-    else if (set_point == NULL_POINT) 
+    else if (set_point == NULL_POINT || set_point == NULL_LOCKIN) 
     {
         selected_setpoint = null_setpoint;
         go_to_setpoint();
     }
 }
 
-void button_isr(uint gpio, uint32_t events)
+void button_isr(unsigned int gpio, uint32_t events)
 {
     if(gpio == BUTTON_PIN)
     {
-        button_pressed = true;
+        sweep_all_pressed = true;
     }
 }
 
 void test_pins()
 {
-    if(gpio_get(NULL_PIN) == true)
+    if(hal_gpio_get(NULL_PIN) == true)
     {
         null_pin = true;
         set_point = NULL_POINT;
     }
-    else if (gpio_get(QUAD_MINUS_PIN) == true)
+    else if (hal_gpio_get(QUAD_MINUS_PIN) == true)
     {
         quad_minus_pin = true;
         set_point = QUAD_MINUS;
     }
-    else if (gpio_get(QUAD_PLUS_PIN) == true)
+    else if (hal_gpio_get(QUAD_PLUS_PIN) == true)
     {
         quad_plus_pin = true;
         set_point = QUAD_PLUS;
     }
-    else if (gpio_get(PEAK_PIN) == true)
+    else if (hal_gpio_get(PEAK_PIN) == true)
     {
         peak_pin = true;
         set_point = PEAK_POINT;
@@ -1136,37 +2290,675 @@ void polling_delay(int ms)
     while(i < num_polls)
     {
         check_serial_input();
-        sleep_ms(interval);
+        hal_sleep_ms(interval);
         i++;
     }
 
 }
 
-int main()
+// Boot straight onto the selected lock point of the stored calibration instead of sweeping. Tracking takes it
+// from there, warm_start_check() sweeps after all if the lock is not confirmed in time.
+bool warm_start()
 {
-    stdio_init_all();
-    
-    // Initialize hardware
-    initialize_pwm();
-    initialize_adc();
-    initialize_button();
-    initialize_led();
-    initialize_shorts();
+    if (calibration.valid != CALIBRATION_VALID) return false;
+
+    null_setpoint = calibration.null_setpoint;
+    peak_setpoint = calibration.peak_setpoint;
+    quad_setpoint = calibration.quad_setpoint;
+    null_voltage_step = calibration.null_step;
+    peak_voltage_step = calibration.peak_step;
+    vpi_steps = calibration.vpi_steps;
+    select_setpoint();
+
+    //The index only knows the cached lock points, enough for go_to_* after an edge case
+    memset(&sweep_index, 0, sizeof(sweep_index));
+    index_add(sweep_index.null_steps, &sweep_index.null_count, calibration.null_step);
+    index_add(sweep_index.peak_steps, &sweep_index.peak_count, calibration.peak_step);
+    index_add(sweep_index.quad_plus_steps, &sweep_index.quad_plus_count, calibration.quad_plus_step);
+    index_add(sweep_index.quad_minus_steps, &sweep_index.quad_minus_count, calibration.quad_minus_step);
+
+    int step = calibration.null_step;
+    if (set_point == PEAK_POINT || set_point == PEAK_LOCKIN) step = calibration.peak_step;
+    else if (set_point == QUAD_PLUS) step = calibration.quad_plus_step;
+    else if (set_point == QUAD_MINUS) step = calibration.quad_minus_step;
 
-    gpio_put(LED_PIN, 0);
+    log_selected_setpoint();
+    console_printf("WARM START: cached calibration, DAC step %d\n\n", step);
+
+    set_pwm_dac(step);
+    warm_start_us = hal_time_us();
+    hal_sleep_ms(dac_settle_ms());
+
+    warm_start_pending = true;
+    warm_start_hits = 0;
+    warm_start_lock_ms = 0;
+    return true;
+}
+
+// Called with every new reading until the warm start lock is confirmed by WARM_START_CONFIRM_READS reads in a
+// row inside tolerance. Past WARM_START_CONFIRM_MS the cached lock point is not trusted and a sweep is queued.
+void warm_start_check()
+{
+    if (!warm_start_pending) return;
+
+    uint32_t elapsed_ms = (uint32_t)((hal_time_us() - warm_start_us) / 1000);
+
+    warm_start_hits = (q16_abs(current_input_voltage - selected_setpoint) <= tolerance) ? warm_start_hits + 1 : 0;
+
+    if (warm_start_hits >= WARM_START_CONFIRM_READS)
+    {
+        warm_start_pending = false;
+        warm_start_lock_ms = elapsed_ms;
+        console_printf("WARM START CONFIRMED: locked in %lu ms\n\n", (unsigned long)elapsed_ms);
+    }
+    else if (elapsed_ms > WARM_START_CONFIRM_MS)
+    {
+        warm_start_pending = false;
+        console_printf("WARM START NOT CONFIRMED after %lu ms, sweeping\n\n", (unsigned long)elapsed_ms);
+        button_pressed = true;
+    }
+}
+
+//CONTROL TICK: one bounded measure and correct step per hardware timer tick, see control_tick.h
+#define TICK_MIN_SAMPLES          16
+#define TICK_PROBE_CHANGE         VOLTS_Q16(0.001f)  //Smallest probe reading change that counts, the old 1 mV readings
+
+static bool tick_tracking = false;                 //A correction is in progress (hill climb excursion, quad PID running)
+static bool tick_direction = MOVE_RIGHT;
+static bool tick_probing = false;                  //The hill climb's direction probe is waiting for its reading
+static adc_q16_t tick_probe_read = 0;              //Reading before the probe's first GAIN step
+static int tick_probe_start = 0;                   //DAC step it was taken at
+static int tick_probe_steps = 0;                   //GAIN steps taken so far
+static int tick_buffer = 0;
+static int tick_rail_count = 0;
+static adc_q16_t tick_prev_difference = 0;
+static adc_q16_t tick_last_difference = 0;
+static enum setPoint tick_mode = NULL_POINT;
+static adc_q16_t tick_setpoint = 0;
+
+//CHANNELS: the globals hold the active channel, channels[] the rest
+
+#define CHANNEL_STORE(type, name) slot->name = name;
+#define CHANNEL_LOAD(type, name) name = slot->name;
+
+static void channel_store(channel_t* slot)
+{
+    CHANNEL_PARAMS(CHANNEL_STORE)
+    CHANNEL_STATE(CHANNEL_STORE)
+}
+
+static void channel_load(const channel_t* slot)
+{
+    CHANNEL_PARAMS(CHANNEL_LOAD)
+    CHANNEL_STATE(CHANNEL_LOAD)
+}
+
+// The first call hands the defaults at the top to every channel
+void channel_sync()
+{
+    if (!channels_ready)
+    {
+        for (int i = 0; i < CONTROLLER_CHANNELS; i++) channel_store(&channels[i]);
+        channels_ready = true;
+        return;
+    }
+
+    channel_store(&channels[active_channel]);
+}
+
+void channel_restore()
+{
+    channel_load(&channels[active_channel]);
+}
+
+void channel_select(int channel)
+{
+    if (channel == active_channel && channels_ready) return;
+
+    channel_sync();
+    active_channel = channel;
+    channel_restore();
+    hal_adc_select(channel);
+}
+
+static bool channels_calibrated()
+{
+    channel_sync();
+
+    for (int i = 0; i < channels_running; i++)
+    {
+        if (channels[i].calibration.valid != CALIBRATION_VALID) return false;
+    }
+    return true;
+}
+
+// ADC samples averaged per tick and channel: the channels share the ADC for up to half the period, leaving
+// the rest for the corrections and the console
+int tick_samples()
+{
+    int samples = (int)(ADC_SAMPLES_PER_US * 1000000 / control_rate / 2 / channels_running);
+
+    if (samples > average_per_read / channels_running) samples = average_per_read / channels_running;
+    if (samples < TICK_MIN_SAMPLES) samples = TICK_MIN_SAMPLES;
+    return samples;
+}
+
+static int clamp_step(int step)
+{
+    if (step > tick_max_step) return tick_max_step;
+    if (step < -tick_max_step) return -tick_max_step;
+    return step;
+}
+
+// Where the lock point is in DAC steps, from this tick's reading, and the variance of that. Quad: the step the
+// reading was taken at plus the error over the slope of the curve, on the linear part only. Peak, null and
+// lock-in have no signed error in one reading, so the step the loop sits at while inside tolerance is used
+// (the lock-in's center, not the dithered step), with the width of the tolerance band as its noise. False
+// when the reading says nothing usable.
+static bool drift_measure(float* z, float* r)
+{
+    adc_q16_t swing = peak_setpoint - null_setpoint;
+
+    if (swing <= 0 || vpi_steps <= 0) return false;
+
+    if (set_point == QUAD_PLUS || set_point == QUAD_MINUS)
+    {
+        adc_q16_t error = selected_setpoint - current_input_voltage;
+        float slope = (float)swing * PI / (2.0f * vpi_steps);       //Q16 counts per DAC step at the crossing
+        float noise = NOISE_FLOOR_Q16 / slope;
+
+        if (q16_abs(error) > swing / 4) return false;                //Past ~30 degrees the sine bends away
+
+        *z = current_output_voltage_step + (set_point == QUAD_PLUS ? 1 : -1) * error / slope;
+        *r = noise * noise;
+        return true;
+    }
+
+    if (q16_abs(current_input_voltage - selected_setpoint) > tolerance) return false;
+
+    //Near the extremum V = extremum -/+ swing / 4 * (pi * x / vpi)^2, inside tolerance |x| < half_band
+    float half_band = vpi_steps / PI * sqrtf(4.0f * tolerance / swing);
+
+    *z = (set_point == NULL_LOCKIN || set_point == PEAK_LOCKIN) ? lockin_center() : current_output_voltage_step;
+    *r = half_band * half_band / 3.0f;
+    return true;
+}
+
+// Predict the lock point one tick on and correct it with this tick's reading. Returns the predicted drift
+// over the tick in DAC steps, limited to one tick's correction.
+static int drift_tracker_estimate(float dt)
+{
+    float z, r;
+
+    drift_kalman_predict(&drift_tracker, dt);
+
+    if (drift_measure(&z, &r))
+    {
+        drift_kalman_update(&drift_tracker, z, r);
+    }
+
+    return clamp_step(drift_kalman_feed_forward(&drift_tracker, dt));
+}
+
+// Move the DAC by the predicted drift before the loop makes its own correction. The quad PID is positional,
+// its integrator is moved too.
+static void drift_tracker_tick()
+{
+    if (!drift_tracker_enabled) return;
 
+    int feed_forward = drift_tracker_estimate(control_tick_stats.period_us * 1e-6f);
+    if (feed_forward == 0) return;
 
-    sleep_ms(10000);
+    set_pwm_dac(current_output_voltage_step + feed_forward);
+    lockin_state.center += feed_forward;    //Mid demodulation the dither moves with it
 
-    // Try to load parameters from flash and handle if not found
+    if (quad_pid && tick_tracking)
+    {
+        quad_controller.integral += (int64_t)feed_forward << Q16_SHIFT;
+    }
+}
+
+//AUTO TUNING: tolerance and buffers from the noise of the readings and the shape of the curve
+#define AUTO_MIN_UPDATES          32                 //Noise estimates before the first derived values
+#define AUTO_TOLERANCE_SIGMAS     3.0f               //Tolerance band half width in reading noise
+#define AUTO_TOLERANCE_MIN        VOLTS_Q16(0.002f)  //Below this the fitted setpoint is the limit, not the noise
+#define AUTO_TOLERANCE_MAX        VOLTS_Q16(0.1f)    //Same range as 'set tolerance'
+#define AUTO_BUFFER_SIGMAS        3.0f               //A direction is judged once the readings have moved this far past the noise
+#define AUTO_BUFFER_MIN           4
+#define AUTO_QUAD_BUFFER_MIN      5
+
+// Slope of the transfer curve at the reading, Q16 counts per DAC step. With V = null + swing / 2 * (1 - cos x)
+// the slope is swing * pi / (2 * vpi) * sin x, its size follows from the reading, its sign from the quad side.
+// 0 at peak and null, where one reading does not tell the side (and the slope is small anyway).
+static float local_slope()
+{
+    adc_q16_t swing = peak_setpoint - null_setpoint;
+
+    if (swing <= 0 || vpi_steps <= 0 || (set_point != QUAD_PLUS && set_point != QUAD_MINUS)) return 0.0f;
+
+    float cosine = 1.0f - 2.0f * (current_input_voltage - null_setpoint) / (float)swing;
+    if (cosine > 1.0f) cosine = 1.0f;
+    if (cosine < -1.0f) cosine = -1.0f;
+
+    float slope = swing * PI / (2.0f * vpi_steps) * sqrtf(1.0f - cosine * cosine);
+    return set_point == QUAD_PLUS ? slope : -slope;
+}
+
+static int auto_buffer(float readings, int min, int max)
+{
+    if (!(readings < max)) return max;      //NaN too
+    if (readings < min) return min;
+    return (int)ceilf(readings);
+}
+
+// Feed this reading (samples averaged) to the noise estimate and, with 'set auto on', derive from it:
+// - tolerance: AUTO_TOLERANCE_SIGMAS reading noise, so a locked output stays inside on noise alone. On quad no
+//   less than one GAIN step of the curve at its steepest, or the fixed step loop jumps over the band.
+// - null_buffer / peak_buffer: at the edge of the band the hill climb gains GAIN * sqrt(2 * tolerance * curvature)
+//   per step, the buffer is the steps it takes for that to stand AUTO_BUFFER_SIGMAS above the noise of a
+//   difference of two readings. Clean signal, a short buffer and a quick reversal; noisy, a long one.
+// - quad_buffer: the same for the search's 16 step moves at the curve's mean slope, swing / vpi.
+static void auto_tune(int samples)
+{
+    adc_q16_t swing = peak_setpoint - null_setpoint;
+
+    noise_estimator_update(&noise_estimator, current_input_voltage, samples, current_output_voltage_step, local_slope());
+
+    if (!auto_tune_enabled || noise_estimator.updates < AUTO_MIN_UPDATES || swing <= 0 || vpi_steps <= 0) return;
+
+    float sigma = noise_estimator_sigma(&noise_estimator, samples);
+    float steepest = swing * PI / (2.0f * vpi_steps);
+    float curvature = swing / 2.0f * (PI / vpi_steps) * (PI / vpi_steps);
+    float band = AUTO_TOLERANCE_SIGMAS * sigma;
+
+    if ((set_point == QUAD_PLUS || set_point == QUAD_MINUS) && band < steepest * GAIN) band = steepest * GAIN;
+    if (band < AUTO_TOLERANCE_MIN) band = AUTO_TOLERANCE_MIN;
+    if (band > AUTO_TOLERANCE_MAX) band = AUTO_TOLERANCE_MAX;
+    tolerance = (adc_q16_t)band;
+
+    float difference_noise = AUTO_BUFFER_SIGMAS * 1.41421356f * sigma;
+    int step_size = MAX_16BIT_STEPS / MAX_12BIT_STEPS;     //Of the quad search
+
+    null_buffer = auto_buffer(difference_noise / (GAIN * sqrtf(2.0f * tolerance * curvature)), AUTO_BUFFER_MIN, 500);
+    peak_buffer = null_buffer;
+    quad_buffer = auto_buffer(difference_noise / (step_size * (float)swing / vpi_steps), AUTO_QUAD_BUFFER_MIN, 100);
+}
+
+void log_auto_tune()
+{
+    int samples = noise_estimator.samples;
+
+    console_printf("Auto tuning  : %s", auto_tune_enabled ? "on" : "off");
+    if (noise_estimator.updates == 0)
+    {
+        console_printf(", no noise estimate yet\n");
+        return;
+    }
+    console_printf(", noise %.2f mV per read of %d samples (%.2f mV per sample), slope %.3f mV/step, %lu estimates, %lu clipped\n",
+        1000 * q16_to_volts((adc_q16_t)noise_estimator_sigma(&noise_estimator, samples)), samples,
+        1000 * q16_to_volts((adc_q16_t)noise_estimator_sigma(&noise_estimator, 1)), 1000 * q16_to_volts((adc_q16_t)noise_estimator.slope),
+        (unsigned long)noise_estimator.updates, (unsigned long)noise_estimator.clipped);
+}
+
+//ESTIMATOR BENCH: cycles per tick of the float estimators above for the 'bench' command (control_bench.c)
+#define ESTIMATOR_BENCH_CHUNK     16                 //Ticks per hal_cycles() window, well inside its 24 bits
+#define ESTIMATOR_BENCH_NOISE     VOLTS_Q16(0.002f)  //Reading noise around the made up lock point
+
+static channel_t estimator_bench_saved;
+static uint32_t estimator_bench_seed = 1;
+
+// A quad+ lock on a made up sweep, on the active channel's globals, saved first
+static void estimator_bench_begin()
+{
+    channel_store(&estimator_bench_saved);
+
+    set_point = QUAD_PLUS;
+    null_setpoint = VOLTS_Q16(0.05f);
+    peak_setpoint = VOLTS_Q16(1.5f);
+    selected_setpoint = (null_setpoint + peak_setpoint) / 2;
+    vpi_steps = 26000;
+    tolerance = VOLTS_Q16(0.05f);
+    current_output_voltage_step = 30000;
+    drift_kalman_reset(&drift_tracker, DRIFT_PROCESS_NOISE);
+    noise_estimator_reset(&noise_estimator);
+    auto_tune_enabled = 1;
+}
+
+static void estimator_bench_end()
+{
+    channel_load(&estimator_bench_saved);
+}
+
+// Next reading of the made up lock, the setpoint plus a little noise
+static void estimator_bench_reading()
+{
+    estimator_bench_seed = estimator_bench_seed * 1664525u + 1013904223u;
+    current_input_voltage = selected_setpoint + (adc_q16_t)(estimator_bench_seed >> 8) % (2 * ESTIMATOR_BENCH_NOISE) - ESTIMATOR_BENCH_NOISE;
+}
+
+static void estimator_bench_drift()
+{
+    estimator_bench_reading();
+    drift_tracker_estimate(0.01f);
+}
+
+// Cycles per call of body, less a call that only makes the reading
+static float estimator_bench_time(void (*body)(void), int iterations)
+{
+    uint64_t total = 0;
+    uint64_t overhead = 0;
+    int done;
+
+    for (done = 0; done < iterations; done += ESTIMATOR_BENCH_CHUNK)
+    {
+        uint32_t start = hal_cycles();
+        for (int i = 0; i < ESTIMATOR_BENCH_CHUNK; i++) body();
+        total += (hal_cycles() - start) & HAL_CYCLES_MASK;
+
+        start = hal_cycles();
+        for (int i = 0; i < ESTIMATOR_BENCH_CHUNK; i++) estimator_bench_reading();
+        overhead += (hal_cycles() - start) & HAL_CYCLES_MASK;
+    }
+
+    return total > overhead ? (float)(total - overhead) / done : 0.0f;
+}
+
+static void estimator_bench_auto()
+{
+    estimator_bench_reading();
+    auto_tune(TICK_MIN_SAMPLES);
+}
+
+// Drift tracker per tick: predict, measure, update and feed forward, without the DAC write
+float drift_tracker_bench(int iterations)
+{
+    estimator_bench_begin();
+    float cycles = estimator_bench_time(estimator_bench_drift, iterations);
+    estimator_bench_end();
+
+    return cycles;
+}
+
+// Auto tuning per tick: the noise estimate with its slope, and the tolerance and buffers derived from it.
+// Warmed up first, so every timed tick takes the whole path.
+float auto_tune_bench(int iterations)
+{
+    estimator_bench_begin();
+    for (int i = 0; i < 2 * AUTO_MIN_UPDATES; i++) estimator_bench_auto();
+    float cycles = estimator_bench_time(estimator_bench_auto, iterations);
+    estimator_bench_end();
+
+    return cycles;
+}
+
+// One step of the process_peak / process_null hill climb. The direction is probed when the reading first
+// leaves the tolerance band, then reversed after peak_buffer / null_buffer steps that made things worse. With
+// auto tuning the band is only a few readings' noise wide, so the climb goes on to half of it before it stops,
+// or it would park on the edge and every noisy reading would start it (and its probe) again.
+//
+// The probe is process_slope_peak() / process_slope_null() spread over ticks: one GAIN step per tick the way
+// the climb last went, until the reading has moved TICK_PROBE_CHANGE from the one before the first step. The
+// climb goes on that way if that helped, else it turns round and jumps back past the start.
+static void tick_hill_climb(bool peak)
+{
+    adc_q16_t difference = q16_abs(selected_setpoint - current_input_voltage);
+    int buffer_limit = peak ? peak_buffer : null_buffer;
+
+    if (difference <= (tick_tracking && auto_tune_enabled ? tolerance / 2 : tolerance))
+    {
+        tick_tracking = false;
+        return;
+    }
+
+    if (!tick_tracking)
+    {
+        tick_probing = true;
+        tick_probe_read = current_input_voltage;
+        tick_probe_start = current_output_voltage_step;
+        tick_probe_steps = 1;
+        tick_last_difference = difference;
+        tick_tracking = true;
+        set_pwm_dac(current_output_voltage_step + (tick_direction == MOVE_RIGHT ? GAIN : -GAIN));
+        return;
+    }
+
+    if (tick_probing)
+    {
+        int step = (tick_direction == MOVE_RIGHT) ? GAIN : -GAIN;
+
+        //Q16 readings differ on noise alone, so the probe waits for a change the 1 mV readings would have shown
+        if (q16_abs(current_input_voltage - tick_probe_read) < TICK_PROBE_CHANGE)
+        {
+            tick_probe_steps++;
+            set_pwm_dac(current_output_voltage_step + step);
+            return;
+        }
+
+        //Peak wants the reading to rise, null to fall
+        bool rose = current_input_voltage > tick_probe_read;
+
+        tick_buffer = 0;
+        tick_probing = false;
+        if (rose == peak)
+        {
+            set_pwm_dac(current_output_voltage_step + clamp_step(step));
+            return;
+        }
+
+        tick_direction = !tick_direction;
+        int target = tick_probe_start - tick_probe_steps * step;
+        set_pwm_dac(current_output_voltage_step + clamp_step(target - current_output_voltage_step));
+        return;
+    }
+
+    if (tick_buffer == 0)
+    {
+        tick_prev_difference = tick_last_difference;
+    }
+
+    if (difference > tick_prev_difference)
+    {
+        tick_buffer++;
+
+        if (tick_buffer >= buffer_limit)
+        {
+            tick_direction = !tick_direction;
+            tick_buffer = 0;
+        }
+    }
+    tick_last_difference = difference;
+
+    set_pwm_dac(current_output_voltage_step + clamp_step(tick_direction == MOVE_RIGHT ? GAIN : -GAIN));
+
+    //EDGE CASE HANDELING
+    if (current_output_voltage_step <= MIN_VOLTAGE_STEP || current_output_voltage_step >= MAX_VOLTAGE_STEP) 
+    {
+        leave_rail(go_to_setpoint);
+        tick_tracking = false;
+    }
+}
+
+// One quad update. The PID runs every tick with its output limited to tick_max_step either side of the
+// current step, so the integrator is back-calculated against the per tick limit as well as the rails.
+static void tick_quad(int slope)
+{
+    if (quad_pid)
+    {
+        if (!tick_tracking)
+        {
+            pid_init(&quad_controller, per_volt_to_q16(kp), per_volt_to_q16(ki), per_volt_to_q16(kd), MIN_VOLTAGE_STEP, MAX_VOLTAGE_STEP);
+            pid_reset(&quad_controller, current_output_voltage_step, slope * current_input_voltage);
+            tick_rail_count = 0;
+            tick_tracking = true;
+        }
+
+        quad_controller.out_min = current_output_voltage_step - tick_max_step;
+        quad_controller.out_max = current_output_voltage_step + tick_max_step;
+        if (quad_controller.out_min < MIN_VOLTAGE_STEP) quad_controller.out_min = MIN_VOLTAGE_STEP;
+        if (quad_controller.out_max > MAX_VOLTAGE_STEP) quad_controller.out_max = MAX_VOLTAGE_STEP;
+
+        adc_q16_t measurement = slope * current_input_voltage;
+        set_pwm_dac(pid_update(&quad_controller, slope * selected_setpoint - measurement, measurement));
+
+        tick_rail_count = (current_output_voltage_step <= MIN_VOLTAGE_STEP || current_output_voltage_step >= MAX_VOLTAGE_STEP) ? tick_rail_count + 1 : 0;
+    }
+    else if (q16_abs(current_input_voltage - selected_setpoint) > tolerance)
+    {
+        //Same fixed GAIN step as process_quad_plus / process_quad_minus
+        int direction = (current_input_voltage > selected_setpoint) ? -slope : slope;
+        set_pwm_dac(current_output_voltage_step + clamp_step(direction * GAIN));
+
+        tick_rail_count = (current_output_voltage_step <= MIN_VOLTAGE_STEP || current_output_voltage_step >= MAX_VOLTAGE_STEP) ? PID_RAIL_LIMIT : 0;
+    }
+
+    //Handle edge case: pinned at a rail means this quad is out of range, take the one a period away
+    if (tick_rail_count >= PID_RAIL_LIMIT)
+    {
+        leave_rail(slope > 0 ? go_to_quad_plus : go_to_quad_minus);
+        tick_tracking = false;
+    }
+}
+
+// The active channel's share of a control tick: sweep if asked, the reading from the tick's capture, one
+// bounded correction
+static void channel_tick()
+{
+    bool swept = false;
+
+    if(button_pressed)
+    {
+        button_pressed = false;
+        hal_sleep_ms(200);
+        sweep();
+        param_journal_maintain(); //The bias was off for the sweep anyway
+        go_to_desired_setpoint();
+        control_tick_resync(); //The sweep is not a loop overrun
+        lockin_restart();
+        swept = true;
+    }
+
+    //Start over when the target changes (mode command, new sweep)
+    if (set_point != tick_mode || selected_setpoint != tick_setpoint)
+    {
+        tick_mode = set_point;
+        tick_setpoint = selected_setpoint;
+        tick_tracking = false;
+        lockin_restart();
+        drift_kalman_reset(&drift_tracker, DRIFT_PROCESS_NOISE);
+        noise_estimator_restart(&noise_estimator);
+    }
+
+    current_input_voltage = swept ? read_voltage_averaged(tick_samples()) : read_voltage_captured(tick_samples());
+    if (swept || rail_recovering) noise_estimator_restart(&noise_estimator); //The DAC jumped since the last reading
+    auto_tune(tick_samples());
+    warm_start_check();
+    rail_recovery_check();
+    drift_tracker_tick();
+
+    if (set_point == NULL_LOCKIN || set_point == PEAK_LOCKIN)
+    {
+        lockin_tick(tick_max_step);
+    }
+    else if (set_point == PEAK_POINT || set_point == NULL_POINT)
+    {
+        tick_hill_climb(set_point == PEAK_POINT);
+    }
+    else
+    {
+        tick_quad(set_point == QUAD_PLUS ? 1 : -1);
+    }
+}
+
+// One control tick: console, one capture for all the channels, then each channel in turn. The ADC rotates
+// through the channels' inputs, so every channel is measured over the same window and updated once per tick.
+void controller_tick()
+{
+    bool sweep_all = sweep_all_pressed;
+    bool dark = false;
+    bool quiet = true;
+
+    if (control_tick_stats.rate_hz != (uint32_t)control_rate)
+    {
+        control_tick_start(control_rate);
+    }
+
+    control_tick_wait();
+    check_serial_input();
+
+    sweep_all_pressed = false;
+    hal_adc_wait(adc_span(tick_samples()));
+
+    for (int channel = 0; channel < channels_running; channel++)
+    {
+        channel_select(channel);
+        if (sweep_all) button_pressed = true;
+
+        channel_tick();
+
+        dark = dark || current_input_voltage < NOISE_FLOOR_Q16;
+        quiet = quiet && q16_abs(current_input_voltage - selected_setpoint) <= tolerance / 2;
+    }
+    channel_select(0);
+    hal_gpio_put(LED_PIN, dark);
+
+    if (save_pending) {
+        save_params_to_flash();
+        save_pending = false;
+    }
+
+    // A sector erase stalls both cores for tens of ms, only do it while every output sits well inside tolerance
+    if (param_journal_erase_pending() && quiet)
+    {
+        param_journal_maintain();
+        control_tick_resync();
+    }
+
+    control_tick_done();
+}
+
+void controller_setup()
+{
+    // Parameters first, the channel count sets up the ADC rotation and the PWM pins
     bool params_loaded = load_params_from_flash();
     if (!params_loaded) {
-        printf("Using default parameters\n");
+        console_printf("Using default parameters\n");
         // Here we're continuing with the default parameters defined at the top
         // Let's save them to flash so they exist for next boot
         //save_params_to_flash();
     }
+    channels_running = channel_count;
 
+    // Initialize hardware
+    initialize_pwm();
+    initialize_adc();
+    initialize_button();
+    initialize_led();
+    initialize_shorts();
+
+    hal_gpio_put(LED_PIN, 0);
+
+    hal_pwm_set_mode(PWM_PIN, dac_mode);
+    test_pins(); // Channel 0's setpoint, the others keep their saved mode
+
+    // The link is dark until the bias is locked: with a stored calibration for every channel and a setpoint
+    // jumper fitted, skip the start up delay and the sweeps and go straight to the cached lock points
+    bool jumper_set = peak_pin || null_pin || quad_minus_pin || quad_plus_pin;
+    if (jumper_set && channels_calibrated())
+    {
+        display_startup_message();
+        for (int channel = 0; channel < channels_running; channel++)
+        {
+            channel_select(channel);
+            warm_start();
+        }
+        channel_select(0);
+        hal_gpio_irq_falling(BUTTON_PIN, &button_isr);
+        return;
+    }
+
+    hal_sleep_ms(10000);
+
+    param_journal_maintain(); //Nothing to disturb before the first sweep
 
     display_startup_message();
 
@@ -1176,70 +2968,145 @@ int main()
         check_serial_input();
     }
     
-    // Rest of the main function remains the same
-    sweep();
-    go_to_desired_setpoint();
+    for (int channel = 0; channel < channels_running; channel++)
+    {
+        channel_select(channel);
+        sweep();
+        go_to_desired_setpoint();
+    }
+    channel_select(0);
 
-    gpio_set_irq_enabled_with_callback(BUTTON_PIN, GPIO_IRQ_EDGE_FALL, true, &button_isr);
+    hal_gpio_irq_falling(BUTTON_PIN, &button_isr);
+}
+
+// One channel's pass of the polling loop: measure, correct if outside tolerance. True when it is locked.
+static bool channel_poll()
+{
+    current_input_voltage = read_voltage();
+    auto_tune(average_per_read / channels_running);
+    warm_start_check();
+    rail_recovery_check();
+
+    if(button_pressed)
+    {
+        button_pressed = false;
+        hal_sleep_ms(200);
+        sweep();
+        param_journal_maintain(); //The bias was off for the sweep anyway
+        go_to_desired_setpoint();
+    }
     
-    // Main loop
-    while(1) 
+    if (set_point == NULL_LOCKIN || set_point == PEAK_LOCKIN)
     {
-        check_serial_input();
-        current_input_voltage = read_voltage();
+        // Lock-in keeps correcting every pass, its error signal does not depend on the tolerance band
+        process_lockin();
+        noise_estimator_restart(&noise_estimator);
+        return false;
+    }
+    else if (q16_abs(current_input_voltage - selected_setpoint) > tolerance)
+    {
+        // The hill climbs wander off and back with many steps and reads, for peak and null the noise estimate
+        // only chains the locked passes. The quad moves stay on the slope the estimate takes off.
+        if (set_point == PEAK_POINT || set_point == NULL_POINT) noise_estimator_restart(&noise_estimator);
 
-        if (current_input_voltage < NOISE_FLOOR)
-        { 
-            gpio_put(LED_PIN, 1);
+        if (set_point == PEAK_POINT)
+        {
+            process_peak();
         }
-        else 
+        else if (set_point == QUAD_PLUS)
         {
-            gpio_put(LED_PIN, 0);
+            process_quad_plus();
         }
-
-        if(button_pressed)
+        else if (set_point == QUAD_MINUS)
         {
-            button_pressed = false;
-            sleep_ms(200);
-            sweep();
-            go_to_desired_setpoint();
+            process_quad_minus();
         }
-        
-        if (fabs(current_input_voltage - selected_setpoint) > tolerance) 
+        else if (set_point == NULL_POINT)
         {
-            if (set_point == PEAK_POINT)
-            {
-                process_peak();
-            }
-            else if (set_point == QUAD_PLUS)
-            {
-                process_quad_plus();
-            }
-            else if (set_point == QUAD_MINUS)
-            {
-                process_quad_minus();
-            }
-            else if (set_point == NULL_POINT)
-            {
-                process_null();
-            }
+            process_null();
+        }
 
-            //check_serial_input();
-            //sleep_ms(1000); // Reason: readable output and control stability 
+        //check_serial_input();
+        //sleep_ms(1000); // Reason: readable output and control stability 
 
-            polling_delay(1000);
-        }
-        else 
-        {
-            //sleep_ms(1000);
+        return false;
+    }
 
-            polling_delay(1000);
-        }
+    return true;
+}
 
-        // Check if a save is pending and perform it in the background
-        if (save_pending) {
-            save_params_to_flash();
-            save_pending = false; // Reset flag after saving
-        }
+// One pass of the main loop: a control tick, or with the tick off check serial, then measure and correct each
+// channel, then wait
+void controller_loop()
+{
+    if (control_rate > 0)
+    {
+        controller_tick();
+        return;
     }
-}
\ No newline at end of file
+
+    if (control_tick_stats.rate_hz)
+    {
+        control_tick_stop();
+    }
+
+    check_serial_input();
+
+    bool sweep_all = sweep_all_pressed;
+    bool dark = false;
+    bool locked = true;
+
+    sweep_all_pressed = false;
+
+    for (int channel = 0; channel < channels_running; channel++)
+    {
+        channel_select(channel);
+        if (sweep_all) button_pressed = true;
+
+        locked = channel_poll() && locked;
+        dark = dark || current_input_voltage < NOISE_FLOOR_Q16;
+    }
+    channel_select(0);
+    hal_gpio_put(LED_PIN, dark);
+
+    if (locked)
+    {
+        param_journal_maintain(); //Locked, a good moment for a pending sector erase
+    }
+    polling_delay(1000);
+
+    // Check if a save is pending and perform it in the background
+    if (save_pending) {
+        save_params_to_flash();
+        save_pending = false; // Reset flag after saving
+    }
+}
+
+// The host build (simulation_code) provides its own main() and drives the two functions above
+#ifndef BIAS_HOST_BUILD
+// Core 1: the control loop. Output goes through the console ring, so nothing here waits on USB.
+void control_core_main()
+{
+    controller_setup();
+
+    // Main loop
+    while(1) 
+    {
+        controller_loop();
+    }
+}
+
+// Core 0: USB serial only, commands are queued to core 1 and its output is written out
+int main()
+{
+    hal_stdio_init();
+    hal_core1_launch(control_core_main);
+
+    while(1)
+    {
+        console_service();
+        telemetry_drain();
+        hal_sleep_ms(1);
+    }
+}
+#endif
@@ -0,0 +1,134 @@
+#ifndef BIAS_CONTROLLER_PICO_H
+#define BIAS_CONTROLLER_PICO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <math.h>
+#include "fixed_point.h"
+#include "drift_kalman.h"
+#include "noise_estimator.h"
+
+// Controller constants, state and entry points shared with the other firmware modules and the host simulation
+
+#define MAX_VOLTAGE_STEP          65535              //Maximum voltage step DAC
+#define MIN_VOLTAGE_STEP          0                  //Minimum voltage step DAC
+#define MAX_VOLTAGE               3.3f
+#define MIN_VOLTAGE               0.0f
+#define NOISE_FLOOR               0.01f              //Noise floor (for null bias)
+#define MAX_8BIT_STEPS            256                //Max value for 8-bit
+#define MAX_12BIT_STEPS           4096               //Max value for 12-bit 
+#define MAX_16BIT_STEPS           65536              //Max value for 16-bit 
+#define PI                        3.14159265f
+#define Q16_PER_VOLT              (MAX_12BIT_STEPS * (float)Q16_ONE / MAX_VOLTAGE)   //ADC counts in Q16.16 per volt
+#define VOLTS_Q16(volts)          ((adc_q16_t)((volts) * Q16_PER_VOLT + 0.5f))       //Constant version of volts_to_q16(), for initializers
+#define NOISE_FLOOR_Q16           VOLTS_Q16(NOISE_FLOOR)
+
+//Board pins, setpoint selection jumpers are read once at boot
+#define PWM_PIN                   15                 //PIN 20
+#define BUTTON_PIN                14                 //PIN 19
+#define LED_PIN                   13
+#define NULL_PIN                  18
+#define QUAD_PLUS_PIN             19
+#define QUAD_MINUS_PIN            20
+#define PEAK_PIN                  21
+
+//Channels: one modulator each, channel n reads ADC input n (GPIO 26 + n) and drives its own PWM pin
+#define CONTROLLER_CHANNELS       3                  //ADC inputs 0 to 2 are the ones on header pins
+#define CHANNEL_PWM_PINS          {PWM_PIN, 16, 22}  //PIN 20, 21 and 29, each on its own PWM slice
+
+enum setPoint {
+    NULL_POINT,
+    QUAD_MINUS,
+    QUAD_PLUS, 
+    PEAK_POINT,
+    NULL_LOCKIN,                  //Null tracked with the dither lock-in (lockin.c), selected with the 'mode' command
+    PEAK_LOCKIN                   //Same for peak
+};
+
+#define RAIL_HIST_BINS            10                 //Rail recovery time histogram bins, see leave_rail()
+
+typedef struct {
+    uint32_t wraps;                   //Rails left by jumping a period towards mid-range
+    uint32_t searches;                //Rails that needed the linear search (no lock point a period away)
+    uint32_t recoveries;              //Back inside tolerance after a rail
+    uint32_t last_ms;                 //Rail to back inside tolerance
+    uint32_t max_ms;
+    uint32_t histogram[RAIL_HIST_BINS];   //Recovery times, < 16 ms then doubling, the last bin open ended
+} rail_stats_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//Readings, setpoints and the tolerance are ADC counts in Q16.16 (fixed_point.h), volts only for printing
+extern enum setPoint set_point;
+extern adc_q16_t tolerance;
+extern int quad_buffer;
+extern int null_buffer;
+extern int peak_buffer;
+extern adc_q16_t null_setpoint;
+extern adc_q16_t peak_setpoint;
+extern adc_q16_t quad_setpoint;
+extern adc_q16_t selected_setpoint;
+extern adc_q16_t current_input_voltage;
+extern int current_output_voltage_step;
+extern int peak_voltage_step;
+extern int null_voltage_step;
+extern int vpi_steps;
+extern int drift_tracker_enabled;
+extern drift_kalman_t drift_tracker;
+extern int auto_tune_enabled;
+extern noise_estimator_t noise_estimator;
+extern rail_stats_t rail_stats;
+extern bool rail_recovering;
+extern int channel_count;
+extern int active_channel;
+
+void controller_setup(void);      //Hardware init, parameter load, wait for setpoint jumper, sweep and first lock
+void controller_loop(void);       //One pass of the main loop
+
+void process_command(char* cmd);
+adc_q16_t read_voltage(void);
+int dac_tau_samples(void);               //RC time constant of the active channel's DAC in ADC samples per input
+uint32_t adc_samples_us(int samples);   //Time the ADC takes for that many samples of every input
+int adc_span(int samples);               //Samples to wait for before a read of samples holds only newer ones
+adc_q16_t read_adc_captured(int samples);   //Filtered mean of the last samples of the active input, no telemetry
+void set_pwm_dac(int voltage_step);
+void sweep(void);
+void go_to_setpoint(void);
+void go_to_desired_setpoint(void);
+void select_setpoint(void);
+void log_selected_setpoint(void);
+void process_peak(void);
+void process_null(void);
+void process_quad_plus(void);
+void process_quad_minus(void);
+void detect_peak(const adc_q16_t* result_array, size_t arraySize);   //Peak level and step of a 12-bit sweep
+void detect_null(const adc_q16_t* result_array, size_t arraySize);
+void leave_rail(void (*search)(void));   //Output hit a DAC rail, move to the same lock point a period away
+void channel_select(int channel);        //Make channel the one the globals above (and the commands) refer to
+float drift_tracker_bench(int iterations);   //Cycles per tick of the drift tracker's float work, for 'bench'
+float auto_tune_bench(int iterations);       //Same for the noise estimate and auto tuning
+
+static inline adc_q16_t volts_to_q16(float volts)
+{
+    return (adc_q16_t)lroundf(volts * Q16_PER_VOLT);
+}
+
+static inline float q16_to_volts(adc_q16_t value)
+{
+    return value * (1.0f / Q16_PER_VOLT);
+}
+
+//A gain typed in per volt of error (PID gains), as Q16 per ADC count
+static inline int32_t per_volt_to_q16(float per_volt)
+{
+    return (int32_t)lroundf(per_volt * Q16_ONE / (MAX_12BIT_STEPS / MAX_VOLTAGE));
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "hal.h"
+#include "console.h"
+#include "spsc_ring.h"
+
+#define CONSOLE_OUTPUT_SIZE       (1u << CONSOLE_OUTPUT_BITS)
+#define CONSOLE_COMMAND_SIZE      (1u << CONSOLE_COMMAND_BITS)
+
+static uint8_t output_buffer[CONSOLE_OUTPUT_SIZE];
+static uint8_t command_buffer[CONSOLE_COMMAND_SIZE];
+
+static spsc_ring_t output_ring = SPSC_RING_INIT(output_buffer);
+static spsc_ring_t command_ring = SPSC_RING_INIT(command_buffer);
+
+static volatile uint32_t dropped = 0;
+
+// Line being typed on core 0
+static char line[CONSOLE_LINE_LEN];
+static int line_length = 0;
+
+int console_printf(const char *format, ...)
+{
+    char message[160];
+    va_list args;
+
+    va_start(args, format);
+    int length = vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    if (length < 0) return length;
+    if (length >= (int)sizeof(message)) length = sizeof(message) - 1;
+
+    if (!spsc_ring_push(&output_ring, message, (uint32_t)length))
+    {
+        dropped += length;
+    }
+
+#ifdef BIAS_HOST_BUILD
+    console_flush(); // No second core on the host, print straight away
+#endif
+
+    return length;
+}
+
+bool console_next_command(char *command, size_t size)
+{
+    if (spsc_ring_used(&command_ring) == 0) return false;
+
+    // Lines are pushed whole with their '\n', so a non-empty ring always holds at least one complete line
+    size_t length = 0;
+    while (spsc_ring_used(&command_ring) > 0)
+    {
+        const uint8_t *data;
+        spsc_ring_peek(&command_ring, &data);
+        uint8_t c = *data;
+        spsc_ring_release(&command_ring, 1);
+
+        if (c == '\n') break;
+        if (length < size - 1) command[length++] = (char)c;
+    }
+
+    command[length] = '\0';
+    return true;
+}
+
+uint32_t console_dropped()
+{
+    return dropped;
+}
+
+void console_flush()
+{
+    const uint8_t *data;
+    uint32_t length;
+
+    while ((length = spsc_ring_peek(&output_ring, &data)) > 0)
+    {
+        fwrite(data, 1, length, stdout);
+        spsc_ring_release(&output_ring, length);
+    }
+
+    fflush(stdout);
+}
+
+void console_service()
+{
+    int c;
+
+    // Non-blocking check for any available characters
+    while ((c = hal_getchar_timeout_us(0)) != HAL_NO_CHAR)
+    {
+        // Echo received character back to terminal
+        putchar(c);
+
+        if (c == '\r' || c == '\n')
+        {
+            if (line_length > 0)
+            {
+                line[line_length++] = '\n';
+                if (!spsc_ring_push(&command_ring, line, (uint32_t)line_length))
+                {
+                    printf("\nCommand queue full, '%.*s' ignored\n", line_length - 1, line);
+                }
+                line_length = 0;
+                putchar('\n');  // Echo newline
+            }
+        }
+        else if (c == 8 || c == 127)  // Backspace or Delete
+        {
+            if (line_length > 0)
+            {
+                line_length--;
+                // Echo backspace-space-backspace to erase character on terminal
+                putchar(8);
+                putchar(' ');
+                putchar(8);
+            }
+        }
+        else if (line_length < CONSOLE_LINE_LEN - 2)  // Room for the '\n' added at the end
+        {
+            line[line_length++] = (char)c;
+        }
+    }
+
+    console_flush();
+}
@@ -0,0 +1,44 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+Serial console split across the two RP2040 cores.
+
+Core 0 owns USB CDC: console_service() reads characters, echoes and edits the line, queues each finished
+command line, and writes out whatever the control loop has logged. Core 1 runs the control loop and only
+touches two lock-free single-producer/single-consumer byte rings (spsc_ring.h):
+
+    commands  core 0 -> core 1    whole lines, popped with console_next_command()
+    output    core 1 -> core 0    console_printf(), a message that does not fit is dropped and counted
+
+so the control loop never waits on USB and every command runs on the core that owns the parameters.
+The host build has a single thread: output is written straight through and check_serial_input() calls
+console_service() itself.
+*/
+
+#define CONSOLE_LINE_LEN          100                //Longest command line, including the terminator
+#define CONSOLE_OUTPUT_BITS       12                 //4 KB of buffered log output, enough for the help text
+#define CONSOLE_COMMAND_BITS      9                  //512 B of queued command lines
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//Core 1 side, never blocks
+int console_printf(const char *format, ...);
+bool console_next_command(char *command, size_t size);   //Copy out the oldest queued line, false if none
+uint32_t console_dropped(void);                          //Output bytes lost because core 0 fell behind
+
+//Core 0 side, may block on USB
+void console_service(void);                              //Read input, queue lines, flush output
+void console_flush(void);                                //Flush output only
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
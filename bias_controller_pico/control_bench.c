@@ -0,0 +1,223 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "hal.h"
+#include "bias_controller_pico.h"
+#include "console.h"
+#include "pid.h"
+#include "control_bench.h"
+#include "adc_hampel.h"
+
+#define BENCH_SAMPLES             4000               //ADC samples per reading, average_per_read
+#define BENCH_CHUNK               64                 //Iterations per hal_cycles() window, keeps a window well inside 24 bits
+#define BENCH_SCAN_POINTS         256                //Sweep array scanned per pass
+#define BENCH_SPIKE_EVERY         64                 //One glitched sample in this many of the outlier filter's input
+#define BENCH_KP                  2000.0f            //Default quad PID gains
+#define BENCH_KI                  4000.0f
+
+//The old float pid_controller_t and pid_update(), kept only to compare against
+typedef struct {
+    float kp;
+    float ki;
+    float kd;
+    float out_min;
+    float out_max;
+    float integral;
+    float prev_measurement;
+    bool saturated;
+} legacy_pid_t;
+
+static float legacy_pid_update(legacy_pid_t *pid, float error, float measurement)
+{
+    float derivative = -(measurement - pid->prev_measurement);
+    pid->prev_measurement = measurement;
+
+    pid->integral += pid->ki * error;
+
+    float output = pid->integral + pid->kp * error + pid->kd * derivative;
+
+    pid->saturated = false;
+
+    if (output > pid->out_max)
+    {
+        pid->integral -= output - pid->out_max;
+        output = pid->out_max;
+        pid->saturated = true;
+    }
+    else if (output < pid->out_min)
+    {
+        pid->integral += pid->out_min - output;
+        output = pid->out_min;
+        pid->saturated = true;
+    }
+
+    return output;
+}
+
+static float legacy_set_precision(float value)
+{
+    value = value * 1000.0f;
+    value = floor(value);
+    value = value / 1000.0f;
+
+    return value;
+}
+
+//Reading from an ADC sum, then volts, as read_voltage_averaged() did
+static float legacy_reading(uint32_t sum)
+{
+    const float conversion_factor = MAX_VOLTAGE / MAX_12BIT_STEPS;
+    float counts = (float)sum / (float)BENCH_SAMPLES;
+
+    return legacy_set_precision(counts * conversion_factor);
+}
+
+//ADC sums around mid-scale that the compiler cannot fold away
+static uint32_t bench_state = 1;
+
+static uint32_t bench_sum(void)
+{
+    bench_state = bench_state * 1664525u + 1013904223u;
+    return BENCH_SAMPLES * 2048u + (bench_state >> 12);
+}
+
+static volatile int32_t bench_sink;
+
+static uint32_t elapsed(uint32_t start)
+{
+    return (hal_cycles() - start) & HAL_CYCLES_MASK;
+}
+
+//Cycles per pass of body, less the loop and bench_sum() overhead measured with an empty body
+#define BENCH_TIME(result, iterations, body)                                  \
+    do {                                                                      \
+        uint64_t total = 0;                                                   \
+        for (int done = 0; done < (iterations); done += BENCH_CHUNK)          \
+        {                                                                     \
+            uint32_t start = hal_cycles();                                    \
+            for (int i = 0; i < BENCH_CHUNK; i++)                             \
+            {                                                                 \
+                uint32_t sum = bench_sum();                                   \
+                body;                                                         \
+            }                                                                 \
+            total += elapsed(start);                                          \
+        }                                                                     \
+        (result) = (float)total / (float)(((iterations) + BENCH_CHUNK - 1) / BENCH_CHUNK * BENCH_CHUNK); \
+    } while (0)
+
+static void print_row(const char *name, float legacy, float fixed, float overhead)
+{
+    legacy -= overhead;
+    fixed -= overhead;
+    if (legacy < 0) legacy = 0;
+    if (fixed < 0) fixed = 0;
+
+    if (fixed > 0)
+        console_printf("%-22s: %8.1f %8.1f   x%.1f\n", name, legacy, fixed, legacy / fixed);
+    else
+        console_printf("%-22s: %8.1f %8.1f   -\n", name, legacy, fixed);
+}
+
+void control_bench_run(int iterations)
+{
+    static float legacy_scan[BENCH_SCAN_POINTS];
+    static adc_q16_t fixed_scan[BENCH_SCAN_POINTS];
+    static uint16_t raw_samples[BENCH_SCAN_POINTS];
+    static adc_hampel_t hampel;
+
+    const float legacy_setpoint = 1.0124f;
+    const float legacy_tolerance = 0.05f;
+    const adc_q16_t setpoint = volts_to_q16(legacy_setpoint);
+    const adc_q16_t tol = volts_to_q16(legacy_tolerance);
+
+    legacy_pid_t legacy_pid = {BENCH_KP, BENCH_KI, 0.0f, MIN_VOLTAGE_STEP, MAX_VOLTAGE_STEP, 30000.0f, 0.0f, false};
+    pid_controller_t pid;
+
+    pid_init(&pid, per_volt_to_q16(BENCH_KP), per_volt_to_q16(BENCH_KI), 0, MIN_VOLTAGE_STEP, MAX_VOLTAGE_STEP);
+    pid_reset(&pid, 30000, setpoint);
+
+    for (int i = 0; i < BENCH_SCAN_POINTS; i++)
+    {
+        uint32_t sum = bench_sum();
+        legacy_scan[i] = legacy_reading(sum);
+        fixed_scan[i] = q16_mean(sum, BENCH_SAMPLES);
+        raw_samples[i] = (uint16_t)(2048u + (sum & 7u) + ((i % BENCH_SPIKE_EVERY) ? 0u : 1000u));   //A few counts of noise
+    }
+
+    float overhead, legacy_mean, fixed_mean, legacy_error, fixed_error, legacy_update, fixed_update, legacy_total, fixed_total;
+
+    BENCH_TIME(overhead, iterations, bench_sink = (int32_t)sum);
+
+    BENCH_TIME(legacy_mean, iterations, bench_sink = (int32_t)(legacy_reading(sum) * 1000.0f));
+    BENCH_TIME(fixed_mean, iterations, bench_sink = q16_mean(sum, BENCH_SAMPLES));
+
+    BENCH_TIME(legacy_error, iterations, bench_sink = fabs((float)sum * 1e-6f - legacy_setpoint) > legacy_tolerance);
+    BENCH_TIME(fixed_error, iterations, bench_sink = q16_abs((adc_q16_t)(sum >> 8) - setpoint) > tol);
+
+    BENCH_TIME(legacy_update, iterations,
+        float reading = (float)(sum & 0xFFF) * 0.0005f;
+        bench_sink = (int32_t)lroundf(legacy_pid_update(&legacy_pid, legacy_setpoint - reading, reading)));
+    BENCH_TIME(fixed_update, iterations,
+        adc_q16_t reading = (adc_q16_t)(sum & 0xFFF) << 12;
+        bench_sink = pid_update(&pid, setpoint - reading, reading));
+
+    //Whole iteration: reading, tolerance check, PID
+    BENCH_TIME(legacy_total, iterations,
+        float reading = legacy_reading(sum);
+        if (fabs(reading - legacy_setpoint) > legacy_tolerance)
+            bench_sink = (int32_t)lroundf(legacy_pid_update(&legacy_pid, legacy_setpoint - reading, reading)));
+    BENCH_TIME(fixed_total, iterations,
+        adc_q16_t reading = q16_mean(sum, BENCH_SAMPLES);
+        if (q16_abs(reading - setpoint) > tol)
+            bench_sink = pid_update(&pid, setpoint - reading, reading));
+
+    //Peak scan of a sweep array, per point, as detect_peak() does it
+    float legacy_scan_cycles, fixed_scan_cycles;
+    int scan_passes = iterations / BENCH_SCAN_POINTS + 1;
+
+    BENCH_TIME(legacy_scan_cycles, scan_passes,
+        float best = 0.0f;
+        for (int k = 0; k < BENCH_SCAN_POINTS; k++) if (legacy_scan[k] > best) best = legacy_scan[k];
+        bench_sink = (int32_t)(best * 1000.0f + (float)(sum & 1)));
+    BENCH_TIME(fixed_scan_cycles, scan_passes,
+        adc_q16_t best = 0;
+        for (int k = 0; k < BENCH_SCAN_POINTS; k++) if (fixed_scan[k] > best) best = fixed_scan[k];
+        bench_sink = best + (adc_q16_t)(sum & 1));
+
+    //Outlier filter on the raw samples of a read, per sample, at the smallest, default and largest window
+    static const int windows[] = {3, 7, ADC_HAMPEL_MAX_WINDOW};
+    float hampel_cycles[3];
+    uint32_t hampel_rejected[3];
+    uint32_t hampel_samples[3];
+
+    for (int w = 0; w < 3; w++)
+    {
+        adc_hampel_init(&hampel, windows[w], 3.0f);
+        BENCH_TIME(hampel_cycles[w], scan_passes,
+            uint32_t filtered = sum & 1;
+            for (int k = 0; k < BENCH_SCAN_POINTS; k++) filtered += adc_hampel_push(&hampel, raw_samples[k]);
+            bench_sink = (int32_t)filtered);
+        hampel_rejected[w] = hampel.rejected;
+        hampel_samples[w] = hampel.samples;
+    }
+
+#ifdef BIAS_HOST_BUILD
+    console_printf("\nCONTROL BENCH: %d iterations, host ns (relative only)\n", iterations);
+#else
+    console_printf("\nCONTROL BENCH: %d iterations, CPU cycles\n", iterations);
+#endif
+    console_printf("%-22s: %8s %8s   speedup\n", "per iteration", "float", "fixed");
+    print_row("ADC mean to reading", legacy_mean, fixed_mean, overhead);
+    print_row("Tolerance check", legacy_error, fixed_error, overhead);
+    print_row("PID update", legacy_update, fixed_update, overhead);
+    print_row("Control iteration", legacy_total, fixed_total, overhead);
+    print_row("Sweep scan, per point", (legacy_scan_cycles - overhead) / BENCH_SCAN_POINTS, (fixed_scan_cycles - overhead) / BENCH_SCAN_POINTS, 0.0f);
+    console_printf("%-22s: %8.1f %8s   float only\n", "Drift tracker, tick", drift_tracker_bench(iterations), "");
+    console_printf("%-22s: %8.1f %8s   float only\n", "Auto tuning, tick", auto_tune_bench(iterations), "");
+    for (int w = 0; w < 3; w++)
+    {
+        console_printf("Hampel %2d, per sample : %8s %8.1f   %lu of %lu rejected\n", windows[w], "",
+            (hampel_cycles[w] - overhead) / BENCH_SCAN_POINTS, (unsigned long)hampel_rejected[w], (unsigned long)hampel_samples[w]);
+    }
+    console_printf("\n");
+}
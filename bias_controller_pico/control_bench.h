@@ -0,0 +1,30 @@
+#ifndef CONTROL_BENCH_H
+#define CONTROL_BENCH_H
+
+/*
+Cycle count of the arithmetic in one control iteration (`bench` command), the float pipeline the firmware
+used to run against the fixed point one it runs now.
+
+The float side is a frozen copy of the old code: float divide for the ADC mean, conversion to volts,
+set_precision() truncation through floor(), fabs() error check and the float PID. The fixed side calls the
+live code: q16_mean(), q16_abs() and pid_update(). The ADC wait and the DAC write cost the same either way
+and are left out. The peak/null scan of a sweep array is timed per point the same way, and the outlier filter
+(adc_hampel.h) per raw sample, on a few counts of noise with one glitch in 64 samples. The drift tracker and
+auto tuning are the float work left in a tick, they are timed per tick on a made up quad lock
+(drift_tracker_bench(), auto_tune_bench()).
+
+Cycles come from hal_cycles(), SysTick on the Pico, so the numbers are M0+ cycles at the system clock.
+On the host they are nanoseconds and only show the relative cost.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void control_bench_run(int iterations);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
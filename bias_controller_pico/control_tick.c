@@ -0,0 +1,70 @@
+#include <math.h>
+#include "hal.h"
+#include "control_tick.h"
+
+control_tick_stats_t control_tick_stats = {0};
+
+static uint64_t start_us = 0;       //Schedule origin, tick n is due at start_us + n * period_us
+static uint64_t wake_us = 0;
+static uint32_t last_count = 0;
+
+void control_tick_start(uint32_t rate_hz)
+{
+    control_tick_stats_t cleared = {0};
+
+    control_tick_stats = cleared;
+    control_tick_stats.rate_hz = rate_hz;
+    control_tick_stats.period_us = 1000000u / rate_hz;
+
+    control_tick_resync();
+}
+
+void control_tick_stop()
+{
+    hal_tick_stop();
+    control_tick_stats.rate_hz = 0;
+}
+
+void control_tick_resync()
+{
+    hal_tick_start(control_tick_stats.period_us);
+    start_us = hal_time_us();
+    wake_us = start_us;                 //Nor is the job part of this tick's busy time
+    last_count = 0;
+}
+
+void control_tick_wait()
+{
+    uint32_t count = hal_tick_wait();
+    wake_us = hal_time_us();
+
+    if (count - last_count > 1)
+    {
+        control_tick_stats.overruns += count - last_count - 1;
+    }
+    last_count = count;
+
+    uint64_t due_us = start_us + (uint64_t)count * control_tick_stats.period_us;
+    uint32_t late_us = (wake_us > due_us) ? (uint32_t)(wake_us - due_us) : 0;
+
+    //Welford update of the wake up delay
+    control_tick_stats.ticks++;
+    float delta = late_us - control_tick_stats.late_mean_us;
+    control_tick_stats.late_mean_us += delta / control_tick_stats.ticks;
+    control_tick_stats.late_m2 += delta * (late_us - control_tick_stats.late_mean_us);
+
+    if (late_us > control_tick_stats.late_max_us) control_tick_stats.late_max_us = late_us;
+}
+
+void control_tick_done()
+{
+    uint32_t busy_us = (uint32_t)(hal_time_us() - wake_us);
+
+    control_tick_stats.busy_last_us = busy_us;
+    if (busy_us > control_tick_stats.busy_max_us) control_tick_stats.busy_max_us = busy_us;
+}
+
+float control_tick_jitter_us()
+{
+    return control_tick_stats.ticks ? sqrtf(control_tick_stats.late_m2 / control_tick_stats.ticks) : 0.0f;
+}
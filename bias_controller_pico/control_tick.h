@@ -0,0 +1,44 @@
+#ifndef CONTROL_TICK_H
+#define CONTROL_TICK_H
+
+#include <stdint.h>
+
+/*
+Fixed rate control tick on top of the HAL repeating timer.
+
+control_tick_wait() blocks until the next tick and measures how late the control loop woke up against the
+ideal schedule (start + n * period). A tick that fires while the previous one is still running is an
+overrun: it is skipped, counted, and the loop carries on from the newest tick instead of trying to catch up.
+control_tick_done() marks the end of the tick's work so the busy time can be compared with the period.
+*/
+
+typedef struct {
+    uint32_t rate_hz;               //0 when stopped
+    uint32_t period_us;
+    uint32_t ticks;                 //Ticks serviced
+    uint32_t overruns;              //Ticks skipped because the loop was still busy
+    uint32_t late_max_us;           //Worst wake up delay against the ideal schedule
+    float late_mean_us;             //Running mean of the wake up delay
+    float late_m2;                  //Welford sum of squares, jitter = sqrt(late_m2 / ticks)
+    uint32_t busy_last_us;
+    uint32_t busy_max_us;           //Longest tick, wake up to control_tick_done()
+} control_tick_stats_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern control_tick_stats_t control_tick_stats;
+
+void control_tick_start(uint32_t rate_hz);       //(Re)start at rate_hz and clear the statistics
+void control_tick_stop(void);
+void control_tick_resync(void);                  //Restart the schedule after a long blocking job (sweep) without counting it
+void control_tick_wait(void);
+void control_tick_done(void);
+float control_tick_jitter_us(void);              //Standard deviation of the wake up delay
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
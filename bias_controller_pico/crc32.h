@@ -0,0 +1,28 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+CRC-32 (IEEE 802.3, reflected polynomial 0xEDB88320, as zlib). Nibble table, 64 bytes of constants and
+two lookups per byte, which is plenty for parameter records and telemetry frames.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//Continue a CRC over more data, start with crc = 0
+uint32_t crc32_update(uint32_t crc, const void *data, size_t length);
+
+static inline uint32_t crc32(const void *data, size_t length)
+{
+    return crc32_update(0, data, length);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
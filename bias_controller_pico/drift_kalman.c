@@ -0,0 +1,83 @@
+#include "drift_kalman.h"
+
+#define DRIFT_KALMAN_RATE0        1000.0f            //Prior standard deviation of the drift rate, DAC steps per second
+
+void drift_kalman_reset(drift_kalman_t *kf, float q)
+{
+    drift_kalman_t cleared = {0};
+
+    cleared.q = q;
+    *kf = cleared;
+}
+
+void drift_kalman_predict(drift_kalman_t *kf, float dt)
+{
+    if (!kf->valid) return;
+
+    //x = F x, P = F P F' + Q with F = [1 dt; 0 1] and Q the white acceleration noise over dt
+    kf->position += kf->rate * dt;
+
+    kf->p00 += dt * (2.0f * kf->p01 + dt * kf->p11) + kf->q * dt * dt * dt / 3.0f;
+    kf->p01 += dt * kf->p11 + kf->q * dt * dt / 2.0f;
+    kf->p11 += kf->q * dt;
+}
+
+bool drift_kalman_update(drift_kalman_t *kf, float z, float r)
+{
+    kf->r = r;
+
+    if (!kf->valid)
+    {
+        kf->position = z;
+        kf->rate = 0.0f;
+        kf->p00 = r;
+        kf->p01 = 0.0f;
+        kf->p11 = DRIFT_KALMAN_RATE0 * DRIFT_KALMAN_RATE0;
+        kf->innovation = 0.0f;
+        kf->residue = 0.0f;
+        kf->rejects_in_row = 0;
+        kf->valid = true;
+        return true;
+    }
+
+    float s = kf->p00 + r;
+    float y = z - kf->position;
+
+    kf->innovation = y;
+
+    if (y * y > DRIFT_KALMAN_GATE * DRIFT_KALMAN_GATE * s)
+    {
+        kf->rejected++;
+        if (++kf->rejects_in_row >= DRIFT_KALMAN_MAX_REJECTS)
+        {
+            kf->valid = false;          //Restart from the next measurement, counters kept
+        }
+        return false;
+    }
+
+    float k0 = kf->p00 / s;
+    float k1 = kf->p01 / s;
+
+    kf->position += k0 * y;
+    kf->rate += k1 * y;
+
+    //P = (I - K H) P with H = [1 0]
+    kf->p11 -= k1 * kf->p01;
+    kf->p01 -= k0 * kf->p01;
+    kf->p00 -= k0 * kf->p00;
+
+    kf->updates++;
+    kf->rejects_in_row = 0;
+    return true;
+}
+
+int drift_kalman_feed_forward(drift_kalman_t *kf, float dt)
+{
+    if (!kf->valid) return 0;
+
+    kf->residue += kf->rate * dt;
+
+    int steps = (int)kf->residue;       //Toward zero, the fraction waits for the next tick
+    kf->residue -= steps;
+    return steps;
+}
@@ -0,0 +1,53 @@
+#ifndef DRIFT_KALMAN_H
+#define DRIFT_KALMAN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+Two state Kalman filter of the lock point drift.
+
+The state is where the lock point is (DAC steps) and how fast it moves (DAC steps per second), a constant
+velocity model driven by white acceleration noise q, so a thermal ramp is followed with no lag once its
+rate has been learned. Every control tick predicts the state forward, the controller measures where the
+lock point is from the reading (or the step the loop sits at) and updates with measurement noise r.
+Measurements more than DRIFT_KALMAN_GATE standard deviations from the prediction are rejected, a run of
+DRIFT_KALMAN_MAX_REJECTS means the lock point jumped (edge case, new sweep) and the filter restarts.
+
+drift_kalman_feed_forward() hands out the predicted movement in whole DAC steps, keeping the fraction, so
+the loop is moved along with the drift before it has to correct for it.
+
+Float, a few dozen operations per tick, the 'bench' command times it (drift_tracker_bench()).
+*/
+
+#define DRIFT_KALMAN_GATE         3.0f               //Innovation gate in standard deviations
+#define DRIFT_KALMAN_MAX_REJECTS  8                  //Rejected measurements in a row before the filter restarts
+
+typedef struct {
+    float position;                   //Lock point, DAC steps
+    float rate;                       //Drift, DAC steps per second
+    float p00, p01, p11;              //Covariance of (position, rate)
+    float q;                          //Process noise, (steps / s)^2 per second of white acceleration
+    float r;                          //Measurement noise, steps^2
+    float innovation;                 //Last measurement minus prediction, steps
+    float residue;                    //Feed forward not handed out yet, fraction of a step
+    uint32_t updates;
+    uint32_t rejected;
+    int rejects_in_row;
+    bool valid;                       //False until the first measurement
+} drift_kalman_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void drift_kalman_reset(drift_kalman_t *kf, float q);          //Forget the state, the next measurement starts it
+void drift_kalman_predict(drift_kalman_t *kf, float dt);
+bool drift_kalman_update(drift_kalman_t *kf, float z, float r); //False if the measurement was gated out
+int drift_kalman_feed_forward(drift_kalman_t *kf, float dt);   //Whole DAC steps the lock point moves in dt
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef FIXED_POINT_H
+#define FIXED_POINT_H
+
+#include <stdint.h>
+
+/*
+Fixed point ADC measurements. The RP2040 has no FPU, so readings, setpoints, tolerances and control errors
+are kept in ADC counts as signed Q16.16: 16 fractional bits below one count. Full scale (4096 counts) is
+2^28, so any reading, difference or sum of two fits an int32_t, and the mean of a few thousand samples
+keeps its sub-count resolution. Products with a Q16 gain need an int64_t intermediate.
+
+Volts only appear at the edges, when a value is printed or typed in, see volts_to_q16() / q16_to_volts()
+in bias_controller_pico.h.
+
+No Pico SDK dependency, also built into the host tools.
+*/
+
+typedef int32_t adc_q16_t;
+
+#define Q16_SHIFT                 16
+#define Q16_ONE                   (1 << Q16_SHIFT)
+
+static inline adc_q16_t q16_abs(adc_q16_t value)
+{
+    return value < 0 ? -value : value;
+}
+
+//Mean of n samples from their sum, exact to the last fractional bit. Two 32-bit divides (in hardware on
+//the RP2040) instead of a 64-bit one. The remainder is < n, so n must stay below 2^16.
+static inline adc_q16_t q16_mean(uint32_t sum, uint32_t n)
+{
+    if (n == 0) return 0;
+
+    uint32_t whole = sum / n;
+    uint32_t rest = sum - whole * n;
+
+    return (adc_q16_t)((whole << Q16_SHIFT) + (rest << Q16_SHIFT) / n);
+}
+
+//value * gain, both Q16, rounded to Q16
+static inline int32_t q16_mul(int32_t value, int32_t gain)
+{
+    return (int32_t)(((int64_t)value * gain + (Q16_ONE / 2)) >> Q16_SHIFT);
+}
+
+//Round a Q16 value to the nearest integer
+static inline int32_t q16_round(int64_t value)
+{
+    return (int32_t)((value + (Q16_ONE / 2)) >> Q16_SHIFT);
+}
+
+#endif
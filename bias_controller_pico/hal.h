@@ -0,0 +1,81 @@
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "fixed_point.h"
+
+/*
+Hardware abstraction layer for the bias controller.
+
+bias_controller_pico.c only talks to the hardware through these functions. hal_pico.c implements them
+with the Pico SDK, simulation_code/hal_host.cpp implements them on Linux against a simulated MZM and a
+virtual clock so the same control code can be run and measured without a board.
+*/
+
+#define HAL_NO_CHAR               (-1)               //Returned by hal_getchar_timeout_us() when nothing was received
+#define HAL_FLASH_SECTOR_SIZE     4096u              //Smallest erasable flash unit
+#define HAL_FLASH_PAGE_SIZE       256u               //Smallest programmable flash unit
+#define HAL_CYCLES_MASK           0x00FFFFFFu        //hal_cycles() wraps at 24 bits, subtract and mask
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*hal_gpio_callback_t)(unsigned int gpio, uint32_t events);
+
+//STDIO
+void hal_stdio_init(void);
+int hal_getchar_timeout_us(uint32_t timeout_us);    //Next received character or HAL_NO_CHAR
+void hal_stdio_write_raw(const uint8_t *data, size_t length);   //Binary write, no CR/LF translation
+
+//ADC: free-running capture of raw 12-bit counts, inputs 0 .. inputs - 1 sampled in rotation
+void hal_adc_init(unsigned int inputs);
+void hal_adc_select(unsigned int input);             //Input hal_adc_mean() averages from now on
+void hal_adc_wait(uint32_t n);                       //Block until n samples of every input newer than the call exist
+adc_q16_t hal_adc_mean(uint32_t n);                  //Mean of the last n samples of the selected input in ADC counts (Q16.16)
+void hal_adc_filter(int order, int shift);           //CIC decimator (adc_cic.h) of that order and decimation 2^shift on every input, order 0 off
+adc_q16_t hal_adc_filtered(uint32_t n);              //Mean of the decimator outputs spanning the last n samples of the selected input
+void hal_adc_outliers(int window, float k);          //Hampel filter (adc_hampel.h) of window samples and k MADs for hal_adc_robust(), window 0 off
+adc_q16_t hal_adc_robust(uint32_t n);                //Mean of the last n samples of the selected input with the outliers replaced
+uint32_t hal_adc_rejected(uint32_t *samples);        //Samples of the selected input replaced since hal_adc_outliers(), and tested in *samples
+
+//PWM DAC: 16-bit level on a PWM pin, either a plain 16-bit PWM or a dithered 8-bit high frequency carrier
+#define HAL_DAC_PWM               0                  //16-bit wrap, 1.9 kHz carrier
+#define HAL_DAC_DITHER            1                  //8-bit wrap, 488 kHz carrier, low byte dithered by DMA (pwm_dither.h)
+
+void hal_pwm_init(unsigned int pin);
+void hal_pwm_set_mode(unsigned int pin, int mode);  //Switch back end, the caller sets the level again afterwards. Dither drives one pin only
+void hal_pwm_set(unsigned int pin, uint16_t level);
+
+//GPIO
+void hal_gpio_init_input(unsigned int pin, bool pull_up);
+void hal_gpio_init_output(unsigned int pin);
+void hal_gpio_put(unsigned int pin, bool value);
+bool hal_gpio_get(unsigned int pin);
+void hal_gpio_irq_falling(unsigned int pin, hal_gpio_callback_t callback);
+
+//MULTICORE: start the control loop on the second core, call from core 0
+void hal_core1_launch(void (*entry)(void));
+
+//TICK: repeating hardware timer for the fixed rate control loop
+void hal_tick_start(uint32_t period_us);            //(Re)start ticking, the first tick fires one period from now
+void hal_tick_stop(void);
+uint32_t hal_tick_wait(void);                       //Block until a tick newer than the last call, returns ticks fired since start
+
+//TIME
+uint64_t hal_time_us(void);
+void hal_sleep_ms(uint32_t ms);
+uint32_t hal_cycles(void);                          //Free running CPU cycle count of the calling core (wall clock ns on the host)
+
+//FLASH: offsets are from the start of flash, erase/program take care of interrupts and the other core themselves
+const uint8_t *hal_flash_read(uint32_t offset);
+void hal_flash_erase(uint32_t offset, size_t length);
+void hal_flash_program(uint32_t offset, const uint8_t *data, size_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,269 @@
+#include "pico/stdlib.h"
+#include "pico/stdio_usb.h"
+#include "hardware/pwm.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "hardware/structs/systick.h"
+#include "pico/multicore.h"
+#include "pico/flash.h"
+#include "adc_capture.h"
+#include "pwm_dither.h"
+#include "hal.h"
+
+//Pico SDK implementation of hal.h
+
+void hal_stdio_init()
+{
+    stdio_init_all();
+}
+
+int hal_getchar_timeout_us(uint32_t timeout_us)
+{
+    int c = getchar_timeout_us(timeout_us);
+
+    return (c == PICO_ERROR_TIMEOUT) ? HAL_NO_CHAR : c;
+}
+
+void hal_stdio_write_raw(const uint8_t *data, size_t length)
+{
+    // Straight to the USB driver: stdio would turn every 0x0A byte into CR LF. Only core 0 writes.
+    fflush(stdout);
+    stdio_usb.out_chars((const char *)data, (int)length);
+}
+
+static unsigned int adc_inputs = 1;
+static unsigned int adc_selected = 0;
+
+void hal_adc_init(unsigned int inputs)
+{
+    adc_inputs = inputs ? inputs : 1;
+    adc_capture_init(adc_inputs);
+}
+
+void hal_adc_select(unsigned int input)
+{
+    adc_selected = input;
+}
+
+void hal_adc_wait(uint32_t n)
+{
+    adc_capture_wait(n * adc_inputs);
+}
+
+adc_q16_t hal_adc_mean(uint32_t n)
+{
+    return adc_capture_mean(adc_selected, n);
+}
+
+void hal_adc_filter(int order, int shift)
+{
+    adc_capture_filter(order, shift);
+}
+
+adc_q16_t hal_adc_filtered(uint32_t n)
+{
+    return adc_capture_filtered(adc_selected, n);
+}
+
+void hal_adc_outliers(int window, float k)
+{
+    adc_capture_outliers(window, k);
+}
+
+adc_q16_t hal_adc_robust(uint32_t n)
+{
+    return adc_capture_robust(adc_selected, n);
+}
+
+uint32_t hal_adc_rejected(uint32_t *samples)
+{
+    return adc_capture_rejected(adc_selected, samples);
+}
+
+void hal_pwm_init(unsigned int pin)
+{
+    gpio_set_function(pin, GPIO_FUNC_PWM);
+    uint slice_num = pwm_gpio_to_slice_num(pin);
+    pwm_config config = pwm_get_default_config();
+    pwm_config_set_clkdiv(&config, 1.f); // Set to fastest frequency to work with external RC filter
+    pwm_init(slice_num, &config, true);  // Start PWM with the config
+}
+
+static int pwm_mode = HAL_DAC_PWM;
+static unsigned int dither_pin = 0;
+
+void hal_pwm_set_mode(unsigned int pin, int mode)
+{
+    if (mode == pwm_mode) return;
+
+    if (mode == HAL_DAC_DITHER) pwm_dither_start(pin);
+    else pwm_dither_stop(dither_pin);
+
+    pwm_mode = mode;
+    dither_pin = pin;
+}
+
+void hal_pwm_set(unsigned int pin, uint16_t level)
+{
+    //One dither DMA channel, the other pins stay plain 16-bit PWM
+    if (pwm_mode == HAL_DAC_DITHER && pin == dither_pin)
+    {
+        pwm_dither_set(level);
+    }
+    else
+    {
+        pwm_set_gpio_level(pin, level);
+    }
+}
+
+void hal_gpio_init_input(unsigned int pin, bool pull_up)
+{
+    gpio_init(pin);
+    gpio_set_dir(pin, GPIO_IN);
+
+    if (pull_up)
+    {
+        gpio_pull_up(pin);
+    }
+}
+
+void hal_gpio_init_output(unsigned int pin)
+{
+    gpio_init(pin);
+    gpio_set_dir(pin, GPIO_OUT);
+}
+
+void hal_gpio_put(unsigned int pin, bool value)
+{
+    gpio_put(pin, value);
+}
+
+bool hal_gpio_get(unsigned int pin)
+{
+    return gpio_get(pin);
+}
+
+void hal_gpio_irq_falling(unsigned int pin, hal_gpio_callback_t callback)
+{
+    gpio_set_irq_enabled_with_callback(pin, GPIO_IRQ_EDGE_FALL, true, callback);
+}
+
+void hal_core1_launch(void (*entry)(void))
+{
+    // Let core 1 park this core while it writes flash
+    flash_safe_execute_core_init();
+    multicore_launch_core1(entry);
+}
+
+// The tick alarm pool is created by the first hal_tick_start(), on core 1, so the timer interrupt lands on
+// the core that waits for it
+static alarm_pool_t *tick_pool = NULL;
+static repeating_timer_t tick_timer;
+static volatile uint32_t tick_count = 0;
+static uint32_t tick_seen = 0;
+static bool tick_running = false;
+
+static bool tick_callback(repeating_timer_t *timer)
+{
+    (void)timer;                                  //One timer, nothing to look up
+    tick_count++;
+    __sev();
+    return true;
+}
+
+void hal_tick_start(uint32_t period_us)
+{
+    hal_tick_stop();
+
+    if (tick_pool == NULL)
+    {
+        tick_pool = alarm_pool_create_with_unused_hardware_alarm(1);
+    }
+
+    tick_count = 0;
+    tick_seen = 0;
+    // Negative delay: period measured between callback starts, so a slow tick does not shift the schedule
+    tick_running = alarm_pool_add_repeating_timer_us(tick_pool, -(int64_t)period_us, tick_callback, NULL, &tick_timer);
+}
+
+void hal_tick_stop()
+{
+    if (tick_running)
+    {
+        cancel_repeating_timer(&tick_timer);
+        tick_running = false;
+    }
+}
+
+uint32_t hal_tick_wait()
+{
+    while (tick_count == tick_seen)
+    {
+        __wfe();
+    }
+
+    tick_seen = tick_count;
+    return tick_seen;
+}
+
+uint64_t hal_time_us()
+{
+    return time_us_64();
+}
+
+// SysTick of the calling core as a free running up counter. The M0+ has no DWT cycle counter, SysTick is
+// the only thing clocked from the CPU clock. Started on first use, 24 bits is 134 ms at 125 MHz.
+uint32_t hal_cycles()
+{
+    if (!(systick_hw->csr & M0PLUS_SYST_CSR_ENABLE_BITS))
+    {
+        systick_hw->rvr = HAL_CYCLES_MASK;
+        systick_hw->cvr = 0;
+        systick_hw->csr = M0PLUS_SYST_CSR_CLKSOURCE_BITS | M0PLUS_SYST_CSR_ENABLE_BITS;
+    }
+
+    return HAL_CYCLES_MASK - systick_hw->cvr;
+}
+
+void hal_sleep_ms(uint32_t ms)
+{
+    sleep_ms(ms);
+}
+
+const uint8_t *hal_flash_read(uint32_t offset)
+{
+    // Flash is memory mapped through the XIP window
+    return (const uint8_t *)(XIP_BASE + offset);
+}
+
+typedef struct {
+    uint32_t offset;
+    const uint8_t *data;
+    size_t length;
+} flash_job_t;
+
+static void flash_erase_job(void *param)
+{
+    const flash_job_t *job = (const flash_job_t *)param;
+    flash_range_erase(job->offset, job->length);
+}
+
+static void flash_program_job(void *param)
+{
+    const flash_job_t *job = (const flash_job_t *)param;
+    flash_range_program(job->offset, job->data, job->length);
+}
+
+void hal_flash_erase(uint32_t offset, size_t length)
+{
+    // Code may not execute from flash while it is being erased: interrupts off here and the other core
+    // parked in RAM for the duration
+    flash_job_t job = {offset, NULL, length};
+    flash_safe_execute(flash_erase_job, &job, UINT32_MAX);
+}
+
+void hal_flash_program(uint32_t offset, const uint8_t *data, size_t length)
+{
+    flash_job_t job = {offset, data, length};
+    flash_safe_execute(flash_program_job, &job, UINT32_MAX);
+}
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "hal.h"
+#include "bias_controller_pico.h"
+#include "lockin.h"
+
+#define LOCKIN_SETTLE_TAUS        3                  //RC time constants (dac_tau_samples()) dropped after every dither edge, 95 % of the step
+#define LOCKIN_LOCKED_STEPS       2                  //Correction size (DAC steps) at which the lock is considered settled
+#define LOCKIN_MAX_ITERATIONS     64                 //Corrections per call before handing back to the main loop
+#define LOCKIN_LOOP_GAIN_Q16      4648               //0.7 / pi^2 in Q16: fraction of the estimated distance corrected per iteration, over the pi^2 of the slope
+#define LOCKIN_MAX_RATIO          4                  //|error| / amplitude is at most ~1 on the curve, anything beyond is saturated
+
+int lockin_dither  = 256;
+int lockin_periods = 4;
+int lockin_samples = 500;
+
+lockin_state_t lockin_state = {.half = -1};
+
+// Samples to wait after a dither edge before a read of lockin_samples holds only settled ones
+static int lockin_settle_samples()
+{
+    return LOCKIN_SETTLE_TAUS * dac_tau_samples() + adc_span(lockin_samples);
+}
+
+adc_q16_t lockin_demodulate(int center_step)
+{
+    int64_t sum = 0;
+
+    for (int i = 0; i < lockin_periods; i++)
+    {
+        set_pwm_dac(center_step + lockin_dither);
+        hal_adc_wait(lockin_settle_samples());
+        adc_q16_t plus = read_adc_captured(lockin_samples);
+
+        set_pwm_dac(center_step - lockin_dither);
+        hal_adc_wait(lockin_settle_samples());
+        adc_q16_t minus = read_adc_captured(lockin_samples);
+
+        sum += plus - minus;
+    }
+
+    set_pwm_dac(center_step);
+
+    return (adc_q16_t)(sum / lockin_periods);
+}
+
+// Correct center by the distance the demodulated error says, at most max_step
+static int lockin_correct(adc_q16_t error, int center, int max_step)
+{
+    //The small signal slope of the demodulated error is dither * amplitude * (pi / Vpi)^2 per DAC step of
+    //distance from the extremum, so the distance is error / amplitude * Vpi^2 / dither / pi^2
+    adc_q16_t amplitude = peak_setpoint - null_setpoint;
+    int sign = (set_point == PEAK_LOCKIN) ? 1 : -1;
+
+    if (amplitude <= 0 || vpi_steps <= 0) return 0;
+
+    int64_t ratio = ((int64_t)error << Q16_SHIFT) / amplitude;     //Q16
+
+    if (ratio > LOCKIN_MAX_RATIO * Q16_ONE) ratio = LOCKIN_MAX_RATIO * Q16_ONE;
+    if (ratio < -LOCKIN_MAX_RATIO * Q16_ONE) ratio = -LOCKIN_MAX_RATIO * Q16_ONE;
+
+    int64_t distance = ratio * ((int64_t)vpi_steps * vpi_steps / lockin_dither);        //Q16 DAC steps, < 2^50
+    int correction = sign * q16_round((distance * LOCKIN_LOOP_GAIN_Q16) >> Q16_SHIFT);
+
+    //Outside the small signal region the estimate saturates, never jump more than a quarter period
+    if (max_step > vpi_steps / 4) max_step = vpi_steps / 4;
+    if (correction > max_step) correction = max_step;
+    if (correction < -max_step) correction = -max_step;
+
+    set_pwm_dac(center + correction);
+
+    //Dither would clip on a rail, fall back to the search used by the other modes
+    if (current_output_voltage_step - lockin_dither <= MIN_VOLTAGE_STEP || current_output_voltage_step + lockin_dither >= MAX_VOLTAGE_STEP)
+    {
+        leave_rail(go_to_setpoint);
+    }
+
+    return correction;
+}
+
+int lockin_step(int max_step)
+{
+    int center = current_output_voltage_step;
+
+    return lockin_correct(lockin_demodulate(center), center, max_step);
+}
+
+void lockin_restart()
+{
+    lockin_state.half = -1;
+}
+
+int lockin_center()
+{
+    return (lockin_state.half < 0) ? current_output_voltage_step : lockin_state.center;
+}
+
+// Put the DAC on the next half period: plus for even halves, minus for odd
+static void lockin_edge()
+{
+    set_pwm_dac(lockin_state.center + ((lockin_state.half & 1) ? -lockin_dither : lockin_dither));
+    lockin_state.edge_us = hal_time_us();
+}
+
+int lockin_tick(int max_step)
+{
+    if (lockin_state.half < 0)
+    {
+        lockin_state.half = 0;
+        lockin_state.center = current_output_voltage_step;
+        lockin_state.sum = 0;
+        lockin_edge();
+        return 0;
+    }
+
+    //Still settling, the half stays on until a later tick
+    if (hal_time_us() - lockin_state.edge_us < adc_samples_us(lockin_settle_samples())) return 0;
+
+    adc_q16_t level = read_adc_captured(lockin_samples);
+    lockin_state.sum += (lockin_state.half & 1) ? -level : level;
+
+    if (++lockin_state.half < 2 * lockin_periods)
+    {
+        lockin_edge();
+        return 0;
+    }
+
+    int center = lockin_state.center;
+    lockin_state.half = -1;
+
+    return lockin_correct((adc_q16_t)(lockin_state.sum / lockin_periods), center, max_step);
+}
+
+void process_lockin()
+{
+    for (int i = 0; i < LOCKIN_MAX_ITERATIONS; i++)
+    {
+        int correction = lockin_step(vpi_steps / 4);
+
+        if (abs(correction) <= LOCKIN_LOCKED_STEPS)
+        {
+            break;
+        }
+    }
+
+    current_input_voltage = read_voltage();
+}
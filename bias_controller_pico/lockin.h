@@ -0,0 +1,52 @@
+#ifndef LOCKIN_H
+#define LOCKIN_H
+
+/*
+Dither lock-in for peak and null tracking.
+
+A square-wave pilot of +/- lockin_dither DAC steps is added around the current bias and the ADC mean of
+each half period, through the same outlier filter or decimator as every other reading (read_adc_captured()),
+is demodulated against it. Near an extremum of the MZM transfer function
+(V = offset + a * (1 -/+ cos(pi * x / Vpi)) / 2) the demodulated difference is
+
+    m+ - m-  =  +/- dither * a * (pi / Vpi)^2 * x
+
+where x is the distance to the extremum in DAC steps, so every demodulation gives both the direction and
+the size of the correction. a and Vpi come from the last sweep.
+
+Each half period waits LOCKIN_SETTLE_TAUS time constants of the RC filter, tens of ms with the 16-bit PWM, so
+a whole demodulation is longer than a control tick. process_lockin() blocks for it, the control tick runs it
+as lockin_tick(): one dither edge at a time, each half read on the first tick after it has settled.
+*/
+
+#include <stdint.h>
+#include "fixed_point.h"
+
+typedef struct {
+    int half;                         //Half periods read so far, -1 with no demodulation in progress
+    int center;                       //DAC step the dither is around
+    int64_t sum;                      //Plus halves minus minus halves so far, Q16 ADC counts
+    uint64_t edge_us;                 //Time of the last dither edge
+} lockin_state_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern int lockin_dither;          //Pilot amplitude in DAC steps
+extern int lockin_periods;         //Dither periods demodulated per correction
+extern int lockin_samples;         //ADC samples averaged per half period
+extern lockin_state_t lockin_state;  //Demodulation in progress on the control tick, one per channel
+
+adc_q16_t lockin_demodulate(int center_step);   //Mean (m+ - m-) in Q16 ADC counts around center_step, DAC is left at center_step
+int lockin_step(int max_step);              //One demodulation and correction of at most max_step, returns the correction
+int lockin_tick(int max_step);              //Same spread over control ticks, 0 until a demodulation completes
+void lockin_restart(void);                  //Drop the demodulation in progress, the DAC is left where it is
+int lockin_center(void);                    //Step the dither is around, current_output_voltage_step when idle
+void process_lockin(void);                  //Walk current_output_voltage_step onto the null or peak
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,66 @@
+#include <math.h>
+#include "noise_estimator.h"
+
+#define SQRT_HALF_PI              1.25331414f        //Standard deviation over mean absolute deviation, normal noise
+
+void noise_estimator_reset(noise_estimator_t *ne)
+{
+    noise_estimator_t cleared = {0};
+
+    *ne = cleared;
+}
+
+void noise_estimator_restart(noise_estimator_t *ne)
+{
+    ne->history = 0;
+}
+
+void noise_estimator_update(noise_estimator_t *ne, adc_q16_t reading, int samples, int step, float slope)
+{
+    ne->slope = slope;
+
+    //A different averaging changes the noise of the readings, the second difference needs three alike
+    if (samples <= 0 || (ne->history > 0 && samples != ne->samples))
+    {
+        ne->history = 0;
+    }
+
+    if (ne->history == 2)
+    {
+        float second = (float)reading - 2.0f * ne->reading[0] + ne->reading[1];
+        float moved = slope * (step - 2 * ne->step[0] + ne->step[1]);
+        float residue = fabsf(second - moved) * sqrtf(samples / 6.0f);
+
+        if (ne->updates < NOISE_ESTIMATOR_WARMUP)
+        {
+            ne->deviation += (residue - ne->deviation) / (ne->updates + 1);
+        }
+        else
+        {
+            //One count on top, so an estimate of zero from a quiet input can still grow
+            float limit = NOISE_ESTIMATOR_CLIP * ne->deviation + Q16_ONE;
+
+            if (residue > limit)
+            {
+                residue = limit;
+                ne->clipped++;
+            }
+            ne->deviation += (residue - ne->deviation) * NOISE_ESTIMATOR_WEIGHT;
+        }
+        ne->updates++;
+    }
+
+    ne->reading[1] = ne->reading[0];
+    ne->step[1] = ne->step[0];
+    ne->reading[0] = reading;
+    ne->step[0] = step;
+    ne->samples = samples;
+    if (ne->history < 2) ne->history++;
+}
+
+float noise_estimator_sigma(const noise_estimator_t *ne, int samples)
+{
+    if (samples <= 0) return 0.0f;
+
+    return ne->deviation * SQRT_HALF_PI / sqrtf((float)samples);
+}
@@ -0,0 +1,51 @@
+#ifndef NOISE_ESTIMATOR_H
+#define NOISE_ESTIMATOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "fixed_point.h"
+
+/*
+Online estimate of the ADC noise behind the control loop's readings.
+
+A reading is the mean of n samples, its noise sigma / sqrt(n) with sigma the noise of one sample. The second
+difference of three readings in a row cancels the level and any linear drift, what the DAC moves between
+them did is taken off with the local slope of the transfer curve, and what is left is noise with variance
+6 sigma^2 / n. sigma is kept as a running mean of the absolute residues scaled to one sample (a mean
+absolute deviation, sqrt(pi / 2) of it is sigma for normal noise). Each residue is clipped to
+NOISE_ESTIMATOR_CLIP times the estimate plus a count, so a sweep, a rail jump or a move the slope got
+wrong only nudges it, while a real rise in the noise is still followed within a few dozen readings.
+
+Float, a handful of operations and a sqrtf() per reading, the 'bench' command times it with auto tuning
+(auto_tune_bench()).
+*/
+
+#define NOISE_ESTIMATOR_WEIGHT    (1.0f / 32)        //Weight of the newest residue in the running mean
+#define NOISE_ESTIMATOR_CLIP      4.0f               //Largest residue taken, in mean absolute deviations
+#define NOISE_ESTIMATOR_WARMUP    8                  //Residues averaged unclipped before the first clip
+
+typedef struct {
+    float deviation;                  //Running mean absolute residue of one sample, Q16 counts
+    float slope;                      //Transfer slope given with the last reading, Q16 counts per DAC step
+    adc_q16_t reading[2];             //Last two readings of the chain, newest first
+    int step[2];                      //DAC step each was taken at
+    int samples;                      //Samples per reading in the chain
+    int history;                      //Readings in the chain, up to 2
+    uint32_t updates;
+    uint32_t clipped;
+} noise_estimator_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void noise_estimator_reset(noise_estimator_t *ne);      //Forget the estimate
+void noise_estimator_restart(noise_estimator_t *ne);    //Start a new chain of readings, the estimate is kept
+void noise_estimator_update(noise_estimator_t *ne, adc_q16_t reading, int samples, int step, float slope);
+float noise_estimator_sigma(const noise_estimator_t *ne, int samples);   //Noise of a mean of samples, Q16 counts
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,198 @@
+#include <string.h>
+#include "crc32.h"
+#include "param_journal.h"
+
+#define JOURNAL_MAGIC             0x4C4E524Au        //"JRNL"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t sequence;              //Increments with every save, newest wins
+    uint32_t length;                //Payload bytes
+    uint32_t crc;                   //CRC32 of sequence, length and payload
+} journal_header_t;
+
+param_journal_stats_t param_journal_stats = {0, -1, 0, 0, 0, 0};
+
+static uint32_t base_offset = 0;
+static uint32_t sector_count = 0;
+static int erase_sector = -1;       //Sector waiting for param_journal_maintain()
+
+static uint32_t slot_offset(int slot)
+{
+    return base_offset + (uint32_t)slot * PARAM_JOURNAL_SLOT_SIZE;
+}
+
+static const journal_header_t *slot_header(int slot)
+{
+    return (const journal_header_t *)hal_flash_read(slot_offset(slot));
+}
+
+static uint32_t record_crc(const journal_header_t *header, const void *payload)
+{
+    uint32_t crc = crc32_update(0, &header->sequence, 2 * sizeof(uint32_t));
+    return crc32_update(crc, payload, header->length);
+}
+
+static bool slot_valid(int slot)
+{
+    const journal_header_t *header = slot_header(slot);
+
+    return header->magic == JOURNAL_MAGIC &&
+           header->length <= PARAM_JOURNAL_MAX_PAYLOAD &&
+           header->crc == record_crc(header, header + 1);
+}
+
+static bool region_erased(uint32_t offset, size_t length)
+{
+    const uint32_t *words = (const uint32_t *)hal_flash_read(offset);
+
+    for (size_t i = 0; i < length / sizeof(uint32_t); i++)
+    {
+        if (words[i] != 0xFFFFFFFFu) return false;
+    }
+    return true;
+}
+
+static bool sector_erased(int sector)
+{
+    return region_erased(base_offset + (uint32_t)sector * HAL_FLASH_SECTOR_SIZE, HAL_FLASH_SECTOR_SIZE);
+}
+
+static void erase(int sector)
+{
+    hal_flash_erase(base_offset + (uint32_t)sector * HAL_FLASH_SECTOR_SIZE, HAL_FLASH_SECTOR_SIZE);
+    param_journal_stats.erases++;
+
+    if (erase_sector == sector) erase_sector = -1;
+}
+
+// Once writing has moved into a sector, the one after it holds the oldest records and is next to be reused
+static void schedule_erase_after(int slot)
+{
+    int next_sector = (slot / PARAM_JOURNAL_SLOTS_PER_SECTOR + 1) % sector_count;
+
+    erase_sector = sector_erased(next_sector) ? -1 : next_sector;
+}
+
+void param_journal_init(uint32_t offset, uint32_t sectors)
+{
+    base_offset = offset;
+    sector_count = sectors;
+    erase_sector = -1;
+
+    param_journal_stats.slots = (int)(sectors * PARAM_JOURNAL_SLOTS_PER_SECTOR);
+    param_journal_stats.sequence = 0;
+    param_journal_stats.newest_slot = -1;
+    param_journal_stats.next_slot = 0;
+
+    //The sector written last is the one whose first record is newest
+    int current = -1;
+    uint32_t current_sequence = 0;
+
+    for (uint32_t sector = 0; sector < sectors; sector++)
+    {
+        int first = (int)(sector * PARAM_JOURNAL_SLOTS_PER_SECTOR);
+        if (!slot_valid(first)) continue;
+
+        uint32_t sequence = slot_header(first)->sequence;
+        if (current < 0 || (int32_t)(sequence - current_sequence) > 0)
+        {
+            current = (int)sector;
+            current_sequence = sequence;
+        }
+    }
+
+    if (current < 0) return;
+
+    //Walk the slots of that sector, the last valid one is the newest record
+    int first = current * PARAM_JOURNAL_SLOTS_PER_SECTOR;
+    int next = first;
+
+    for (int slot = first; slot < first + PARAM_JOURNAL_SLOTS_PER_SECTOR; slot++)
+    {
+        if (slot_valid(slot))
+        {
+            param_journal_stats.newest_slot = slot;
+            param_journal_stats.sequence = slot_header(slot)->sequence;
+        }
+
+        //Anything programmed, valid or torn, is not free
+        if (!region_erased(slot_offset(slot), PARAM_JOURNAL_SLOT_SIZE))
+        {
+            next = slot + 1;
+        }
+    }
+
+    param_journal_stats.next_slot = next % param_journal_stats.slots;
+    schedule_erase_after(param_journal_stats.newest_slot);
+}
+
+bool param_journal_load(void *data, size_t length)
+{
+    int slot = param_journal_stats.newest_slot;
+
+    if (slot < 0) return false;
+
+    const journal_header_t *header = slot_header(slot);
+    if (header->length != length) return false;
+
+    memcpy(data, header + 1, length);
+    return true;
+}
+
+bool param_journal_save(const void *data, size_t length)
+{
+    uint8_t page[PARAM_JOURNAL_SLOT_SIZE];
+    journal_header_t *header = (journal_header_t *)page;
+    int slot = param_journal_stats.next_slot;
+
+    if (length > PARAM_JOURNAL_MAX_PAYLOAD || param_journal_stats.slots == 0) return false;   //Too long, or no param_journal_init()
+
+    //Skip torn slots left by a reset mid program, a sector boundary is where erasing is allowed
+    while (!region_erased(slot_offset(slot), PARAM_JOURNAL_SLOT_SIZE))
+    {
+        if (slot % PARAM_JOURNAL_SLOTS_PER_SECTOR == 0)
+        {
+            param_journal_stats.forced_erases++;
+            erase(slot / PARAM_JOURNAL_SLOTS_PER_SECTOR);
+            break;
+        }
+        slot = (slot + 1) % param_journal_stats.slots;
+    }
+
+    memset(page, 0xFF, sizeof(page));
+    header->magic = JOURNAL_MAGIC;
+    header->sequence = param_journal_stats.sequence + 1;
+    header->length = (uint32_t)length;
+    memcpy(header + 1, data, length);
+    header->crc = record_crc(header, data);
+
+    hal_flash_program(slot_offset(slot), page, sizeof(page));
+
+    param_journal_stats.next_slot = (slot + 1) % param_journal_stats.slots;
+
+    if (!slot_valid(slot)) return false;
+
+    param_journal_stats.newest_slot = slot;
+    param_journal_stats.sequence = header->sequence;
+
+    if (slot % PARAM_JOURNAL_SLOTS_PER_SECTOR == 0)
+    {
+        schedule_erase_after(slot);
+    }
+
+    return true;
+}
+
+bool param_journal_erase_pending()
+{
+    return erase_sector >= 0;
+}
+
+void param_journal_maintain()
+{
+    if (erase_sector >= 0)
+    {
+        erase(erase_sector);
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef PARAM_JOURNAL_H
+#define PARAM_JOURNAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "hal.h"
+
+/*
+Append-only, wear-levelled journal of parameter records in flash.
+
+The journal spans several flash sectors. Each sector holds PARAM_JOURNAL_SLOTS_PER_SECTOR slots of two
+pages. One slot holds one record, the parameters of every channel. A save programs the next free slot
+with {magic, sequence, length, crc32, payload} and never erases anything it does not have to: a sector is
+only erased once the writer is about to wrap back into it, and that erase is left pending for
+param_journal_maintain() to run at a quiet moment (after a sweep, or while the loop sits inside its
+tolerance). Only when saves outrun the quiet moments does a save erase inline, which is counted.
+
+Every slot's first record sequence tells which sector was written last, so boot reads one header per
+sector and then walks that sector's slots, newest valid record wins. A torn write fails its CRC and the
+previous record is used instead.
+*/
+
+#define PARAM_JOURNAL_SLOT_SIZE          (2 * HAL_FLASH_PAGE_SIZE)
+#define PARAM_JOURNAL_SLOTS_PER_SECTOR   (int)(HAL_FLASH_SECTOR_SIZE / PARAM_JOURNAL_SLOT_SIZE)
+#define PARAM_JOURNAL_MAX_PAYLOAD        (PARAM_JOURNAL_SLOT_SIZE - 16)   //Slot minus the record header
+
+typedef struct {
+    uint32_t sequence;              //Sequence of the newest record, 0 if none
+    int newest_slot;                //-1 if the journal is empty
+    int next_slot;                  //Where the next save goes
+    int slots;                      //Slots in the whole journal
+    uint32_t erases;                //Sector erases since boot
+    uint32_t forced_erases;         //Of those, erases a save had to do itself
+} param_journal_stats_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern param_journal_stats_t param_journal_stats;
+
+void param_journal_init(uint32_t offset, uint32_t sectors);   //Scan the journal, sectors >= 2
+bool param_journal_load(void *data, size_t length);           //Copy the newest record, false if none of this length
+bool param_journal_save(const void *data, size_t length);     //Append a record, false if it did not verify or before init
+bool param_journal_erase_pending(void);
+void param_journal_maintain(void);                            //Run the pending erase, if any
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
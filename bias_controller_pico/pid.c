@@ -0,0 +1,50 @@
+#include "pid.h"
+
+void pid_init(pid_controller_t *pid, int32_t kp, int32_t ki, int32_t kd, int32_t out_min, int32_t out_max)
+{
+    pid->kp = kp;
+    pid->ki = ki;
+    pid->kd = kd;
+    pid->out_min = out_min;
+    pid->out_max = out_max;
+    pid_reset(pid, out_min, 0);
+}
+
+void pid_reset(pid_controller_t *pid, int32_t output, adc_q16_t measurement)
+{
+    pid->integral = (int64_t)output << Q16_SHIFT;
+    pid->prev_measurement = measurement;
+    pid->saturated = false;
+}
+
+int32_t pid_update(pid_controller_t *pid, adc_q16_t error, adc_q16_t measurement)
+{
+    //error = setpoint - measurement, so a rising measurement is a falling error
+    adc_q16_t derivative = -(measurement - pid->prev_measurement);
+    pid->prev_measurement = measurement;
+
+    //Q16 gain * Q16 counts is Q32, back to Q16 DAC steps
+    pid->integral += ((int64_t)pid->ki * error) >> Q16_SHIFT;
+
+    int64_t output = pid->integral + (((int64_t)pid->kp * error + (int64_t)pid->kd * derivative) >> Q16_SHIFT);
+    int64_t out_max = (int64_t)pid->out_max << Q16_SHIFT;
+    int64_t out_min = (int64_t)pid->out_min << Q16_SHIFT;
+
+    pid->saturated = false;
+
+    //Anti-windup: clamp at the rails and pull the integrator back so the output leaves the rail as soon as the error reverses
+    if (output > out_max)
+    {
+        pid->integral -= output - out_max;
+        output = out_max;
+        pid->saturated = true;
+    }
+    else if (output < out_min)
+    {
+        pid->integral += out_min - output;
+        output = out_min;
+        pid->saturated = true;
+    }
+
+    return q16_round(output);
+}
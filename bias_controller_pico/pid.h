@@ -0,0 +1,36 @@
+#ifndef PID_H
+#define PID_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "fixed_point.h"
+
+/*
+Positional PID controller with anti-windup, used for quad locking.
+
+Output is an absolute DAC step. The integrator holds the bias position, so it is seeded with the current
+step on pid_reset() for a bumpless start. When the output would pass a rail it is clamped and the
+integrator is back-calculated to the clamped value instead of winding up.
+Derivative acts on the measurement so setpoint changes do not kick the output.
+
+Fixed point, no floats: errors and measurements are ADC counts in Q16.16, gains are Q16 DAC steps per
+count (per_volt_to_q16() converts the per volt gains the console takes), the integrator is Q16 DAC steps
+in 64 bits since a full scale output (65535 << 16) does not fit in 32.
+*/
+
+typedef struct {
+    int32_t kp;                 //Q16 DAC steps per count of error
+    int32_t ki;                 //Q16 DAC steps per count of error, accumulated every update
+    int32_t kd;                 //Q16 DAC steps per count of measurement change between updates
+    int32_t out_min;            //DAC steps
+    int32_t out_max;
+    int64_t integral;           //Integrator state in Q16 DAC steps
+    adc_q16_t prev_measurement;
+    bool saturated;             //Last output was clamped to a rail
+} pid_controller_t;
+
+void pid_init(pid_controller_t *pid, int32_t kp, int32_t ki, int32_t kd, int32_t out_min, int32_t out_max);
+void pid_reset(pid_controller_t *pid, int32_t output, adc_q16_t measurement);
+int32_t pid_update(pid_controller_t *pid, adc_q16_t error, adc_q16_t measurement);   //Returns the DAC step
+
+#endif
@@ -0,0 +1,92 @@
+#include "pico/stdlib.h"
+#include "hardware/pwm.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "pwm_dither.h"
+
+#define PWM_DITHER_DMA_CHUNK      (PWM_DITHER_SLOTS << 20)           //Transfers per DMA run, a multiple of the table (~9 min)
+
+//DMA ring wrap needs the table aligned to its own size in bytes. Each entry is a whole CC register, both
+//channels get the same level so it does not matter which one the pin is on.
+static uint32_t dither_table[PWM_DITHER_SLOTS] __attribute__((aligned(PWM_DITHER_SLOTS * sizeof(uint32_t))));
+
+static int dma_chan = -1;
+
+static void pwm_dither_dma_isr()
+{
+    dma_channel_acknowledge_irq1(dma_chan);
+
+    //Read address carries on around the table, only the count needs reloading
+    dma_channel_set_trans_count(dma_chan, PWM_DITHER_DMA_CHUNK, true);
+}
+
+void pwm_dither_set(uint16_t level)
+{
+    uint32_t base = level >> PWM_DITHER_BITS;
+    uint32_t frac = level & (PWM_DITHER_SLOTS - 1);
+    uint32_t error = PWM_DITHER_SLOTS / 2;
+
+    //First order error feedback: frac extra counts spread as evenly as possible over the cycle. The DMA may
+    //read a mix of the old and new table for one cycle, which the RC filter averages like any other step.
+    for (uint32_t i = 0; i < PWM_DITHER_SLOTS; i++)
+    {
+        uint32_t duty = base;
+
+        error += frac;
+        if (error >= PWM_DITHER_SLOTS)
+        {
+            error -= PWM_DITHER_SLOTS;
+            duty++;
+        }
+
+        dither_table[i] = duty | (duty << 16);
+    }
+}
+
+void pwm_dither_start(uint pin)
+{
+    uint slice = pwm_gpio_to_slice_num(pin);
+
+    pwm_dither_set(0);
+
+    pwm_config config = pwm_get_default_config();
+    pwm_config_set_clkdiv(&config, 1.f);
+    pwm_config_set_wrap(&config, PWM_DITHER_SLOTS - 1);
+    pwm_init(slice, &config, false);
+
+    if (dma_chan < 0)
+    {
+        dma_chan = dma_claim_unused_channel(true);
+        irq_set_exclusive_handler(DMA_IRQ_1, pwm_dither_dma_isr);
+        irq_set_enabled(DMA_IRQ_1, true);
+    }
+    dma_channel_set_irq1_enabled(dma_chan, true);
+
+    dma_channel_config cfg = dma_channel_get_default_config(dma_chan);
+    channel_config_set_transfer_data_size(&cfg, DMA_SIZE_32);
+    channel_config_set_read_increment(&cfg, true);
+    channel_config_set_write_increment(&cfg, false);
+    channel_config_set_ring(&cfg, false, PWM_DITHER_BITS + 2);  //Wrap the read address every 2^(bits+2) bytes
+    channel_config_set_dreq(&cfg, pwm_get_dreq(slice));         //One compare value per carrier period
+
+    dma_channel_configure(dma_chan, &cfg, &pwm_hw->slice[slice].cc, dither_table, PWM_DITHER_DMA_CHUNK, true);
+
+    pwm_set_enabled(slice, true);
+}
+
+void pwm_dither_stop(uint pin)
+{
+    uint slice = pwm_gpio_to_slice_num(pin);
+
+    if (dma_chan >= 0)
+    {
+        //Abort can raise a spurious completion (RP2040-E13), keep the reload handler out of it
+        dma_channel_set_irq1_enabled(dma_chan, false);
+        dma_channel_abort(dma_chan);
+        dma_channel_acknowledge_irq1(dma_chan);
+    }
+
+    pwm_config config = pwm_get_default_config();
+    pwm_config_set_clkdiv(&config, 1.f);
+    pwm_init(slice, &config, true);
+}
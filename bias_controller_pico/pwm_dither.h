@@ -0,0 +1,27 @@
+#ifndef PWM_DITHER_H
+#define PWM_DITHER_H
+
+#include <stdint.h>
+#include "pico/types.h"
+
+/*
+Dithered high frequency PWM DAC.
+
+The plain back end runs a 16-bit PWM (wrap 65535) at clkdiv 1, a 1.9 kHz carrier that the external RC
+filter has to attenuate by ~70 dB. Here the PWM wraps at 255 instead, a 488 kHz carrier, and a DMA
+channel paced by the PWM wrap feeds the compare register from a 256 entry table every carrier period.
+The table holds the top 8 bits of the level, plus one in frac / 256 of the entries spread by first order
+error feedback, so the average over 256 periods (0.5 ms) carries all 16 bits and the residual dither
+ripple is one 8-bit LSB at or above 1.9 kHz instead of a full scale square wave.
+
+Pico only, the host build has no PWM hardware behind hal_pwm_set_mode().
+*/
+
+#define PWM_DITHER_BITS           8                                  //Carrier resolution, 125 MHz / 256 = 488 kHz
+#define PWM_DITHER_SLOTS          (1u << PWM_DITHER_BITS)            //Carrier periods per dither cycle
+
+void pwm_dither_start(uint pin);       //Switch the pin's PWM slice to the dithered carrier and start the DMA
+void pwm_dither_stop(uint pin);        //Stop the DMA and return the slice to the plain 16-bit PWM
+void pwm_dither_set(uint16_t level);   //16-bit level, takes effect within one dither cycle
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+Lock-free byte ring with one producer and one consumer, used to pass data between the two RP2040 cores.
+
+head is only written by the producer and tail only by the consumer, both count bytes monotonically and
+wrap. The barrier orders the data copy against the index update so the other core never sees an index
+ahead of the bytes it covers. Pushes are all or nothing, so the consumer only ever sees whole messages.
+The buffer size must be a power of two.
+*/
+
+typedef struct {
+    uint8_t *buffer;
+    uint32_t mask;                  //Size - 1
+    volatile uint32_t head;         //Bytes pushed
+    volatile uint32_t tail;         //Bytes popped
+} spsc_ring_t;
+
+#define SPSC_RING_INIT(buffer)    {(buffer), sizeof(buffer) - 1, 0, 0}
+
+static inline uint32_t spsc_ring_used(const spsc_ring_t *ring)
+{
+    return ring->head - ring->tail;
+}
+
+static inline bool spsc_ring_push(spsc_ring_t *ring, const void *data, uint32_t length)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    uint32_t head = ring->head;
+
+    if (length > ring->mask + 1 - (head - ring->tail)) return false;
+
+    for (uint32_t i = 0; i < length; i++)
+    {
+        ring->buffer[(head + i) & ring->mask] = bytes[i];
+    }
+
+    __sync_synchronize();
+    ring->head = head + length;
+    return true;
+}
+
+//Contiguous bytes ready at the tail, up to the end of the buffer
+static inline uint32_t spsc_ring_peek(const spsc_ring_t *ring, const uint8_t **data)
+{
+    uint32_t tail = ring->tail;
+    uint32_t used = ring->head - tail;
+    uint32_t to_end = ring->mask + 1 - (tail & ring->mask);
+
+    __sync_synchronize();
+    *data = &ring->buffer[tail & ring->mask];
+    return (used < to_end) ? used : to_end;
+}
+
+static inline void spsc_ring_release(spsc_ring_t *ring, uint32_t length)
+{
+    __sync_synchronize();
+    ring->tail += length;
+}
+
+#endif
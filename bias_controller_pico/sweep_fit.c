@@ -0,0 +1,427 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sweep_fit.h"
+
+#define FIT_PI                    3.14159265f
+#define FIT_MAX_ARRAY             4096               //Largest sweep the trim mask can hold
+#define FIT_GRID_POINTS           32                 //Log spaced Vpi candidates in the coarse search
+#define FIT_GRID_MIN_FRACTION     (1.0f / 16.0f)     //Shortest Vpi tried, as a fraction of the swept span
+#define FIT_GRID_MAX_FRACTION     2.0f               //Longest Vpi tried
+#define FIT_COARSE_STRIDE         16                 //Every 16th point for the coarse grid
+#define FIT_FINE_STRIDE           4                  //Every 4th point for the golden section search
+#define FIT_GOLDEN_ITERATIONS     18
+#define FIT_TRIM_SIGMA            3.0f               //Points further than this many RMS residuals are dropped on the second pass
+#define FIT_MIN_AMPLITUDE         0.01f              //Volts, anything flatter is not a transfer curve
+#define FIT_MAX_RELATIVE_RMS      0.2f               //RMS residual / amplitude above which the fit is rejected
+#define FIT_SMOOTH_HALF_WIDTH     2                  //Boxcar half width used when refining extrema in the data
+
+typedef struct {
+    float c;                          //Offset
+    float a;                          //cos coefficient
+    float b;                          //sin coefficient
+    float sse;                        //Sum of squared residuals
+    int used;                         //Points included
+} linear_fit_t;
+
+//The trim state is static to keep it off the firmware stack. Host tools may fit from several threads, so there it is per thread.
+#ifdef BIAS_HOST_BUILD
+#define FIT_STATE static _Thread_local
+#else
+#define FIT_STATE static
+#endif
+
+//Points excluded by the trim pass, one bit per array index
+FIT_STATE uint32_t trim_mask[FIT_MAX_ARRAY / 32];
+FIT_STATE bool trim_active = false;
+
+static bool is_trimmed(int i)
+{
+    return trim_active && (trim_mask[i >> 5] & (1u << (i & 31)));
+}
+
+//Closed form least squares of y = c + a cos(w i) + b sin(w i) over every stride-th point for a fixed w (radians per index)
+static bool fit_linear(const float *y, int n, int stride, float w, linear_fit_t *out)
+{
+    float s1 = 0, sc = 0, ss = 0, scc = 0, scs = 0, sss = 0, sy = 0, syc = 0, sys = 0, syy = 0;
+
+    //cos/sin of w*i by rotation instead of a libm call per point, this runs without an FPU
+    float cos_step = cosf(w * stride);
+    float sin_step = sinf(w * stride);
+    float c = 1.0f;
+    float s = 0.0f;
+
+    for (int i = 0; i < n; i += stride)
+    {
+        if (!is_trimmed(i))
+        {
+            float v = y[i];
+            s1 += 1.0f;
+            sc += c;
+            ss += s;
+            scc += c * c;
+            scs += c * s;
+            sss += s * s;
+            sy += v;
+            syc += v * c;
+            sys += v * s;
+            syy += v * v;
+        }
+
+        float next_c = c * cos_step - s * sin_step;
+        s = s * cos_step + c * sin_step;
+        c = next_c;
+    }
+
+    //Cramer's rule on the 3x3 normal equations
+    float det = s1 * (scc * sss - scs * scs) - sc * (sc * sss - scs * ss) + ss * (sc * scs - scc * ss);
+
+    if (s1 < 4.0f || fabsf(det) < 1e-12f * s1 * s1 * s1)
+    {
+        return false;
+    }
+
+    out->c = (sy * (scc * sss - scs * scs) - sc * (syc * sss - scs * sys) + ss * (syc * scs - scc * sys)) / det;
+    out->a = (s1 * (syc * sss - sys * scs) - sy * (sc * sss - scs * ss) + ss * (sc * sys - syc * ss)) / det;
+    out->b = (s1 * (scc * sys - scs * syc) - sc * (sc * sys - syc * ss) + sy * (sc * scs - scc * ss)) / det;
+    out->sse = syy - (out->c * sy + out->a * syc + out->b * sys);
+    out->used = (int)s1;
+
+    if (out->sse < 0.0f) out->sse = 0.0f;
+
+    return true;
+}
+
+//RMS residual of a solved fit over every point not trimmed. Computed directly, sse from the normal equations loses too much to cancellation in float.
+static float residual_rms(const float *y, int n, float w, const linear_fit_t *lf)
+{
+    float cos_step = cosf(w);
+    float sin_step = sinf(w);
+    float c = 1.0f;
+    float s = 0.0f;
+    float sum = 0.0f;
+    int used = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        if (!is_trimmed(i))
+        {
+            float r = y[i] - (lf->c + lf->a * c + lf->b * s);
+            sum += r * r;
+            used++;
+        }
+
+        float next_c = c * cos_step - s * sin_step;
+        s = s * cos_step + c * sin_step;
+        c = next_c;
+    }
+
+    return used ? sqrtf(sum / used) : 0.0f;
+}
+
+//Mean squared residual for a period, large if the fit is singular
+static float period_cost(const float *y, int n, int stride, float vpi_index)
+{
+    linear_fit_t lf;
+
+    if (!fit_linear(y, n, stride, FIT_PI / vpi_index, &lf))
+    {
+        return 1e30f;
+    }
+
+    return lf.sse / lf.used;
+}
+
+static float golden_search(const float *y, int n, float lo, float hi)
+{
+    const float ratio = 0.618034f;
+    float x1 = hi - ratio * (hi - lo);
+    float x2 = lo + ratio * (hi - lo);
+    float f1 = period_cost(y, n, FIT_FINE_STRIDE, x1);
+    float f2 = period_cost(y, n, FIT_FINE_STRIDE, x2);
+
+    for (int i = 0; i < FIT_GOLDEN_ITERATIONS; i++)
+    {
+        if (f1 < f2)
+        {
+            hi = x2;
+            x2 = x1;
+            f2 = f1;
+            x1 = hi - ratio * (hi - lo);
+            f1 = period_cost(y, n, FIT_FINE_STRIDE, x1);
+        }
+        else
+        {
+            lo = x1;
+            x1 = x2;
+            f1 = f2;
+            x2 = lo + ratio * (hi - lo);
+            f2 = period_cost(y, n, FIT_FINE_STRIDE, x2);
+        }
+    }
+
+    return (lo + hi) / 2.0f;
+}
+
+static float smoothed(const float *y, int n, int i)
+{
+    int lo = (i - FIT_SMOOTH_HALF_WIDTH < 0) ? 0 : i - FIT_SMOOTH_HALF_WIDTH;
+    int hi = (i + FIT_SMOOTH_HALF_WIDTH > n - 1) ? n - 1 : i + FIT_SMOOTH_HALF_WIDTH;
+    float sum = 0.0f;
+
+    for (int j = lo; j <= hi; j++)
+    {
+        sum += y[j];
+    }
+
+    return sum / (hi - lo + 1);
+}
+
+//Refine a predicted extremum (array index) to the data. Returns -1 if the best point sits on the array boundary.
+static int refine_extremum(const float *y, int n, int predicted, int half_window, bool find_max, float *value)
+{
+    int lo = (predicted - half_window < 0) ? 0 : predicted - half_window;
+    int hi = (predicted + half_window > n - 1) ? n - 1 : predicted + half_window;
+    int best = -1;
+
+    for (int i = lo; i <= hi; i++)
+    {
+        float v = smoothed(y, n, i);
+
+        if (best < 0 || (find_max ? (v > *value) : (v < *value)))
+        {
+            best = i;
+            *value = v;
+        }
+    }
+
+    if (best <= 0 || best >= n - 1)
+    {
+        return -1;
+    }
+
+    return best;
+}
+
+//Crossing of level nearest to a predicted index, interpolated between samples. Returns -1 if none in the window.
+static float refine_crossing(const float *y, int n, int predicted, int half_window, float level, bool rising)
+{
+    int lo = (predicted - half_window < 0) ? 0 : predicted - half_window;
+    int hi = (predicted + half_window > n - 2) ? n - 2 : predicted + half_window;
+    float best = -1.0f;
+    int best_distance = 0;
+
+    for (int i = lo; i <= hi; i++)
+    {
+        float v0 = smoothed(y, n, i);
+        float v1 = smoothed(y, n, i + 1);
+        bool crosses = rising ? (v0 < level && v1 >= level) : (v0 > level && v1 <= level);
+
+        if (crosses)
+        {
+            int distance = (i > predicted) ? i - predicted : predicted - i;
+
+            if (best < 0.0f || distance < best_distance)
+            {
+                best = i + (level - v0) / (v1 - v0);
+                best_distance = distance;
+            }
+        }
+    }
+
+    return best;
+}
+
+//Array indices inside [0, n) where pi * i / vpi_index + phase == target (mod 2 pi)
+static int predict_points(float target, float phase, float vpi_index, int n, float *out)
+{
+    float period = 2.0f * vpi_index;
+    float first = (target - phase) * vpi_index / FIT_PI;
+    int count = 0;
+
+    first -= floorf(first / period) * period;   //Wrap into [0, period)
+
+    for (float i = first; i < n && count < FIT_MAX_POINTS; i += period)
+    {
+        out[count++] = i;
+    }
+
+    return count;
+}
+
+float sweep_fit_eval(const sweep_fit_t *fit, float step)
+{
+    return fit->offset + fit->amplitude * sinf(FIT_PI * step / fit->vpi_steps + fit->phase);
+}
+
+int sweep_fit_closest_to_mid(const int *steps, int count)
+{
+    const int mid = 32768;
+    int best = -1;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (best < 0 || abs(steps[i] - mid) < abs(best - mid))
+        {
+            best = steps[i];
+        }
+    }
+
+    return best;
+}
+
+bool sweep_fit(const float *result_array, int array_size, int step_size, sweep_fit_t *fit)
+{
+    const float *y = result_array;
+    int n = array_size;
+    linear_fit_t lf;
+
+    memset(fit, 0, sizeof(*fit));
+
+    if (y == NULL || n < 16 || n > FIT_MAX_ARRAY)
+    {
+        return false;
+    }
+
+    trim_active = false;
+
+    //Coarse log spaced grid over the period
+    float grid_min = n * FIT_GRID_MIN_FRACTION;
+    float grid_ratio = powf(FIT_GRID_MAX_FRACTION / FIT_GRID_MIN_FRACTION, 1.0f / (FIT_GRID_POINTS - 1));
+    float best_vpi = grid_min;
+    float best_cost = 1e30f;
+
+    for (int g = 0; g < FIT_GRID_POINTS; g++)
+    {
+        float vpi_index = grid_min * powf(grid_ratio, (float)g);
+        float cost = period_cost(y, n, FIT_COARSE_STRIDE, vpi_index);
+
+        if (cost < best_cost)
+        {
+            best_cost = cost;
+            best_vpi = vpi_index;
+        }
+    }
+
+    //Golden section between the neighbouring grid points
+    float vpi_index = golden_search(y, n, best_vpi / grid_ratio, best_vpi * grid_ratio);
+
+    if (!fit_linear(y, n, 1, FIT_PI / vpi_index, &lf))
+    {
+        return false;
+    }
+
+    //Trim pass: drop outliers against the first model and refit around the same period
+    float threshold = FIT_TRIM_SIGMA * residual_rms(y, n, FIT_PI / vpi_index, &lf);
+    float cos_step = cosf(FIT_PI / vpi_index);
+    float sin_step = sinf(FIT_PI / vpi_index);
+    float c = 1.0f;
+    float s = 0.0f;
+    int trimmed = 0;
+
+    memset(trim_mask, 0, sizeof(trim_mask));
+
+    for (int i = 0; i < n; i++)
+    {
+        float model = lf.c + lf.a * c + lf.b * s;
+
+        if (fabsf(y[i] - model) > threshold)
+        {
+            trim_mask[i >> 5] |= 1u << (i & 31);
+            trimmed++;
+        }
+
+        float next_c = c * cos_step - s * sin_step;
+        s = s * cos_step + c * sin_step;
+        c = next_c;
+    }
+
+    if (trimmed > 0)
+    {
+        trim_active = true;
+        vpi_index = golden_search(y, n, vpi_index * 0.97f, vpi_index * 1.03f);
+
+        if (!fit_linear(y, n, 1, FIT_PI / vpi_index, &lf))
+        {
+            trim_active = false;
+            return false;
+        }
+    }
+
+    fit->rms_residual = residual_rms(y, n, FIT_PI / vpi_index, &lf);
+    trim_active = false;
+
+    //y = c + R sin(w i + phase) with R sin(phase) = a, R cos(phase) = b
+    fit->offset = lf.c;
+    fit->amplitude = sqrtf(lf.a * lf.a + lf.b * lf.b);
+    fit->phase = atan2f(lf.a, lf.b);
+    fit->vpi_steps = vpi_index * step_size;
+
+    if (fit->amplitude < FIT_MIN_AMPLITUDE || fit->rms_residual > FIT_MAX_RELATIVE_RMS * fit->amplitude)
+    {
+        return false;
+    }
+
+    //Refine every predicted peak and null against the data
+    float predicted[FIT_MAX_POINTS];
+    int half_window = (int)(vpi_index / 4.0f);
+    int count;
+    float peak_sum = 0.0f;
+    float null_sum = 0.0f;
+
+    count = predict_points(FIT_PI / 2.0f, fit->phase, vpi_index, n, predicted);
+    for (int k = 0; k < count; k++)
+    {
+        float value = 0.0f;
+        int i = refine_extremum(y, n, (int)predicted[k], half_window, true, &value);
+
+        if (i >= 0)
+        {
+            fit->peak_steps[fit->peak_count++] = i * step_size;
+            peak_sum += value;
+        }
+    }
+
+    count = predict_points(-FIT_PI / 2.0f, fit->phase, vpi_index, n, predicted);
+    for (int k = 0; k < count; k++)
+    {
+        float value = 0.0f;
+        int i = refine_extremum(y, n, (int)predicted[k], half_window, false, &value);
+
+        if (i >= 0)
+        {
+            fit->null_steps[fit->null_count++] = i * step_size;
+            null_sum += value;
+        }
+    }
+
+    //Extrema outside the swept range fall back to the model
+    fit->peak_voltage = fit->peak_count ? peak_sum / fit->peak_count : fit->offset + fit->amplitude;
+    fit->null_voltage = fit->null_count ? null_sum / fit->null_count : fit->offset - fit->amplitude;
+    fit->quad_voltage = (fit->peak_voltage + fit->null_voltage) / 2.0f;
+
+    count = predict_points(0.0f, fit->phase, vpi_index, n, predicted);
+    for (int k = 0; k < count; k++)
+    {
+        float i = refine_crossing(y, n, (int)predicted[k], half_window, fit->quad_voltage, true);
+
+        if (i >= 0.0f)
+        {
+            fit->quad_plus_steps[fit->quad_plus_count++] = (int)(i * step_size + 0.5f);
+        }
+    }
+
+    count = predict_points(FIT_PI, fit->phase, vpi_index, n, predicted);
+    for (int k = 0; k < count; k++)
+    {
+        float i = refine_crossing(y, n, (int)predicted[k], half_window, fit->quad_voltage, false);
+
+        if (i >= 0.0f)
+        {
+            fit->quad_minus_steps[fit->quad_minus_count++] = (int)(i * step_size + 0.5f);
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,64 @@
+#ifndef SWEEP_FIT_H
+#define SWEEP_FIT_H
+
+#include <stdbool.h>
+
+/*
+Least-squares fit of the MZM transfer function to a sweep:
+
+    y(x) = offset + amplitude * sin(pi * x / vpi_steps + phase)        x in DAC steps
+
+For a fixed period the model is linear in (offset, a cos, b sin), so the period is searched (coarse grid,
+then golden section) and the other three parameters are solved in closed form at every trial. A second
+pass drops points more than FIT_TRIM_SIGMA residuals away so single glitches do not pull the fit.
+
+RF drive distorts the curve away from a pure sinusoid (hardware_tests/RF_TEST/test_1), so the fit is only
+used to say where the extrema are. Each predicted peak and null is then refined to the local extremum of
+the lightly smoothed data within a quarter period, and quad crossings are interpolated from the data
+between each refined null and peak. The setpoint voltages come from those refined points.
+*/
+
+#define FIT_MAX_POINTS            8                  //Lock points of each kind kept from the swept range
+
+typedef struct {
+    //Fitted model
+    float offset;                     //Volts
+    float amplitude;                  //Volts, half of peak to null
+    float vpi_steps;                  //DAC steps for a pi phase change
+    float phase;                      //Radians at DAC step 0
+    float rms_residual;               //Volts, over the points kept by the trim pass
+
+    //Setpoints from the refined extrema
+    float peak_voltage;
+    float null_voltage;
+    float quad_voltage;
+
+    //DAC steps of every lock point inside the swept range
+    int peak_steps[FIT_MAX_POINTS];
+    int null_steps[FIT_MAX_POINTS];
+    int quad_plus_steps[FIT_MAX_POINTS];
+    int quad_minus_steps[FIT_MAX_POINTS];
+    int peak_count;
+    int null_count;
+    int quad_plus_count;
+    int quad_minus_count;
+} sweep_fit_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//result_array[i] is the reading at DAC step i * step_size. Returns false if no usable fit was found.
+bool sweep_fit(const float *result_array, int array_size, int step_size, sweep_fit_t *fit);
+
+//Model value at a DAC step
+float sweep_fit_eval(const sweep_fit_t *fit, float step);
+
+//Lock point of a list closest to mid-range (most headroom to either rail), -1 if the list is empty
+int sweep_fit_closest_to_mid(const int *steps, int count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
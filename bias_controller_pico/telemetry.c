@@ -0,0 +1,70 @@
+#include <stddef.h>
+
+#include "hal.h"
+#include "crc32.h"
+#include "spsc_ring.h"
+#include "telemetry.h"
+
+static uint8_t telemetry_buffer[1u << TELEMETRY_RING_BITS];
+static spsc_ring_t telemetry_ring = SPSC_RING_INIT(telemetry_buffer);
+
+volatile bool telemetry_enabled = false;
+
+#define ERROR_100UV_SHIFT         28                 //Q16 counts to 100 uV: * 3.3 V * 10000 / 4096 / 2^16 = * 33000 / 2^28
+#define ERROR_100UV_SCALE         33000
+
+static uint32_t sequence = 0;
+static volatile uint32_t dropped = 0;
+
+void telemetry_sample(uint16_t dac_step, adc_q16_t counts, adc_q16_t error_counts, uint8_t mode, uint8_t flags)
+{
+    telemetry_frame_t frame;
+    int32_t error = (int32_t)(((int64_t)error_counts * ERROR_100UV_SCALE + (1 << (ERROR_100UV_SHIFT - 1))) >> ERROR_100UV_SHIFT);
+
+    if (error > INT16_MAX) error = INT16_MAX;
+    if (error < INT16_MIN) error = INT16_MIN;
+
+    frame.sync[0] = TELEMETRY_SYNC_0;
+    frame.sync[1] = TELEMETRY_SYNC_1;
+    frame.type = TELEMETRY_SAMPLE;
+    frame.length = sizeof(telemetry_sample_t);
+    frame.sequence = sequence++;
+    frame.sample.time_us = (uint32_t)hal_time_us();
+    frame.sample.dac_step = dac_step;
+    frame.sample.adc_x16 = (uint16_t)((counts + (1 << (Q16_SHIFT - 5))) >> (Q16_SHIFT - 4));
+    frame.sample.error_100uv = (int16_t)error;
+    frame.sample.mode = mode;
+    frame.sample.flags = flags;
+    frame.crc = crc32(&frame.type, offsetof(telemetry_frame_t, crc) - offsetof(telemetry_frame_t, type));
+
+    if (!spsc_ring_push(&telemetry_ring, &frame, sizeof(frame)))
+    {
+        dropped++;
+    }
+
+#ifdef BIAS_HOST_BUILD
+    telemetry_drain(); // No second core on the host, write straight away
+#endif
+}
+
+uint32_t telemetry_frames()
+{
+    return sequence;
+}
+
+uint32_t telemetry_dropped()
+{
+    return dropped;
+}
+
+void telemetry_drain()
+{
+    const uint8_t *data;
+    uint32_t length;
+
+    while ((length = spsc_ring_peek(&telemetry_ring, &data)) > 0)
+    {
+        hal_stdio_write_raw(data, length);
+        spsc_ring_release(&telemetry_ring, length);
+    }
+}
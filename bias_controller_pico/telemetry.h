@@ -0,0 +1,71 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "fixed_point.h"
+
+/*
+Binary telemetry stream over the USB serial link (`stream on`).
+
+Every ADC read of the control code (read_voltage_averaged) becomes one 24 byte frame instead of a
+formatted line. Frames are pushed into their own RAM ring on core 1 and written out by core 0 between
+console flushes, so text replies and frames never split each other. A full ring drops the frame and
+counts it; the sequence number lets the decoder (simulation_code/telemetry_decode.cpp) see the gap.
+
+    offset  size
+    0       2     sync 0xA5 0x5A
+    2       1     type (TELEMETRY_SAMPLE)
+    3       1     payload length
+    4       4     sequence, +1 per frame produced (dropped frames included)
+    8       12    telemetry_sample_t
+    20      4     CRC32 (crc32.h) of bytes 2 to 19
+
+All fields are little endian.
+*/
+
+#define TELEMETRY_SYNC_0          0xA5
+#define TELEMETRY_SYNC_1          0x5A
+#define TELEMETRY_SAMPLE          1
+#define TELEMETRY_FLAG_SWEEP      0x01               //Read taken by sweep()
+#define TELEMETRY_FLAG_RAIL       0x02               //Read taken between a DAC rail and being back inside tolerance
+#define TELEMETRY_CHANNEL_SHIFT   4                  //mode carries the controller channel in its high nibble
+#define TELEMETRY_RING_BITS       13                 //8 KB, ~340 frames
+
+typedef struct __attribute__((packed)) {
+    uint32_t time_us;               //hal_time_us(), wraps after 71 minutes
+    uint16_t dac_step;              //DAC level the read was taken at
+    uint16_t adc_x16;               //Raw ADC mean in 1/16 counts
+    int16_t error_100uv;            //Reading minus the selected setpoint, 100 uV units, saturated
+    uint8_t mode;                   //enum setPoint, channel << TELEMETRY_CHANNEL_SHIFT
+    uint8_t flags;                  //TELEMETRY_FLAG_*
+} telemetry_sample_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t sync[2];
+    uint8_t type;
+    uint8_t length;
+    uint32_t sequence;
+    telemetry_sample_t sample;
+    uint32_t crc;
+} telemetry_frame_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern volatile bool telemetry_enabled;
+
+//Core 1 side, never blocks
+void telemetry_sample(uint16_t dac_step, adc_q16_t counts, adc_q16_t error, uint8_t mode, uint8_t flags);   //Q16.16 ADC counts
+uint32_t telemetry_frames(void);           //Frames produced
+uint32_t telemetry_dropped(void);          //Of those, frames lost to a full ring
+
+//Core 0 side
+void telemetry_drain(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,301 @@
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <chrono>
+#include <random>
+
+#include "../bias_controller_pico/adc_cic.h"
+#include "../bias_controller_pico/adc_hampel.h"
+#include "../bias_controller_pico/adc_ring.h"
+
+/*
+Host stand-in for the DMA ADC capture on the Pico. A producer loop writes noisy 12-bit samples into the
+ring exactly the way the DMA channel does (index & ADC_RING_MASK, monotonic count) and the firmware's
+adc_ring_consume()/adc_ring_mean() are checked against a brute force average and timed, then the same for
+several inputs captured in rotation (adc_ring_slot_mean()).
+
+Last the CIC decimator (adc_cic.h) at every 'oversample' setting and order: rounded samples of a level with
+CIC_NOISE counts of noise, the RMS error of single outputs against the level as effective bits
+(12 - log2(error * sqrt(12))), the share of a 1.9 kHz PWM carrier ripple still in the outputs, and the
+time per sample.
+
+Then the outlier filter (adc_hampel.h) at a few windows: the same noise with HAMPEL_SPIKE_RATE of the samples
+glitched by 50 .. 1000 counts either way, the share of glitches caught and of clean samples replaced, the
+RMS error of a read of AVERAGE_PER_READ samples with the filter against the plain mean, and the time per
+sample.
+
+BUILD: g++ -O2 -std=c++17 adc_ring_stub.cpp ../bias_controller_pico/adc_cic.c ../bias_controller_pico/adc_hampel.c -o adc_ring_stub
+*/
+
+#define AVERAGE_PER_READ 4000   //Same as average_per_read in the firmware
+#define TOTAL_SAMPLES    5000000
+#define BENCH_ITERATIONS 200000
+#define ROUND_ROBIN      3      //Inputs of the interleaved check, one per controller channel
+#define CIC_NOISE        1.5    //RMS noise of the ADC itself in counts, the dither
+#define CIC_RIPPLE       4.0    //Carrier ripple amplitude in counts
+#define CIC_CARRIER_HZ   1907.0 //16-bit PWM at 125 MHz
+#define CIC_SAMPLE_HZ    500000.0
+#define CIC_LEVELS       200    //Levels tried, each held for CIC_HOLD samples
+#define CIC_HOLD         20000
+#define HAMPEL_SPIKE_RATE 0.001 //Glitched samples
+#define HAMPEL_K         3.0    //MADs, the firmware default
+#define HAMPEL_READS     500
+
+static uint16_t samples[ADC_RING_SIZE];
+static adc_ring_t ring;
+
+//Brute force mean of the last n samples written, the reference for the running sum
+double reference_mean(uint32_t produced, uint32_t n) {
+    double total = 0;
+    for (uint32_t i = produced - n; i != produced; i++) {
+        total += samples[i & ADC_RING_MASK];
+    }
+    return total / n;
+}
+
+//Same for the last n samples of one input out of stride captured in rotation, sample k from input k % stride
+double reference_slot_mean(uint32_t produced, uint32_t stride, uint32_t slot, uint32_t n) {
+    uint32_t last = produced - 1;
+    while (last % stride != slot) last--;
+
+    double total = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        total += samples[(last - i * stride) & ADC_RING_MASK];
+    }
+    return total / n;
+}
+
+int main() {
+    std::mt19937 gen(1234);
+    std::normal_distribution<> noise(0.0, 6.0);         //~5 mV RMS of noise in ADC counts
+    std::uniform_int_distribution<> burst(1, 2000);     //Samples written between consumer polls
+
+    adc_ring_init(&ring, samples, 1);
+
+    uint32_t produced = 0;
+    double max_error = 0;
+    size_t checks = 0;
+
+    //Correctness: random producer bursts, consumer polls in between, compare against brute force
+    while (produced < TOTAL_SAMPLES) {
+        int count = burst(gen);
+        for (int i = 0; i < count; i++) {
+            double value = 2048 + 1500 * std::sin(produced * 1e-5) + noise(gen);
+            value = std::min(4095.0, std::max(0.0, value));
+            samples[produced & ADC_RING_MASK] = static_cast<uint16_t>(value);
+            produced++;
+        }
+
+        adc_ring_consume(&ring, produced);
+
+        if (ring.valid >= AVERAGE_PER_READ) {
+            double error = std::abs(static_cast<double>(adc_ring_mean(&ring, AVERAGE_PER_READ)) / Q16_ONE - reference_mean(produced, AVERAGE_PER_READ));
+            max_error = std::max(max_error, error);
+            checks++;
+        }
+    }
+
+    //Overrun path: let the producer lap the consumer and make sure the window restarts cleanly
+    for (uint32_t i = 0; i < 3 * ADC_RING_SIZE; i++) {
+        samples[produced & ADC_RING_MASK] = 1000;
+        produced++;
+    }
+    adc_ring_consume(&ring, produced);
+    double lapped_mean = static_cast<double>(adc_ring_mean(&ring, AVERAGE_PER_READ)) / Q16_ONE;
+
+    //Interleaved: each input has its own level, means of one input must not see the others
+    static adc_ring_t interleaved;
+    const uint32_t per_input = AVERAGE_PER_READ / ROUND_ROBIN;
+    double slot_error = 0;
+    size_t slot_checks = 0;
+
+    adc_ring_init(&interleaved, samples, ROUND_ROBIN);
+    produced = 0;
+    while (produced < TOTAL_SAMPLES / 4) {
+        int count = burst(gen);
+        for (int i = 0; i < count; i++) {
+            double value = 500 + 1000 * (produced % ROUND_ROBIN) + noise(gen);
+            samples[produced & ADC_RING_MASK] = static_cast<uint16_t>(value);
+            produced++;
+        }
+
+        adc_ring_consume(&interleaved, produced);
+
+        for (uint32_t slot = 0; slot < ROUND_ROBIN && interleaved.valid >= AVERAGE_PER_READ; slot++) {
+            double mean = static_cast<double>(adc_ring_slot_mean(&interleaved, slot, per_input)) / Q16_ONE;
+            slot_error = std::max(slot_error, std::abs(mean - reference_slot_mean(produced, ROUND_ROBIN, slot, per_input)));
+            slot_checks++;
+        }
+    }
+
+    //Lapped with a rotation that does not start on input 0, the slots have to stay in step
+    for (uint32_t i = 0; i < 3 * ADC_RING_SIZE + 1; i++) {
+        samples[produced & ADC_RING_MASK] = static_cast<uint16_t>(500 + 1000 * (produced % ROUND_ROBIN));
+        produced++;
+    }
+    adc_ring_consume(&interleaved, produced);
+    for (uint32_t slot = 0; slot < ROUND_ROBIN; slot++) {
+        double mean = static_cast<double>(adc_ring_slot_mean(&interleaved, slot, per_input)) / Q16_ONE;
+        slot_error = std::max(slot_error, std::abs(mean - (500 + 1000 * slot)));
+    }
+
+    std::cout << "Checked " << checks << " windows of " << AVERAGE_PER_READ << " samples" << std::endl;
+    std::cout << "Max |ring mean - brute force mean| : " << max_error << " counts" << std::endl;
+    std::cout << "Mean after producer lapped consumer: " << lapped_mean << " (expected 1000), overruns: " << ring.overruns << std::endl;
+    std::cout << "Interleaved " << ROUND_ROBIN << " inputs, max error : " << slot_error << " counts over " << slot_checks << " windows of " << per_input << std::endl;
+
+    //Benchmark: O(1) ring mean vs summing the window vs the old read_voltage() loop (one read added 4000 times)
+    volatile double sink = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        sink = adc_ring_mean(&ring, AVERAGE_PER_READ - (i & 63));
+    }
+    auto ring_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / BENCH_ITERATIONS;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < BENCH_ITERATIONS / 100; i++) {
+        sink = (reference_mean(produced, AVERAGE_PER_READ - (i & 63)));
+    }
+    auto brute_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (BENCH_ITERATIONS / 100);
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < BENCH_ITERATIONS / 100; i++) {
+        float raw_value = samples[i & ADC_RING_MASK];
+        float total_voltage = 0;
+        for (int j = 0; j < AVERAGE_PER_READ; j++) {
+            total_voltage += raw_value * (3.3f / 4096);
+        }
+        sink = total_voltage / AVERAGE_PER_READ;
+    }
+    auto legacy_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (BENCH_ITERATIONS / 100);
+    double last_mean = sink;    //Read once, the loops only store
+
+    start = std::chrono::steady_clock::now();
+    uint32_t consume_total = 0;
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        samples[produced & ADC_RING_MASK] = static_cast<uint16_t>(i & 0xFFF);
+        produced++;
+        adc_ring_consume(&ring, produced);
+        consume_total++;
+    }
+    auto consume_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / consume_total;
+
+    std::cout << "adc_ring_mean()           : " << ring_ns << " ns/op" << std::endl;
+    std::cout << "Brute force window mean   : " << brute_ns << " ns/op" << std::endl;
+    std::cout << "Legacy read_voltage loop  : " << legacy_ns << " ns/op (last mean " << last_mean << " V)" << std::endl;
+    std::cout << "adc_ring_consume()        : " << consume_ns << " ns/sample" << std::endl;
+
+    //CIC: effective bits of single outputs, a new level every CIC_HOLD samples, the outputs that still
+    //reach back to the previous level skipped. Once without the ripple for the noise, once with it for
+    //what is left of the carrier.
+    static adc_cic_t cic;
+    std::uniform_real_distribution<> level_dist(100.0, 4000.0);
+    std::normal_distribution<> dither(0.0, CIC_NOISE);
+    std::vector<uint16_t> block(CIC_HOLD);
+
+    auto cic_error = [&](int order, int shift, double ripple, double& ns_per_sample) {
+        double sum_squared = 0, pushed_ns = 0;
+        size_t outputs = 0;
+        uint64_t fed = 0;
+
+        adc_cic_init(&cic, order, shift);
+        for (int l = 0; l < CIC_LEVELS; l++) {
+            double level = level_dist(gen);
+            for (uint16_t& sample : block) {
+                double t = fed++ / CIC_SAMPLE_HZ;
+                double value = level + ripple * std::sin(2 * M_PI * CIC_CARRIER_HZ * t) + dither(gen);
+                sample = static_cast<uint16_t>(std::lround(std::min(4095.0, std::max(0.0, value))));
+            }
+
+            uint32_t skip = static_cast<uint32_t>(order);
+            auto pushed = std::chrono::steady_clock::now();
+            for (uint16_t sample : block) {
+                if (!adc_cic_push(&cic, sample) && cic.phase != 0) continue;
+                if (skip > 0) {
+                    skip--;
+                    continue;
+                }
+                double error = static_cast<double>(adc_cic_mean(&cic, 1)) / Q16_ONE - level;
+                sum_squared += error * error;
+                outputs++;
+            }
+            pushed_ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - pushed).count();
+        }
+        ns_per_sample = pushed_ns / fed;
+        return std::sqrt(sum_squared / outputs);
+    };
+
+    std::cout << std::endl << "CIC decimator, " << CIC_NOISE << " counts noise, " << CIC_RIPPLE << " counts of " << CIC_CARRIER_HZ
+              << " Hz ripple" << std::endl;
+    std::cout << "oversample  order  decimation  outputs/s  noise counts  effective bits  ripple %    ns/sample" << std::endl;
+
+    for (int shift = 2; shift <= ADC_CIC_MAX_SHIFT; shift += 2) {
+        for (int order = 1; order <= ADC_CIC_MAX_ORDER; order++) {
+            double ns, ignored;
+            double noise = cic_error(order, shift, 0, ns);
+            double total = cic_error(order, shift, CIC_RIPPLE, ignored);
+            double ripple_left = std::sqrt(std::max(0.0, total * total - noise * noise)) / (CIC_RIPPLE / std::sqrt(2.0));
+
+            std::printf("%-12d%-7d%-12d%-11.0f%-14.4f%-16.2f%-13.1f%.2f\n", shift / 2, order, 1 << shift, CIC_SAMPLE_HZ / (1 << shift),
+                        noise, 12 - std::log2(noise * std::sqrt(12.0)), ripple_left * 100, ns);
+        }
+    }
+
+    //Outlier filter: every read primed with the window - 1 samples before it, as adc_capture_robust() does
+    static adc_hampel_t hampel;
+    std::uniform_real_distribution<> unit(0.0, 1.0);
+    std::vector<uint16_t> read_samples(AVERAGE_PER_READ + ADC_HAMPEL_MAX_WINDOW);
+    std::vector<bool> spiked(read_samples.size());
+
+    std::cout << std::endl << "Hampel filter, " << CIC_NOISE << " counts noise, " << HAMPEL_SPIKE_RATE * 100 << "% of the samples glitched, "
+              << HAMPEL_K << " MADs" << std::endl;
+    std::cout << "window  glitches caught  clean replaced  read error, plain  filtered  ns/sample" << std::endl;
+
+    for (int window : {3, 5, 7, 9, 15}) {
+        uint64_t spikes = 0, caught = 0, clean = 0, replaced = 0;
+        double plain_squared = 0, filtered_squared = 0, pushed_ns = 0;
+
+        adc_hampel_init(&hampel, window, HAMPEL_K);
+        for (int r = 0; r < HAMPEL_READS; r++) {
+            double level = level_dist(gen);
+            for (size_t i = 0; i < read_samples.size(); i++) {
+                double value = level + dither(gen);
+                spiked[i] = unit(gen) < HAMPEL_SPIKE_RATE;
+                if (spiked[i]) value += (unit(gen) < 0.5 ? -1 : 1) * (50 + 950 * unit(gen));
+                read_samples[i] = static_cast<uint16_t>(std::lround(std::min(4095.0, std::max(0.0, value))));
+            }
+
+            size_t first = read_samples.size() - AVERAGE_PER_READ;
+            uint64_t plain = 0, filtered = 0;
+
+            auto pushed = std::chrono::steady_clock::now();
+            adc_hampel_restart(&hampel);
+            for (size_t i = first - (window - 1); i < first; i++) adc_hampel_insert(&hampel, read_samples[i]);
+            for (size_t i = first; i < read_samples.size(); i++) {
+                uint16_t out = adc_hampel_push(&hampel, read_samples[i]);
+                filtered += out;
+                plain += read_samples[i];
+                if (spiked[i]) {
+                    spikes++;
+                    caught += (out != read_samples[i]);
+                } else {
+                    clean++;
+                    replaced += (out != read_samples[i]);
+                }
+            }
+            pushed_ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - pushed).count();
+
+            double plain_error = static_cast<double>(plain) / AVERAGE_PER_READ - level;
+            double filtered_error = static_cast<double>(filtered) / AVERAGE_PER_READ - level;
+            plain_squared += plain_error * plain_error;
+            filtered_squared += filtered_error * filtered_error;
+        }
+
+        std::printf("%-8d%-17.1f%-16.3f%-19.4f%-10.4f%.2f\n", window, 100.0 * caught / spikes, 100.0 * replaced / clean,
+                    std::sqrt(plain_squared / HAMPEL_READS), std::sqrt(filtered_squared / HAMPEL_READS),
+                    pushed_ns / (static_cast<double>(HAMPEL_READS) * AVERAGE_PER_READ));
+    }
+
+    return max_error < 1e-3 && lapped_mean == 1000 && slot_error < 1e-3 ? 0 : 1;
+}
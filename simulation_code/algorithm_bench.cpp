@@ -0,0 +1,385 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "../bias_controller_pico/bias_controller_pico.h"
+#include "hal_host.hpp"
+#include "main_detect.hpp"
+#include "mzm_plant.hpp"
+
+/*
+Speed and quality of the detection and control algorithms on a parameterized plant, one row per algorithm
+and plant so a run can be diffed against the one from an earlier commit.
+
+detect: ns per call of main.cpp's detectPeaks / detectNulls / detectQuads / scanPWM on a 65536 point curve
+and of the firmware's detect_peak / detect_null on a 4096 point sweep, and how far (DAC steps) the lock
+points they found are from the true ones. success is the fraction of seeds where one was found.
+
+loop: the firmware's process_null / process_peak / process_quad_plus / process_quad_minus called the way the
+polling loop calls them, once a second while the reading is outside tolerance. After a sweep and a lock the
+plant phase is kicked, steps_to_lock / ms_to_lock are the DAC writes and simulated time until a reading is
+back inside. residual_rms_v is the noise free output against the setpoint at the start of every pass from
+then on, so it includes what the drift did in the second since the last correction. rail_events counts
+the rails the loop had to leave, ns_per_op is the host time per process_* call. success is the fraction
+of seeds that got back inside.
+
+Every combination of the plant lists is run (drift only matters to the loops) and averaged over the seeds.
+Controller console output is discarded, the results go to stdout.
+
+USAGE: algorithm_bench [--noise V,..] [--phase rad,..] [--drift rad/s,..] [--adc_bits n,..] [--kick rad]
+                       [--seconds s] [--seeds n] [--samples n] [--format csv|json]
+adc_bits 0 is an unquantized ADC. --samples is the ADC samples averaged per curve point for the detectors.
+*/
+
+#define BENCH_MIN_NS   20e6             //Time each detector for at least this long
+#define POLL_US        1000000          //Polling loop pass, polling_delay(1000)
+#define DEADLINE_S     3600             //Simulated time a loop run may take before the bench gives up
+
+#define MAIN_POINTS    65536            //main.cpp scans every 16-bit step
+#define SWEEP_POINTS   MAX_12BIT_STEPS  //The firmware sweeps 12-bit steps
+
+struct Row {
+    std::string suite;
+    std::string algorithm;
+    MzmPlantConfig plant;
+    double ns_per_op = NAN;
+    double error_steps = NAN;
+    double steps_to_lock = NAN;
+    double ms_to_lock = NAN;
+    double residual_rms_v = NAN;
+    double rail_events = NAN;
+    double success = 0;
+};
+
+//Mean over the seeds of the runs that produced the value
+struct Mean {
+    double sum = 0;
+    int n = 0;
+
+    void add(double value) {
+        if (!std::isnan(value)) {
+            sum += value;
+            n++;
+        }
+    }
+
+    double get() const {
+        return n ? sum / n : NAN;
+    }
+};
+
+template <typename F>
+static double ns_per_call(F&& f) {
+    using clock = std::chrono::steady_clock;
+    uint64_t calls = 0;
+    double elapsed = 0;
+    auto start = clock::now();
+
+    do {
+        f();
+        calls++;
+        elapsed = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+    } while (elapsed < BENCH_MIN_NS || calls < 3);
+
+    return elapsed / calls;
+}
+
+//DAC step nearest to step where the plant phase pi * dac / v_pi + phase is at target (mod 2 pi)
+static double nearest_point(const MzmPlantConfig& c, double target, double step) {
+    double period = 2 * c.v_pi_steps;
+    double first = (target - c.phase) * c.v_pi_steps / M_PI;
+    return first + std::round((step - first) / period) * period;
+}
+
+static const double PEAK_PHASE = M_PI / 2, NULL_PHASE = -M_PI / 2, QUAD_PLUS_PHASE = 0, QUAD_MINUS_PHASE = M_PI;
+
+//Distance of a found lock point from the true one, NAN when nothing was found (index 0)
+static double point_error(const MzmPlantConfig& c, double target, int step) {
+    if (step <= 0) return NAN;
+    return std::abs(step - nearest_point(c, target, step));
+}
+
+//Mean distance over the points that were found
+static double mean_error(std::initializer_list<double> errors) {
+    Mean mean;
+    for (double e : errors) mean.add(e);
+    return mean.get();
+}
+
+static void run_detect(const MzmPlantConfig& config, int seeds, int samples, std::vector<Row>& rows) {
+    const char* names[] = {"detectPeaks", "detectNulls", "detectQuads", "scanPWM", "detect_peak", "detect_null"};
+    const int count = sizeof(names) / sizeof(names[0]);
+    Mean ns[count], error[count];
+    int found[count] = {};
+
+    for (int seed = 1; seed <= seeds; seed++) {
+        MzmPlant plant(config, seed);
+        std::vector<double> curve(MAIN_POINTS);
+        std::vector<adc_q16_t> sweep_points(SWEEP_POINTS);
+
+        for (int i = 0; i < MAIN_POINTS; i++) {
+            plant.set_dac(static_cast<uint16_t>(i));
+            curve[i] = plant.mean_counts(samples, 0) * PLANT_ADC_MAX_VOLTAGE / PLANT_ADC_STEPS;
+        }
+        for (int i = 0; i < SWEEP_POINTS; i++) {
+            plant.set_dac(static_cast<uint16_t>(i * (MAX_16BIT_STEPS / SWEEP_POINTS)));
+            sweep_points[i] = static_cast<adc_q16_t>(std::lround(plant.mean_counts(samples, 0) * Q16_ONE));
+        }
+        simulation::load_curve(curve);
+
+        double e[count];
+
+        simulation::reset_detected();
+        ns[0].add(ns_per_call([&] { simulation::detectPeaks(curve); }));
+        e[0] = point_error(config, PEAK_PHASE, simulation::detected().peak);
+
+        ns[1].add(ns_per_call([&] { simulation::detectNulls(curve); }));
+        e[1] = point_error(config, NULL_PHASE, simulation::detected().null);
+
+        ns[2].add(ns_per_call([&] { simulation::detectQuads(curve); }));     //Quad level from the peak found above
+        simulation::Detected d = simulation::detected();
+        e[2] = mean_error({point_error(config, QUAD_PLUS_PHASE, d.quad_plus), point_error(config, QUAD_MINUS_PHASE, d.quad_minus)});
+
+        simulation::reset_detected();
+        ns[3].add(ns_per_call([&] { simulation::scanPWM(); }));
+        d = simulation::detected();
+        e[3] = mean_error({point_error(config, PEAK_PHASE, d.peak), point_error(config, NULL_PHASE, d.null),
+                           point_error(config, QUAD_PLUS_PHASE, d.quad_plus), point_error(config, QUAD_MINUS_PHASE, d.quad_minus)});
+
+        ns[4].add(ns_per_call([&] { detect_peak(sweep_points.data(), sweep_points.size()); }));
+        e[4] = point_error(config, PEAK_PHASE, peak_voltage_step);
+
+        ns[5].add(ns_per_call([&] { detect_null(sweep_points.data(), sweep_points.size()); }));
+        e[5] = point_error(config, NULL_PHASE, null_voltage_step);
+
+        for (int i = 0; i < count; i++) {
+            error[i].add(e[i]);
+            found[i] += !std::isnan(e[i]);
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        Row row;
+        row.suite = "detect";
+        row.algorithm = names[i];
+        row.plant = config;
+        row.ns_per_op = ns[i].get();
+        row.error_steps = error[i].get();
+        row.success = static_cast<double>(found[i]) / seeds;
+        rows.push_back(row);
+    }
+}
+
+struct LoopRun {
+    double ns_per_op = NAN;
+    double steps_to_lock = NAN;
+    double ms_to_lock = NAN;
+    double residual_rms_v = NAN;
+    double rail_events = 0;
+};
+
+static LoopRun run_loop_once(enum setPoint mode, void (*process)(), const MzmPlantConfig& config, double kick, double seconds, uint32_t seed) {
+    MzmPlant plant(config, seed);
+    LoopRun run;
+
+    hal_host_reset();
+    hal_host_attach(&plant);
+    hal_host_set_deadline_us(static_cast<uint64_t>(DEADLINE_S) * 1000000);
+
+    set_point = mode;
+    sweep();
+    go_to_desired_setpoint();
+
+    plant.shift_phase(kick);
+
+    const HostHalStats& stats = hal_host_stats();
+    uint64_t kick_us = hal_host_time_us();
+    uint64_t end_us = kick_us + static_cast<uint64_t>(seconds * 1e6);
+    uint64_t kick_writes = stats.dac_writes;
+    uint32_t rails = rail_stats.wraps + rail_stats.searches;
+    double process_ns = 0, sum_squared = 0;
+    uint64_t calls = 0, passes = 0;
+    bool locked = false;
+
+    while (hal_host_time_us() < end_us) {
+        current_input_voltage = read_voltage();
+
+        if (locked) {
+            double error = plant.voltage(hal_host_time_us() * 1e-6) - q16_to_volts(selected_setpoint);
+            sum_squared += error * error;
+            passes++;
+        }
+        if (q16_abs(current_input_voltage - selected_setpoint) > tolerance) {
+            auto start = std::chrono::steady_clock::now();
+            process();
+            process_ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+            calls++;
+        }
+        //The process_* loops return once a reading is inside tolerance
+        if (!locked && q16_abs(current_input_voltage - selected_setpoint) <= tolerance) {
+            locked = true;
+            run.steps_to_lock = static_cast<double>(stats.dac_writes - kick_writes);
+            run.ms_to_lock = (hal_host_time_us() - kick_us) / 1000.0;
+        }
+        hal_host_advance_us(POLL_US);
+    }
+
+    if (calls) run.ns_per_op = process_ns / calls;
+    if (passes) run.residual_rms_v = std::sqrt(sum_squared / passes);
+    run.rail_events = rail_stats.wraps + rail_stats.searches - rails;
+    return run;
+}
+
+static void run_loop(const MzmPlantConfig& config, double kick, double seconds, int seeds, std::vector<Row>& rows) {
+    const struct { enum setPoint mode; void (*process)(); const char* name; } loops[] = {
+        {NULL_POINT, process_null, "process_null"},
+        {PEAK_POINT, process_peak, "process_peak"},
+        {QUAD_PLUS, process_quad_plus, "process_quad_plus"},
+        {QUAD_MINUS, process_quad_minus, "process_quad_minus"},
+    };
+
+    for (const auto& loop : loops) {
+        Mean ns, steps, ms, residual, rails;
+        int locked = 0;
+
+        for (int seed = 1; seed <= seeds; seed++) {
+            LoopRun run = run_loop_once(loop.mode, loop.process, config, kick, seconds, seed);
+            ns.add(run.ns_per_op);
+            steps.add(run.steps_to_lock);
+            ms.add(run.ms_to_lock);
+            residual.add(run.residual_rms_v);
+            rails.add(run.rail_events);
+            locked += !std::isnan(run.steps_to_lock);
+        }
+
+        Row row;
+        row.suite = "loop";
+        row.algorithm = loop.name;
+        row.plant = config;
+        row.ns_per_op = ns.get();
+        row.steps_to_lock = steps.get();
+        row.ms_to_lock = ms.get();
+        row.residual_rms_v = residual.get();
+        row.rail_events = rails.get();
+        row.success = static_cast<double>(locked) / seeds;
+        rows.push_back(row);
+    }
+}
+
+static std::string number(double value, bool json) {
+    if (std::isnan(value)) return json ? "null" : "";
+    std::ostringstream out;
+    out.precision(6);
+    out << value;
+    return out.str();
+}
+
+static void print(FILE* out, const std::vector<Row>& rows, bool json) {
+    const char* columns[] = {"suite", "algorithm", "noise_v", "phase_rad", "drift_rad_s", "adc_bits", "ns_per_op",
+                             "error_steps", "steps_to_lock", "ms_to_lock", "residual_rms_v", "rail_events", "success"};
+    const int count = sizeof(columns) / sizeof(columns[0]);
+
+    if (json) std::fprintf(out, "[\n");
+    else {
+        for (int i = 0; i < count; i++) std::fprintf(out, "%s%s", i ? "," : "", columns[i]);
+        std::fprintf(out, "\n");
+    }
+
+    for (size_t r = 0; r < rows.size(); r++) {
+        const Row& row = rows[r];
+        std::string values[] = {
+            json ? "\"" + row.suite + "\"" : row.suite,
+            json ? "\"" + row.algorithm + "\"" : row.algorithm,
+            number(row.plant.noise, json), number(row.plant.phase, json), number(row.plant.drift, json),
+            number(row.plant.adc_bits, json), number(row.ns_per_op, json), number(row.error_steps, json),
+            number(row.steps_to_lock, json), number(row.ms_to_lock, json), number(row.residual_rms_v, json),
+            number(row.rail_events, json), number(row.success, json),
+        };
+
+        if (json) std::fprintf(out, "  {");
+        for (int i = 0; i < count; i++) {
+            if (json) std::fprintf(out, "%s\"%s\": %s", i ? ", " : "", columns[i], values[i].c_str());
+            else std::fprintf(out, "%s%s", i ? "," : "", values[i].c_str());
+        }
+        if (json) std::fprintf(out, "}%s", r + 1 < rows.size() ? "," : "");
+        std::fprintf(out, "\n");
+    }
+
+    if (json) std::fprintf(out, "]\n");
+    std::fflush(out);
+}
+
+static std::vector<double> parse_list(const char* text) {
+    std::vector<double> values;
+    std::stringstream in(text);
+    std::string item;
+
+    while (std::getline(in, item, ',')) {
+        if (!item.empty()) values.push_back(std::atof(item.c_str()));
+    }
+    return values;
+}
+
+int main(int argc, char** argv) {
+    std::vector<double> noises = {0.001, 0.005, 0.02};
+    std::vector<double> phases = {-1.45, 0.4};
+    std::vector<double> drifts = {0, 0.02};
+    std::vector<double> adc_bits = {0, 10};
+    double kick = 0.6;
+    double seconds = 60;
+    int seeds = 3;
+    int samples = 64;
+    bool json = false;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string key = argv[i];
+        const char* value = argv[i + 1];
+
+        if (key == "--noise") noises = parse_list(value);
+        else if (key == "--phase") phases = parse_list(value);
+        else if (key == "--drift") drifts = parse_list(value);
+        else if (key == "--adc_bits") adc_bits = parse_list(value);
+        else if (key == "--kick") kick = std::atof(value);
+        else if (key == "--seconds") seconds = std::atof(value);
+        else if (key == "--seeds") seeds = std::max(1, std::atoi(value));
+        else if (key == "--samples") samples = std::max(1, std::atoi(value));
+        else if (key == "--format") json = std::string(value) == "json";
+        else {
+            std::cerr << "Unknown option: " << key << std::endl;
+            return 1;
+        }
+    }
+
+    //The controller and main.cpp print as they go, only the results are kept
+    FILE* out = fdopen(dup(STDOUT_FILENO), "w");
+    if (!out || !std::freopen("/dev/null", "w", stdout)) return 1;
+
+    std::vector<Row> rows;
+
+    for (double bits : adc_bits) {
+        for (double noise : noises) {
+            for (double phase : phases) {
+                MzmPlantConfig config;
+                config.noise = noise;
+                config.phase = phase;
+                config.adc_bits = static_cast<int>(bits);
+
+                run_detect(config, seeds, samples, rows);
+
+                for (double drift : drifts) {
+                    config.drift = drift;
+                    run_loop(config, kick, seconds, seeds, rows);
+                }
+            }
+        }
+    }
+
+    print(out, rows, json);
+    return 0;
+}
@@ -0,0 +1,328 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../bias_controller_pico/sweep_fit.h"
+#include "capture_log.hpp"
+
+/*
+Batch analysis of the sweep captures under hardware_tests. Every putty.log / .csv found under the given
+paths is memory mapped, parsed and fitted with the firmware's sweep_fit() on a pool of threads, then one
+table per RF frequency is printed with, for each run:
+
+    Vpi          fitted half period in DAC steps
+    ER           extinction ratio, refined peak over refined null voltage, in dB
+    null..quad-  lock point closest to mid-range, in DAC steps (what the firmware would pick)
+    resid        RMS residual of the sinusoid fit as a percentage of the amplitude
+    H2, H3       second and third harmonic of the curve against the fitted phase, percent of the fundamental
+
+RF drive shows up as flattened peaks, i.e. a larger H3 and residual (hardware_tests/RF_TEST/test_1).
+The RF frequency is taken from the directory names (1_8Ghz, 500MHz, ...) or failing that from an
+"RF IN: 1GHz" line in a read/readme file above the run. The RF power comes from the first "<x> dBm" in
+the run's read/readme. Runs with neither are grouped under "no RF".
+
+USAGE: capture_analyze [--csv] [-j threads] path [path ...]        e.g. capture_analyze ../hardware_tests
+--csv prints one machine readable row per run instead of the tables. Timing goes to stderr.
+*/
+
+namespace fs = std::filesystem;
+
+#define NO_RF_MHZ        0.0
+#define NULL_FLOOR_V     (3.3 / 4096)     //One ADC LSB, keeps the extinction ratio finite on a clipped null
+
+struct RunResult {
+    std::string path;
+    double rf_mhz = NO_RF_MHZ;
+    double rf_dbm = NAN;
+    size_t points = 0;
+    bool fit_ok = false;
+    sweep_fit_t fit{};
+    double extinction_db = NAN;
+    double residual_pct = NAN;
+    double h2_pct = NAN;
+    double h3_pct = NAN;
+    int null_step = -1;
+    int peak_step = -1;
+    int quad_plus_step = -1;
+    int quad_minus_step = -1;
+};
+
+//Frequency in MHz from a name like "1_8Ghz", "1.5GHz", "300Mhz" or "RF IN: 1GHz", 0 if there is none
+static double parse_frequency(const std::string& text) {
+    for (size_t i = 0; i < text.size(); i++) {
+        if (!std::isdigit(static_cast<unsigned char>(text[i])) || (i > 0 && std::isalnum(static_cast<unsigned char>(text[i - 1])))) continue;
+
+        size_t j = i;
+        double value = 0;
+        while (j < text.size() && std::isdigit(static_cast<unsigned char>(text[j]))) value = value * 10 + (text[j++] - '0');
+
+        if (j + 1 < text.size() && (text[j] == '.' || text[j] == '_') && std::isdigit(static_cast<unsigned char>(text[j + 1]))) {
+            double scale = 0.1;
+            for (j++; j < text.size() && std::isdigit(static_cast<unsigned char>(text[j])); j++, scale /= 10) value += (text[j] - '0') * scale;
+        }
+        while (j < text.size() && text[j] == ' ') j++;
+
+        std::string unit;
+        for (size_t k = j; k < text.size() && k < j + 3; k++) unit += static_cast<char>(std::tolower(static_cast<unsigned char>(text[k])));
+        if (unit == "ghz") return value * 1000;
+        if (unit == "mhz") return value;
+    }
+    return 0;
+}
+
+//RF power in a read/readme: the first "<number> dBm", or the number after "Power:" when the unit was left off. NaN if there is none.
+static double parse_dbm(const std::string& text) {
+    auto number_before = [&](size_t pos) {
+        size_t end = pos;
+        while (end > 0 && text[end - 1] == ' ') end--;
+        size_t start = end;
+        while (start > 0 && (std::isdigit(static_cast<unsigned char>(text[start - 1])) || text[start - 1] == '.' || text[start - 1] == '-')) start--;
+        return start < end ? std::atof(text.substr(start, end - start).c_str()) : NAN;
+    };
+
+    for (size_t pos = text.find("dBm"); pos != std::string::npos; pos = text.find("dBm", pos + 3)) {
+        double dbm = number_before(pos);
+        if (!std::isnan(dbm)) return dbm;
+    }
+
+    size_t power = text.find("Power:");
+    if (power != std::string::npos) {
+        const char* p = text.c_str() + power + 6;
+        char* end = nullptr;
+        double dbm = std::strtod(p, &end);
+        if (end != p) return dbm;
+    }
+    return NAN;
+}
+
+static std::string read_notes(const fs::path& dir) {
+    std::string notes;
+    for (const char* name : {"read", "readme"}) {
+        MappedFile file((dir / name).string());
+        notes.append(file.begin(), file.end());
+    }
+    return notes;
+}
+
+//Amplitudes of the first HARMONICS harmonics of the curve against the fitted phase. The sweeps cover less
+//than a full period, so the harmonics are not orthogonal over the data and are solved jointly by least squares.
+#define HARMONICS 3
+
+static bool harmonic_amplitudes(const std::vector<float>& y, const sweep_fit_t& fit, int step_size, double* amplitude) {
+    const int terms = 1 + 2 * HARMONICS;
+    double normal[terms][terms + 1] = {};
+    double w = M_PI * step_size / fit.vpi_steps;
+
+    for (size_t i = 0; i < y.size(); i++) {
+        double basis[terms];
+        basis[0] = 1;
+        for (int k = 1; k <= HARMONICS; k++) {
+            basis[2 * k - 1] = std::cos(k * (w * i + fit.phase));
+            basis[2 * k] = std::sin(k * (w * i + fit.phase));
+        }
+        for (int r = 0; r < terms; r++) {
+            for (int c = 0; c < terms; c++) normal[r][c] += basis[r] * basis[c];
+            normal[r][terms] += basis[r] * y[i];
+        }
+    }
+
+    //Gaussian elimination with partial pivoting
+    for (int col = 0; col < terms; col++) {
+        int pivot = col;
+        for (int r = col + 1; r < terms; r++) {
+            if (std::abs(normal[r][col]) > std::abs(normal[pivot][col])) pivot = r;
+        }
+        if (std::abs(normal[pivot][col]) < 1e-9) return false;
+        std::swap(normal[col], normal[pivot]);
+
+        for (int r = 0; r < terms; r++) {
+            if (r == col) continue;
+            double factor = normal[r][col] / normal[col][col];
+            for (int c = col; c <= terms; c++) normal[r][c] -= factor * normal[col][c];
+        }
+    }
+
+    for (int k = 1; k <= HARMONICS; k++) {
+        amplitude[k - 1] = std::hypot(normal[2 * k - 1][terms] / normal[2 * k - 1][2 * k - 1], normal[2 * k][terms] / normal[2 * k][2 * k]);
+    }
+    return true;
+}
+
+static void analyze(const fs::path& path, const fs::path& root, RunResult& run) {
+    run.path = path.lexically_relative(root).string();
+    if (run.path.empty() || run.path[0] == '.') run.path = path.string();
+
+    //Frequency from the nearest directory name carrying one, then from the notes on the way up
+    for (fs::path dir = path.parent_path(); !dir.empty() && run.rf_mhz == NO_RF_MHZ; dir = dir.parent_path()) {
+        run.rf_mhz = parse_frequency(dir.filename().string());
+        if (dir == root || dir == dir.parent_path()) break;
+    }
+    for (fs::path dir = path.parent_path(); !dir.empty(); dir = dir.parent_path()) {
+        std::string notes = read_notes(dir);
+        if (std::isnan(run.rf_dbm)) run.rf_dbm = parse_dbm(notes);
+        size_t rf_in = notes.find("RF IN");
+        if (run.rf_mhz == NO_RF_MHZ && rf_in != std::string::npos) run.rf_mhz = parse_frequency(notes.substr(rf_in));
+        if (dir == root || dir == dir.parent_path()) break;
+    }
+
+    std::vector<CapturePoint> points = load_capture(path.string());
+    run.points = points.size();
+    if (points.size() < 2) return;
+
+    std::vector<float> y = capture_voltages(points);
+    int step_size = points[1].step - points[0].step;
+    run.fit_ok = sweep_fit(y.data(), static_cast<int>(y.size()), step_size, &run.fit);
+    if (!run.fit_ok) return;
+
+    const sweep_fit_t& fit = run.fit;
+    run.extinction_db = 10 * std::log10(fit.peak_voltage / std::max<double>(fit.null_voltage, NULL_FLOOR_V));
+    run.residual_pct = 100 * fit.rms_residual / fit.amplitude;
+
+    double harmonics[HARMONICS];
+    if (harmonic_amplitudes(y, fit, step_size, harmonics) && harmonics[0] > 0) {
+        run.h2_pct = 100 * harmonics[1] / harmonics[0];
+        run.h3_pct = 100 * harmonics[2] / harmonics[0];
+    }
+
+    run.null_step = sweep_fit_closest_to_mid(fit.null_steps, fit.null_count);
+    run.peak_step = sweep_fit_closest_to_mid(fit.peak_steps, fit.peak_count);
+    run.quad_plus_step = sweep_fit_closest_to_mid(fit.quad_plus_steps, fit.quad_plus_count);
+    run.quad_minus_step = sweep_fit_closest_to_mid(fit.quad_minus_steps, fit.quad_minus_count);
+}
+
+static std::string frequency_name(double mhz) {
+    char name[32];
+    if (mhz == NO_RF_MHZ) return "no RF";
+    if (mhz >= 1000) std::snprintf(name, sizeof(name), "%g GHz", mhz / 1000);
+    else std::snprintf(name, sizeof(name), "%g MHz", mhz);
+    return name;
+}
+
+//Lock point column, "-" when the sweep did not contain one
+static std::string step_column(int step) {
+    return step < 0 ? "-" : std::to_string(step);
+}
+
+static void print_row(const char* name, double dbm, double vpi, double er, int null_step, int peak_step,
+                      int quad_plus_step, int quad_minus_step, double residual, double h2, double h3) {
+    std::printf("  %-44s %7.2f %7.0f %6.2f %6s %6s %6s %6s %6.2f %6.2f %6.2f\n", name, dbm, vpi, er,
+                step_column(null_step).c_str(), step_column(peak_step).c_str(), step_column(quad_plus_step).c_str(),
+                step_column(quad_minus_step).c_str(), residual, h2, h3);
+}
+
+int main(int argc, char** argv) {
+    bool csv = false;
+    unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<fs::path> roots;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--csv") csv = true;
+        else if (arg == "-j" && i + 1 < argc) threads = std::max(1, std::atoi(argv[++i]));
+        else roots.emplace_back(arg);
+    }
+
+    if (roots.empty()) {
+        std::cerr << "USAGE: capture_analyze [--csv] [-j threads] path [path ...]" << std::endl;
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    //Every capture under the given paths, each paired with the root it was found under
+    std::vector<std::pair<fs::path, fs::path>> files;
+    for (const fs::path& root : roots) {
+        if (fs::is_regular_file(root)) {
+            files.emplace_back(root, root.parent_path());
+            continue;
+        }
+        std::error_code error;
+        for (auto it = fs::recursive_directory_iterator(root, error); it != fs::recursive_directory_iterator(); it.increment(error)) {
+            const fs::path& path = it->path();
+            if (it->is_regular_file() && (path.filename() == "putty.log" || path.extension() == ".csv")) files.emplace_back(path, root);
+        }
+    }
+
+    //Work queue is just an index, each worker takes the next file until none are left
+    std::vector<RunResult> runs(files.size());
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> pool;
+
+    for (unsigned int t = 0; t < std::min<size_t>(threads, files.size()); t++) {
+        pool.emplace_back([&] {
+            for (size_t i; (i = next.fetch_add(1)) < files.size();) analyze(files[i].first, files[i].second, runs[i]);
+        });
+    }
+    for (std::thread& worker : pool) worker.join();
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    std::sort(runs.begin(), runs.end(), [](const RunResult& a, const RunResult& b) {
+        return a.rf_mhz != b.rf_mhz ? a.rf_mhz < b.rf_mhz : a.path < b.path;
+    });
+
+    size_t failures = 0;
+    size_t total_points = 0;
+    for (const RunResult& run : runs) {
+        failures += !run.fit_ok;
+        total_points += run.points;
+    }
+
+    if (csv) {
+        std::printf("path,rf_mhz,rf_dbm,points,fit_ok,vpi_steps,extinction_db,null_step,peak_step,quad_plus_step,quad_minus_step,"
+                    "null_v,peak_v,quad_v,residual_pct,h2_pct,h3_pct\n");
+        for (const RunResult& run : runs) {
+            std::printf("%s,%g,%g,%zu,%d,%.1f,%.3f,%d,%d,%d,%d,%.4f,%.4f,%.4f,%.3f,%.3f,%.3f\n", run.path.c_str(), run.rf_mhz,
+                        run.rf_dbm, run.points, run.fit_ok, run.fit.vpi_steps, run.extinction_db, run.null_step, run.peak_step,
+                        run.quad_plus_step, run.quad_minus_step, run.fit.null_voltage, run.fit.peak_voltage, run.fit.quad_voltage,
+                        run.residual_pct, run.h2_pct, run.h3_pct);
+        }
+    } else {
+        std::map<double, std::vector<const RunResult*>> groups;
+        for (const RunResult& run : runs) groups[run.rf_mhz].push_back(&run);
+
+        for (const auto& [mhz, group] : groups) {
+            std::printf("\n=== %s, %zu runs ===\n", frequency_name(mhz).c_str(), group.size());
+            std::printf("  %-44s %7s %7s %6s %6s %6s %6s %6s %6s %6s %6s\n", "run", "dBm", "Vpi", "ER dB",
+                        "null", "peak", "quad+", "quad-", "resid%", "H2%", "H3%");
+
+            double sum_vpi = 0, sum_er = 0, sum_residual = 0, sum_h2 = 0, sum_h3 = 0;
+            int fitted = 0;
+
+            for (const RunResult* run : group) {
+                if (!run->fit_ok) {
+                    std::printf("  %-44s %7.2f  no fit (%zu points)\n", run->path.c_str(), run->rf_dbm, run->points);
+                    continue;
+                }
+                print_row(run->path.c_str(), run->rf_dbm, run->fit.vpi_steps, run->extinction_db, run->null_step, run->peak_step,
+                          run->quad_plus_step, run->quad_minus_step, run->residual_pct, run->h2_pct, run->h3_pct);
+                sum_vpi += run->fit.vpi_steps;
+                sum_er += run->extinction_db;
+                sum_residual += run->residual_pct;
+                sum_h2 += run->h2_pct;
+                sum_h3 += run->h3_pct;
+                fitted++;
+            }
+
+            if (fitted > 1) {
+                std::printf("  %-44s %7s %7.0f %6.2f %6s %6s %6s %6s %6.2f %6.2f %6.2f\n", "mean", "", sum_vpi / fitted,
+                            sum_er / fitted, "", "", "", "", sum_residual / fitted, sum_h2 / fitted, sum_h3 / fitted);
+            }
+        }
+    }
+
+    std::fprintf(stderr, "%zu captures, %zu points, %zu without a fit, %.1f ms on %u threads\n", runs.size(), total_points,
+                 failures, ms, std::min<unsigned int>(threads, static_cast<unsigned int>(std::max<size_t>(1, files.size()))));
+
+    return failures ? 1 : 0;
+}
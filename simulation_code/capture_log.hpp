@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+Parser for the sweep captures under hardware_tests: PuTTY logs of "step:voltage" lines, one per sweep
+point, with the PuTTY banner and any other text lines skipped. Some logs were re-saved from the
+spreadsheet as "step;voltage", so ';' and ',' are accepted as the separator too. Files are memory mapped and parsed in place.
+*/
+
+//Read-only mapping of a whole file, empty if it cannot be opened or has no data
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+
+        struct stat info;
+        if (::fstat(fd, &info) == 0 && info.st_size > 0) {
+            void* data = ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                ::madvise(data, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+                data_ = static_cast<const char*>(data);
+                size_ = static_cast<size_t>(info.st_size);
+            }
+        }
+        ::close(fd);
+    }
+
+    ~MappedFile() {
+        if (data_) ::munmap(const_cast<char*>(data_), size_);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* begin() const { return data_; }
+    const char* end() const { return data_ + size_; }
+    size_t size() const { return size_; }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+struct CapturePoint {
+    int step;
+    float voltage;
+};
+
+//Unsigned decimal integer at p, bounded by end. Returns the first character after it.
+inline const char* parse_digits(const char* p, const char* end, long& value, int& digits) {
+    value = 0;
+    digits = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        value = value * 10 + (*p - '0');
+        digits++;
+        p++;
+    }
+    return p;
+}
+
+//Parse every "step:voltage" line between begin and end. The numbers are parsed by hand, strtol/strtof
+//would need a terminator and a mapped file does not have one.
+inline std::vector<CapturePoint> parse_capture(const char* begin, const char* end) {
+    std::vector<CapturePoint> points;
+    const char* p = begin;
+
+    while (p < end) {
+        const char* line_end = p;
+        while (line_end < end && *line_end != '\n') line_end++;
+
+        //Anything that is not digits separator [-]digits[.digits] is a header or comment
+        long step, whole, fraction;
+        int digits, fraction_digits = 0;
+        const char* q = parse_digits(p, line_end, step, digits);
+
+        if (digits > 0 && q < line_end && (*q == ':' || *q == ';' || *q == ',')) {
+            q++;
+            bool negative = q < line_end && *q == '-';
+            if (negative) q++;
+
+            q = parse_digits(q, line_end, whole, digits);
+            if (digits > 0) {
+                double voltage = static_cast<double>(whole);
+                if (q < line_end && *q == '.') {
+                    q = parse_digits(q + 1, line_end, fraction, fraction_digits);
+                    voltage += fraction / std::pow(10.0, fraction_digits);
+                }
+                points.push_back({static_cast<int>(step), static_cast<float>(negative ? -voltage : voltage)});
+            }
+        }
+
+        p = line_end + 1;
+    }
+
+    return points;
+}
+
+inline std::vector<CapturePoint> load_capture(const std::string& path) {
+    MappedFile file(path);
+    return parse_capture(file.begin(), file.end());
+}
+
+//Voltages only, in capture order, as the firmware's result_array
+inline std::vector<float> capture_voltages(const std::vector<CapturePoint>& points) {
+    std::vector<float> voltages;
+    voltages.reserve(points.size());
+    for (const auto& point : points) voltages.push_back(point.voltage);
+    return voltages;
+}
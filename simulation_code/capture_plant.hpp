@@ -0,0 +1,100 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "capture_log.hpp"
+#include "plant.hpp"
+
+/*
+Plant that plays back a recorded sweep (capture_log.hpp) instead of the ideal sinusoid of mzm_plant.hpp,
+so the firmware sees the real distortion, offset and noise floor of the hardware. DAC levels between
+captured points are linearly interpolated and fresh ADC noise is added on top of the recording.
+
+set_drift() makes the phase move in time like mzm_plant.hpp's: the curve slides along the DAC axis by
+v_pi_steps / pi steps per radian. Where that leaves the captured range the curve is continued a whole
+period (2 v_pi_steps) away if the capture covers it, else held at its end.
+*/
+
+class CapturePlant : public Plant {
+public:
+    CapturePlant(std::vector<CapturePoint> points, double noise, uint32_t seed = 1)
+        : points_(std::move(points)), noise_(noise), gen_(seed), normal_(0.0, 1.0) {}
+
+    void set_dac(uint16_t level) override {
+        dac_ = level;
+    }
+
+    //Phase drift in radians per second (and per second^2) on a curve with the given half period
+    void set_drift(double v_pi_steps, double drift, double drift_ramp = 0) {
+        v_pi_steps_ = v_pi_steps;
+        drift_ = drift;
+        drift_ramp_ = drift_ramp;
+    }
+
+    //Step change of the bias phase, e.g. a thermal jump
+    void shift_phase(double radians) {
+        phase_ += radians;
+    }
+
+    double phase(double t_seconds) const {
+        return phase_ + drift_ * t_seconds + drift_ramp_ * t_seconds * t_seconds / 2;
+    }
+
+    double drift_rate(double t_seconds) const {
+        return drift_ + drift_ramp_ * t_seconds;
+    }
+
+    //Captured curve at a DAC level, at a time the phase has moved it along
+    double voltage_at(double dac, double t_seconds) const {
+        if (v_pi_steps_ <= 0 || points_.empty()) return voltage_at(dac);
+
+        double x = dac + phase(t_seconds) * v_pi_steps_ / M_PI;
+        double period = 2 * v_pi_steps_;
+        if (points_.back().step - points_.front().step >= period) {
+            if (x < points_.front().step) x += std::ceil((points_.front().step - x) / period) * period;
+            if (x > points_.back().step) x -= std::ceil((x - points_.back().step) / period) * period;
+        }
+        return voltage_at(x);
+    }
+
+    double voltage_at(double dac) const {
+        if (points_.empty()) return 0.0;
+        if (dac <= points_.front().step) return points_.front().voltage;
+        if (dac >= points_.back().step) return points_.back().voltage;
+
+        auto upper = std::upper_bound(points_.begin(), points_.end(), dac,
+                                      [](double value, const CapturePoint& point) { return value < point.step; });
+        auto lower = upper - 1;
+        double fraction = (dac - lower->step) / static_cast<double>(upper->step - lower->step);
+        return lower->voltage + (upper->voltage - lower->voltage) * fraction;
+    }
+
+    double voltage(double t_seconds) const override {
+        return voltage_at(dac_, t_seconds);
+    }
+
+    float mean_counts(uint32_t n, double t_seconds) override {
+        if (n == 0) return 0.0f;
+        double counts = voltage(t_seconds) / PLANT_ADC_MAX_VOLTAGE * PLANT_ADC_STEPS;
+        counts += noise_ / PLANT_ADC_MAX_VOLTAGE * PLANT_ADC_STEPS / std::sqrt(static_cast<double>(n)) * normal_(gen_);
+        return static_cast<float>(std::min(PLANT_ADC_STEPS - 1.0, std::max(0.0, counts)));
+    }
+
+    const std::vector<CapturePoint>& points() const {
+        return points_;
+    }
+
+private:
+    std::vector<CapturePoint> points_;
+    double noise_;
+    double v_pi_steps_ = 0;            //0: no drift, the capture as recorded
+    double drift_ = 0;
+    double drift_ramp_ = 0;
+    double phase_ = 0;
+    uint16_t dac_ = 0;
+    std::mt19937 gen_;
+    std::normal_distribution<> normal_;
+};
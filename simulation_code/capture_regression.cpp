@@ -0,0 +1,211 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../bias_controller_pico/bias_controller_pico.h"
+#include "../bias_controller_pico/sweep_fit.h"
+#include "capture_log.hpp"
+#include "capture_plant.hpp"
+#include "hal_host.hpp"
+#include "sim_trial.hpp"
+
+/*
+Regression of the firmware against every sweep capture under the given paths: for each putty.log / .csv
+and each setpoint mode the controller boots on a CapturePlant playing the recorded curve, runs its sweep,
+detection and lock, and tracks for --seconds with the curve drifting --drift rad/s (the capture's own
+period from sweep_fit() converts it to DAC steps). A run fails if the noise free output is outside the
+tolerance for more than --hold percent of the tracking passes.
+
+Captures are memory mapped and parsed once, before the runs. Every run is a forked child (sim_trial.hpp,
+the firmware keeps its state in globals) sharing the parsed curves, at most -j of them at a time. Runs are
+seeded, the same arguments give the same table.
+
+USAGE: capture_regression [--seconds s] [--drift rad/s] [--noise V] [--kick rad] [--hold %] [--seed n]
+                          [-j n] [--csv] path [path ...]          e.g. capture_regression ../hardware_tests
+Exit code is 0 when every run held, 1 otherwise.
+*/
+
+namespace fs = std::filesystem;
+
+#define DEFAULT_VPI    26000           //When the capture does not fit, the ideal plant's
+
+struct Capture {
+    std::string path;
+    std::vector<CapturePoint> points;
+    double vpi = DEFAULT_VPI;
+    bool fit_ok = false;
+};
+
+struct Options {
+    double seconds = 20;
+    double drift = 0.005;
+    double noise = 0.005;
+    double kick = 0;
+    double hold = 95;
+    uint32_t seed = 1;
+};
+
+//Sent back by each run over its pipe
+struct RunResult {
+    bool finished;
+    double setup_ms;
+    double setpoint_v;
+    double rms_v;
+    double inside;                     //Fraction of the tracking passes
+    uint32_t rail_events;
+};
+
+struct Mode {
+    enum setPoint mode;
+    const char* name;
+};
+
+static const Mode modes[] = {
+    {NULL_POINT, "null"},
+    {PEAK_POINT, "peak"},
+    {QUAD_PLUS, "quad+"},
+    {QUAD_MINUS, "quad-"},
+};
+
+//In the child
+static RunResult run(const Capture& capture, const Mode& mode, const Options& options) {
+    CapturePlant plant(capture.points, options.noise, options.seed);
+    RunResult result = {};
+    SimErrorAccumulator error;
+
+    plant.set_drift(capture.vpi, options.drift);
+    hal_host_attach(&plant);
+    sim_boot(mode.mode, options.seconds);
+
+    result.setup_ms = (hal_host_time_us() - hal_host_stats().first_dac_us) / 1000.0;
+    result.setpoint_v = q16_to_volts(selected_setpoint);
+    plant.shift_phase(options.kick);
+
+    sim_track(options.seconds, [&](double t) { error.add(sim_error(plant.voltage(t))); });
+
+    result.rms_v = error.rms();
+    result.inside = error.inside_share();
+    result.rail_events = rail_stats.wraps + rail_stats.searches;
+    result.finished = true;
+    return result;
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    unsigned int jobs = std::max(1u, std::thread::hardware_concurrency());
+    bool csv = false;
+    std::vector<fs::path> roots;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (arg == "--csv") csv = true;
+        else if (arg == "-j" && has_value) jobs = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--seconds" && has_value) options.seconds = std::atof(argv[++i]);
+        else if (arg == "--drift" && has_value) options.drift = std::atof(argv[++i]);
+        else if (arg == "--noise" && has_value) options.noise = std::atof(argv[++i]);
+        else if (arg == "--kick" && has_value) options.kick = std::atof(argv[++i]);
+        else if (arg == "--hold" && has_value) options.hold = std::atof(argv[++i]);
+        else if (arg == "--seed" && has_value) options.seed = static_cast<uint32_t>(std::atoi(argv[++i]));
+        else if (arg.rfind("--", 0) == 0) {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return 1;
+        }
+        else roots.emplace_back(arg);
+    }
+
+    if (roots.empty()) {
+        std::cerr << "USAGE: capture_regression [--seconds s] [--drift rad/s] [--noise V] [--kick rad] [--hold %] [--seed n] "
+                     "[-j n] [--csv] path [path ...]" << std::endl;
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    //Every capture, parsed and fitted once for all the runs
+    std::vector<Capture> captures;
+    for (const fs::path& root : roots) {
+        std::vector<fs::path> files;
+        if (fs::is_regular_file(root)) files.push_back(root);
+        std::error_code error;
+        for (auto it = fs::recursive_directory_iterator(root, error); it != fs::recursive_directory_iterator(); it.increment(error)) {
+            const fs::path& path = it->path();
+            if (it->is_regular_file() && (path.filename() == "putty.log" || path.extension() == ".csv")) files.push_back(path);
+        }
+        std::sort(files.begin(), files.end());
+
+        for (const fs::path& path : files) {
+            Capture capture;
+            capture.path = path.lexically_relative(fs::is_regular_file(root) ? root.parent_path() : root).string();
+            capture.points = load_capture(path.string());
+            if (capture.points.size() < 2) continue;
+
+            std::vector<float> y = capture_voltages(capture.points);
+            sweep_fit_t fit;
+            capture.fit_ok = sweep_fit(y.data(), static_cast<int>(y.size()), capture.points[1].step - capture.points[0].step, &fit);
+            if (capture.fit_ok) capture.vpi = fit.vpi_steps;
+            captures.push_back(std::move(capture));
+        }
+    }
+
+    size_t mode_count = sizeof(modes) / sizeof(modes[0]);
+    size_t run_count = captures.size() * mode_count;
+    std::vector<RunResult> results(run_count);
+    std::vector<SimChild> running(run_count);
+    size_t next = 0, done = 0;
+
+    while (done < run_count) {
+        //Start runs up to the limit, each sends its result back and exits
+        while (next < run_count && next - done < jobs) {
+            const Capture& capture = captures[next / mode_count];
+            const Mode& mode = modes[next % mode_count];
+            running[next] = sim_fork([&] { return run(capture, mode, options); });
+            next++;
+        }
+
+        //Collect in order, a run that died or timed out reads as unfinished
+        results[done] = sim_collect<RunResult>(running[done]);
+        done++;
+    }
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    size_t failures = 0;
+
+    if (csv) {
+        std::printf("capture,mode,vpi_steps,fit_ok,setup_ms,setpoint_v,rms_v,inside_pct,rail_events,held\n");
+    } else {
+        std::printf("%zu captures x %zu modes, %.1f s tracking each, drift %g rad/s, noise %g V, kick %g rad, seed %u\n\n",
+                    captures.size(), mode_count, options.seconds, options.drift, options.noise, options.kick, options.seed);
+        std::printf("%-48s%-7s%-8s%-10s%-11s%-11s%-9s%-7s%s\n", "capture", "mode", "Vpi", "setup ms", "setpoint V", "RMS mV",
+                    "inside%", "rails", "");
+    }
+
+    for (size_t i = 0; i < run_count; i++) {
+        const Capture& capture = captures[i / mode_count];
+        const Mode& mode = modes[i % mode_count];
+        const RunResult& r = results[i];
+        bool held = r.finished && r.inside * 100 >= options.hold;
+        failures += !held;
+
+        if (csv) {
+            std::printf("%s,%s,%.0f,%d,%.1f,%.4f,%.5f,%.2f,%u,%d\n", capture.path.c_str(), mode.name, capture.vpi, capture.fit_ok,
+                        r.setup_ms, r.setpoint_v, r.rms_v, r.inside * 100, r.rail_events, held);
+        } else if (!r.finished) {
+            std::printf("%-48s%-7s%-8.0f%s\n", capture.path.c_str(), mode.name, capture.vpi, "did not finish  FAIL");
+        } else {
+            std::printf("%-48s%-7s%-8.0f%-10.0f%-11.4f%-11.2f%-9.1f%-7u%s\n", capture.path.c_str(), mode.name, capture.vpi, r.setup_ms,
+                        r.setpoint_v, r.rms_v * 1000, r.inside * 100, r.rail_events, held ? "" : "FAIL");
+        }
+    }
+
+    std::fprintf(stderr, "%zu runs, %zu failed, %.0f ms on %u jobs\n", run_count, failures, ms, jobs);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,271 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <vector>
+
+#include "../bias_controller_pico/hal.h"
+#include "hal_host.hpp"
+
+#define HOST_FLASH_SIZE (2 * 1024 * 1024)
+#define HOST_GPIO_COUNT 30
+
+namespace {
+
+//One plant per controller channel: channel n is ADC input n and one PWM pin
+struct HostChannel {
+    Plant* plant = nullptr;
+    int pwm_pin = -1;              //-1: any pin (hal_host_attach())
+};
+
+HostChannel channels[HOST_ADC_INPUTS];
+unsigned int adc_inputs = 1;
+unsigned int adc_selected = 0;
+uint64_t now_us = 0;
+uint64_t deadline_us = UINT64_MAX;
+bool pins[HOST_GPIO_COUNT] = {};
+hal_gpio_callback_t pin_callbacks[HOST_GPIO_COUNT] = {};
+std::deque<char> input;
+std::vector<uint8_t> flash(HOST_FLASH_SIZE, 0xFF);
+HostHalStats stats;
+uint64_t tick_period_us = 1;
+uint64_t tick_start_us = 0;
+uint64_t tick_seen = 0;
+
+double now_seconds() {
+    return now_us * 1e-6;
+}
+
+}
+
+void hal_host_attach(Plant* p) {
+    channels[0].plant = p;
+    channels[0].pwm_pin = -1;
+}
+
+void hal_host_attach_channel(unsigned int input, unsigned int pwm_pin, Plant* p) {
+    channels[input].plant = p;
+    channels[input].pwm_pin = static_cast<int>(pwm_pin);
+}
+
+void hal_host_set_pin(unsigned int pin, bool value) {
+    bool falling = pins[pin] && !value;
+    pins[pin] = value;
+    if (falling && pin_callbacks[pin]) {
+        pin_callbacks[pin](pin, 0);
+    }
+}
+
+void hal_host_queue_input(const std::string& text) {
+    input.insert(input.end(), text.begin(), text.end());
+}
+
+void hal_host_set_deadline_us(uint64_t us) {
+    deadline_us = us;
+}
+
+void hal_host_reset() {
+    now_us = 0;
+    deadline_us = UINT64_MAX;
+    std::memset(pins, 0, sizeof(pins));
+    std::memset(pin_callbacks, 0, sizeof(pin_callbacks));
+    input.clear();
+    stats = HostHalStats();
+    tick_period_us = 1;
+    tick_start_us = 0;
+    tick_seen = 0;
+    adc_inputs = 1;
+    adc_selected = 0;
+}
+
+void hal_host_power_cycle() {
+    std::memset(pins, 0, sizeof(pins));
+    std::memset(pin_callbacks, 0, sizeof(pin_callbacks));
+    input.clear();
+    stats = HostHalStats();
+    tick_period_us = 1;
+    tick_start_us = now_us;
+    tick_seen = 0;
+    for (HostChannel& channel : channels) {
+        if (channel.plant) {
+            channel.plant->advance(now_seconds());
+            channel.plant->set_dac(0);
+        }
+    }
+}
+
+uint64_t hal_host_time_us() {
+    return now_us;
+}
+
+void hal_host_advance_us(uint64_t us) {
+    now_us += us;
+    if (now_us > deadline_us) {
+        std::cout << "TIMEOUT: simulated time passed " << deadline_us / 1000000.0 << " s" << std::endl;
+        std::exit(2);
+    }
+}
+
+const HostHalStats& hal_host_stats() {
+    return stats;
+}
+
+//hal.h implementation
+
+extern "C" {
+
+void hal_stdio_init() {}
+
+int hal_getchar_timeout_us(uint32_t timeout_us) {
+    if (input.empty()) {
+        hal_host_advance_us(timeout_us);
+        return HAL_NO_CHAR;
+    }
+    char c = input.front();
+    input.pop_front();
+    return c;
+}
+
+void hal_stdio_write_raw(const uint8_t* data, size_t length) {
+    std::fflush(stdout);
+    std::fwrite(data, 1, length, stdout);
+    std::fflush(stdout);
+}
+
+void hal_adc_init(unsigned int inputs) {
+    adc_inputs = inputs ? inputs : 1;
+}
+
+void hal_adc_select(unsigned int input) {
+    adc_selected = input;
+}
+
+//The inputs are sampled in rotation, n of each takes n * inputs sample times
+void hal_adc_wait(uint32_t n) {
+    stats.adc_reads++;
+    stats.adc_samples += static_cast<uint64_t>(n) * adc_inputs;
+    hal_host_advance_us(static_cast<uint64_t>(n * adc_inputs * HOST_ADC_SAMPLE_US));
+}
+
+adc_q16_t hal_adc_mean(uint32_t n) {
+    Plant* plant = channels[adc_selected].plant;
+    return plant ? static_cast<adc_q16_t>(std::lround(plant->mean_counts(n, now_seconds()) * Q16_ONE)) : 0;
+}
+
+//The plants draw the mean of a window directly, with no samples to decimate. For the slow bias signal the
+//CIC outputs of a window average to its plain mean, which is what the host returns.
+void hal_adc_filter(int, int) {}
+
+adc_q16_t hal_adc_filtered(uint32_t n) {
+    return hal_adc_mean(n);
+}
+
+//Nor any samples to reject, the plants' noise is Gaussian and a window mean of it is what the Hampel filter
+//passes unchanged
+void hal_adc_outliers(int, float) {}
+
+adc_q16_t hal_adc_robust(uint32_t n) {
+    return hal_adc_mean(n);
+}
+
+uint32_t hal_adc_rejected(uint32_t* samples) {
+    *samples = 0;
+    return 0;
+}
+
+void hal_pwm_init(unsigned int) {}
+
+//The plant sees the 16-bit level directly, both back ends look the same here
+void hal_pwm_set_mode(unsigned int, int) {}
+
+void hal_pwm_set(unsigned int pin, uint16_t level) {
+    if (stats.dac_writes == 0) {
+        stats.first_dac_us = now_us;
+    }
+    stats.dac_writes++;
+    for (HostChannel& channel : channels) {
+        if (channel.plant && (channel.pwm_pin == static_cast<int>(pin) || channel.pwm_pin < 0)) {
+            channel.plant->advance(now_seconds());
+            channel.plant->set_dac(level);
+            return;
+        }
+    }
+}
+
+void hal_gpio_init_input(unsigned int, bool) {}
+
+void hal_gpio_init_output(unsigned int) {}
+
+void hal_gpio_put(unsigned int pin, bool value) {
+    pins[pin] = value;
+}
+
+bool hal_gpio_get(unsigned int pin) {
+    return pins[pin];
+}
+
+void hal_gpio_irq_falling(unsigned int pin, hal_gpio_callback_t callback) {
+    pin_callbacks[pin] = callback;
+}
+
+//Single threaded: the host tools call controller_setup()/controller_loop() themselves, this just runs entry
+void hal_core1_launch(void (*entry)(void)) {
+    entry();
+}
+
+//Ticks are computed from the virtual clock: waiting jumps to the next tick, a late caller gets every tick
+//that has already fired
+void hal_tick_start(uint32_t period_us) {
+    tick_period_us = period_us ? period_us : 1;
+    tick_start_us = now_us;
+    tick_seen = 0;
+}
+
+void hal_tick_stop() {}
+
+uint32_t hal_tick_wait() {
+    uint64_t fired = (now_us - tick_start_us) / tick_period_us;
+
+    if (fired <= tick_seen) {
+        fired = tick_seen + 1;
+        hal_host_advance_us(tick_start_us + fired * tick_period_us - now_us);
+    }
+
+    tick_seen = static_cast<uint32_t>(fired);
+    return tick_seen;
+}
+
+uint64_t hal_time_us() {
+    return now_us;
+}
+
+//Real time, not the virtual clock: only used to time code, there is no cycle counter to emulate
+uint32_t hal_cycles() {
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    return static_cast<uint32_t>(ns) & HAL_CYCLES_MASK;
+}
+
+void hal_sleep_ms(uint32_t ms) {
+    hal_host_advance_us(static_cast<uint64_t>(ms) * 1000);
+}
+
+const uint8_t* hal_flash_read(uint32_t offset) {
+    return flash.data() + offset;
+}
+
+void hal_flash_erase(uint32_t offset, size_t length) {
+    stats.flash_erases++;
+    std::memset(flash.data() + offset, 0xFF, length);
+}
+
+void hal_flash_program(uint32_t offset, const uint8_t* data, size_t length) {
+    //NOR flash can only clear bits
+    for (size_t i = 0; i < length; i++) {
+        flash[offset + i] &= data[i];
+    }
+}
+
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "plant.hpp"
+
+/*
+Host side of bias_controller_pico/hal.h. Time is virtual: hal_sleep_ms() and ADC captures advance the
+clock instead of sleeping, so the 10 s boot delay and polling_delay(1000) cost nothing.
+*/
+
+#define HOST_ADC_SAMPLE_US 2.0    //RP2040 ADC free-running at 500 ksps
+#define HOST_ADC_INPUTS    4      //RP2040 ADC inputs, one plant each
+
+struct HostHalStats {
+    uint64_t adc_reads = 0;        //hal_adc_wait() calls (one per read_voltage())
+    uint64_t adc_samples = 0;      //Samples captured in total, every input
+    uint64_t dac_writes = 0;       //hal_pwm_set() calls
+    uint64_t first_dac_us = 0;     //Virtual time of the first DAC write (start of the sweep)
+    uint64_t flash_erases = 0;
+};
+
+void hal_host_attach(Plant* plant);                    //Single channel, every DAC pin drives it
+void hal_host_attach_channel(unsigned int input, unsigned int pwm_pin, Plant* plant);   //Controller channel input
+void hal_host_set_pin(unsigned int pin, bool value);
+void hal_host_queue_input(const std::string& text);    //Characters returned by hal_getchar_timeout_us()
+void hal_host_set_deadline_us(uint64_t deadline_us);   //Abort the run if virtual time passes this
+void hal_host_reset();
+void hal_host_power_cycle();                           //Reboot: pins, input, ticks and stats cleared, flash and the clock kept
+
+uint64_t hal_host_time_us();
+void hal_host_advance_us(uint64_t us);
+const HostHalStats& hal_host_stats();
@@ -0,0 +1,195 @@
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "../bias_controller_pico/bias_controller_pico.h"
+#include "../bias_controller_pico/control_tick.h"
+#include "hal_host.hpp"
+#include "mzm_plant.hpp"
+#include "physical_plant.hpp"
+
+/*
+Runs the real firmware control code (bias_controller_pico.c built with BIAS_HOST_BUILD) against the
+simulated MZM in mzm_plant.hpp on a virtual clock, and reports how long and how many steps it took to lock.
+
+USAGE: host_controller [--mode null|peak|quad+|quad-] [--phase rad] [--drift rad/s] [--ramp rad/s^2] [--noise V]
+                       [--vpi steps] [--kick rad] [--seconds s] [--seed n] [--cmd "set tolerance 0.01"]
+                       [--reboot rad] [--plant mzm|physical] [--min-inside %]
+--plant physical runs against the time stepped plant of physical_plant.hpp (RC filter, ADC with DNL, thermal
+drift, intensity noise, harmonics) instead of the ideal one, for hour long soak runs; --phase, --drift, --ramp,
+--noise and --vpi set the same quantities on it.
+--kick applies a phase step to the plant right after the first lock. --ramp makes the drift rate itself grow.
+--reboot power cycles the controller after the tracking run, with the plant phase moved by rad while it was
+off, then boots and tracks again. The second boot warm starts from the calibration the first one stored.
+Exit code is 0 when the selected setpoint was reached and held, at least --min-inside % of the tracking passes
+inside tolerance (default every pass), 1 otherwise, 2 on a simulated timeout.
+*/
+
+#define SIM_TIMEOUT_S 3600     //Abort runs that never converge after an hour of simulated time on top of the tracking
+
+static void print_plant(const MzmPlant&) {}
+
+static void print_plant(const PhysicalPlant& plant) {
+    std::cout << "Plant              : temperature " << plant.temperature() << " K, phase " << plant.phase(hal_host_time_us() * 1e-6)
+              << " rad, ripple " << plant.ripple_steps() << " steps p-p" << std::endl;
+}
+
+//Boot, lock, track for the given time and print the results. Returns true if at least min_inside % of the
+//passes were inside tolerance.
+template <class P>
+static bool boot_and_track(P& plant, const std::string& mode, double seconds, double kick, double min_inside) {
+    uint64_t boot_us = hal_host_time_us();
+
+    //Boot, sweep and first lock
+    controller_setup();
+
+    const HostHalStats& stats = hal_host_stats();
+    uint64_t lock_us = hal_host_time_us();
+    uint64_t acquire_dac_writes = stats.dac_writes;
+    uint64_t acquire_adc_reads = stats.adc_reads;
+
+    plant.shift_phase(kick);
+
+    //Tracking: run the main loop for the requested simulated time
+    uint64_t end_us = lock_us + static_cast<uint64_t>(seconds * 1e6);
+    uint64_t passes = 0;
+    uint64_t in_tolerance = 0;
+    double sum_squared_error = 0;
+    double max_error = 0;
+
+    while (hal_host_time_us() < end_us) {
+        controller_loop();
+
+        double error = std::abs(plant.voltage(hal_host_time_us() * 1e-6) - q16_to_volts(selected_setpoint));
+        sum_squared_error += error * error;
+        max_error = std::max(max_error, error);
+        in_tolerance += (error <= q16_to_volts(tolerance));
+        passes++;
+    }
+
+    double rms_error = passes ? std::sqrt(sum_squared_error / passes) : 0;
+
+    std::cout << "\n--- HOST SIMULATION ---" << std::endl;
+    std::cout << "Mode               : " << mode << std::endl;
+    std::cout << "Phase / drift      : " << plant.config().phase << " rad, " << plant.config().drift << " rad/s";
+    if (plant.config().drift_ramp != 0) {
+        std::cout << " ramping " << plant.config().drift_ramp << " rad/s^2";
+    }
+    std::cout << std::endl;
+    std::cout << "Selected setpoint  : " << q16_to_volts(selected_setpoint) << " V (null " << q16_to_volts(null_setpoint)
+              << ", peak " << q16_to_volts(peak_setpoint) << ", quad " << q16_to_volts(quad_setpoint) << ")" << std::endl;
+    std::cout << "Boot to setup done : " << (lock_us - boot_us) / 1000.0 << " ms simulated" << std::endl;
+    std::cout << "Lock acquisition   : " << (lock_us - stats.first_dac_us) / 1000.0 << " ms simulated" << std::endl;
+    std::cout << "Acquisition steps  : " << acquire_dac_writes << " DAC writes, " << acquire_adc_reads << " ADC reads" << std::endl;
+    std::cout << "Tracking           : " << passes << " loop passes over " << seconds << " s" << std::endl;
+    std::cout << "Tracking steps     : " << stats.dac_writes - acquire_dac_writes << " DAC writes, "
+              << stats.adc_reads - acquire_adc_reads << " ADC reads" << std::endl;
+    std::cout << "Error RMS / max    : " << rms_error << " V / " << max_error << " V" << std::endl;
+    std::cout << "In tolerance       : " << (passes ? 100.0 * in_tolerance / passes : 0) << " %" << std::endl;
+    print_plant(plant);
+    if (rail_stats.wraps || rail_stats.searches) {
+        std::cout << "Rail edges         : " << rail_stats.wraps << " wrapped, " << rail_stats.searches << " searched, recovery max "
+                  << rail_stats.max_ms << " ms, last " << rail_stats.last_ms << " ms" << std::endl;
+    }
+    if (drift_tracker_enabled && drift_tracker.valid) {
+        double true_rate = plant.drift_rate(hal_host_time_us() * 1e-6) * plant.config().v_pi_steps / M_PI;
+        std::cout << "Drift tracker      : " << drift_tracker.rate << " steps/s estimated, " << -true_rate << " true, "
+                  << drift_tracker.updates << " updates, " << drift_tracker.rejected << " gated out" << std::endl;
+    }
+    if (auto_tune_enabled) {
+        std::cout << "Auto tuning        : tolerance " << q16_to_volts(tolerance) << " V, buffers " << quad_buffer << " quad / "
+                  << null_buffer << " null / " << peak_buffer << " peak, noise " << q16_to_volts(noise_estimator_sigma(&noise_estimator, 1))
+                  << " V per sample estimated, " << plant.config().noise << " true" << std::endl;
+    }
+    if (control_tick_stats.rate_hz) {
+        std::cout << "Control ticks      : " << control_tick_stats.ticks << " at " << control_tick_stats.rate_hz << " Hz, "
+                  << control_tick_stats.overruns << " overruns, busy max " << control_tick_stats.busy_max_us << " us" << std::endl;
+    }
+
+    return passes > 0 && 100.0 * in_tolerance >= min_inside * passes;
+}
+
+//Track, then optionally power cycle and track again
+template <class P>
+static bool run(P& plant, unsigned int pin, const std::string& mode, const std::string& commands, double seconds, double kick,
+                double reboot, double min_inside) {
+    hal_host_attach(&plant);
+    hal_host_set_pin(pin, true);
+    hal_host_queue_input(commands);
+    hal_host_set_deadline_us(static_cast<uint64_t>((SIM_TIMEOUT_S + 2 * seconds) * 1e6));
+
+    bool held = boot_and_track(plant, mode, seconds, kick, min_inside);
+
+    if (!std::isnan(reboot)) {
+        control_tick_stop();
+        hal_host_power_cycle();
+        plant.shift_phase(reboot);
+        hal_host_set_pin(pin, true);
+
+        std::cout << "\n--- POWER CYCLE (phase moved " << reboot << " rad) ---" << std::endl;
+        held = boot_and_track(plant, mode, seconds, 0, min_inside) && held;
+    }
+
+    return held;
+}
+
+int main(int argc, char** argv) {
+    MzmPlantConfig config;
+    std::string mode = "null";
+    std::string commands;
+    std::string plant_model = "mzm";
+    double seconds = 60;
+    double kick = 0;
+    double reboot = NAN;
+    double min_inside = 100;
+    uint32_t seed = 1;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string key = argv[i];
+        const char* value = argv[i + 1];
+
+        if (key == "--mode") mode = value;
+        else if (key == "--phase") config.phase = std::atof(value);
+        else if (key == "--drift") config.drift = std::atof(value);
+        else if (key == "--ramp") config.drift_ramp = std::atof(value);
+        else if (key == "--noise") config.noise = std::atof(value);
+        else if (key == "--vpi") config.v_pi_steps = std::atof(value);
+        else if (key == "--kick") kick = std::atof(value);
+        else if (key == "--seconds") seconds = std::atof(value);
+        else if (key == "--seed") seed = static_cast<uint32_t>(std::atoi(value));
+        else if (key == "--cmd") commands += std::string(value) + "\n";
+        else if (key == "--reboot") reboot = std::atof(value);
+        else if (key == "--plant") plant_model = value;
+        else if (key == "--min-inside") min_inside = std::atof(value);
+        else {
+            std::cerr << "Unknown option: " << key << std::endl;
+            return 1;
+        }
+    }
+
+    unsigned int pin = NULL_PIN;
+    if (mode == "peak") pin = PEAK_PIN;
+    else if (mode == "quad+") pin = QUAD_PLUS_PIN;
+    else if (mode == "quad-") pin = QUAD_MINUS_PIN;
+
+    if (plant_model == "physical") {
+        PhysicalPlantConfig physical;
+        physical.phase = config.phase;
+        physical.drift = config.drift;
+        physical.drift_ramp = config.drift_ramp;
+        physical.noise = config.noise;
+        physical.v_pi_steps = config.v_pi_steps;
+
+        PhysicalPlant plant(physical, seed);
+        return run(plant, pin, mode, commands, seconds, kick, reboot, min_inside) ? 0 : 1;
+    }
+    if (plant_model != "mzm") {
+        std::cerr << "Unknown plant: " << plant_model << std::endl;
+        return 1;
+    }
+
+    MzmPlant plant(config, seed);
+    return run(plant, pin, mode, commands, seconds, kick, reboot, min_inside) ? 0 : 1;
+}
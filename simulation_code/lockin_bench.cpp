@@ -0,0 +1,83 @@
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "../bias_controller_pico/bias_controller_pico.h"
+#include "../bias_controller_pico/lockin.h"
+#include "hal_host.hpp"
+#include "mzm_plant.hpp"
+
+/*
+Convergence of the dither lock-in (process_lockin) against the GAIN-step hill climbers (process_null,
+process_peak) on the simulated MZM. Each run sweeps, locks, then applies a phase step to the plant and
+times how long the algorithm takes to bring the bias back, in simulated time and DAC writes.
+Residual is the noise free distance from the true extremum once the algorithm returns.
+*/
+
+#define BENCH_SEEDS 5
+
+struct Result {
+    double ms = 0;
+    double dac_writes = 0;
+    double residual = 0;
+};
+
+Result run(enum setPoint mode, double kick, uint32_t seed) {
+    MzmPlantConfig config;
+    MzmPlant plant(config, seed);
+
+    hal_host_reset();
+    hal_host_attach(&plant);
+
+    set_point = mode;
+    sweep();
+    go_to_desired_setpoint();
+
+    plant.shift_phase(kick);
+    hal_host_set_deadline_us(hal_host_time_us() + 600 * 1000000ull);
+
+    uint64_t start_us = hal_host_time_us();
+    uint64_t start_writes = hal_host_stats().dac_writes;
+    current_input_voltage = read_voltage();
+
+    if (mode == NULL_LOCKIN || mode == PEAK_LOCKIN) process_lockin();
+    else if (mode == NULL_POINT) process_null();
+    else process_peak();
+
+    double t = hal_host_time_us() * 1e-6;
+    double extremum = (mode == NULL_POINT || mode == NULL_LOCKIN) ? config.offset : config.offset + config.amplitude;
+
+    Result result;
+    result.ms = (hal_host_time_us() - start_us) / 1000.0;
+    result.dac_writes = static_cast<double>(hal_host_stats().dac_writes - start_writes);
+    result.residual = std::abs(plant.voltage(t) - extremum);
+    return result;
+}
+
+int main() {
+    const double kicks[] = {0.2, 0.4, 0.8};
+    const struct { enum setPoint mode; const char* name; } modes[] = {
+        {NULL_POINT, "null hill"}, {NULL_LOCKIN, "null lock-in"},
+        {PEAK_POINT, "peak hill"}, {PEAK_LOCKIN, "peak lock-in"},
+    };
+
+    std::cout << std::left << std::setw(14) << "algorithm" << std::setw(10) << "kick rad"
+              << std::setw(14) << "time ms" << std::setw(14) << "DAC writes" << "residual V" << std::endl;
+
+    for (const auto& m : modes) {
+        for (double kick : kicks) {
+            Result mean;
+            for (uint32_t seed = 1; seed <= BENCH_SEEDS; seed++) {
+                Result r = run(m.mode, kick, seed);
+                mean.ms += r.ms / BENCH_SEEDS;
+                mean.dac_writes += r.dac_writes / BENCH_SEEDS;
+                mean.residual += r.residual / BENCH_SEEDS;
+            }
+            std::cout << std::left << std::setw(14) << m.name << std::setw(10) << kick
+                      << std::setw(14) << mean.ms << std::setw(14) << mean.dac_writes << mean.residual << std::endl;
+        }
+    }
+
+    return 0;
+}
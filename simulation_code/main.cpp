@@ -48,7 +48,7 @@ public:
         y_values.clear();
 
         // Number of steps for 16-bit resolution (65536 steps)
-        size_t num_steps = MAX_VOLTAGE;
+        size_t num_steps = MAX_VOLTAGE + 1;
 
         // Calculate step size based on x range and number of steps
         double step_size = (x_end - x_start) / (num_steps - 1);
@@ -253,7 +253,7 @@ void detectQuads(const std::vector<double>& resultArray) {
 
 
 void scanPWM() {
-    std::vector<double> resultArray(MAX_VOLTAGE);  // 16-bit resolution, range 0-MAX_VOLTAGE
+    std::vector<double> resultArray(MAX_VOLTAGE + 1);  // 16-bit resolution, range 0-MAX_VOLTAGE
 
     // Scan through all possible PWM values in the 16-bit range
     for (int pwm_value = 0; pwm_value <= MAX_VOLTAGE; pwm_value++) {
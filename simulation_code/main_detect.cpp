@@ -0,0 +1,40 @@
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "main_detect.hpp"
+
+//The standard headers main.cpp includes are already in, so only its own code lands in the namespace
+#define main simulation_main
+namespace simulation {
+#include "main.cpp"
+}
+#undef main
+
+namespace simulation {
+
+void load_curve(const std::vector<double>& volts) {
+    SineWaveData::x_values.resize(volts.size());
+    for (size_t i = 0; i < volts.size(); i++) {
+        SineWaveData::x_values[i] = static_cast<double>(i);
+    }
+    SineWaveData::y_values = volts;
+    SineWaveData::last_accessed_index = 0;
+}
+
+void reset_detected() {
+    peak_setpoint = null_setpoint = quad_setpoint = 0;
+    peak_index = null_index = quad_plus_index = quad_minus_index = quad_index = 0;
+}
+
+Detected detected() {
+    Detected d;
+    d.peak = peak_index;
+    d.null = null_index;
+    d.quad_plus = quad_plus_index;
+    d.quad_minus = quad_minus_index;
+    return d;
+}
+
+}
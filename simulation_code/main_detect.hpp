@@ -0,0 +1,30 @@
+#pragma once
+
+#include <vector>
+
+/*
+The detection code of the original simulation (main.cpp), built into the benchmarks through main_detect.cpp.
+main.cpp keeps its globals and macros, which clash with the firmware's, so it is compiled on its own inside
+namespace simulation and only these wrappers are visible.
+*/
+
+namespace simulation {
+
+struct Detected {
+    int peak = 0;              //Index of the first peak, 0 when none was found
+    int null = 0;
+    int quad_plus = 0;
+    int quad_minus = 0;
+};
+
+void load_curve(const std::vector<double>& volts);     //Detector voltage at each of main.cpp's 65535 DAC steps
+void reset_detected();                                  //Clear the indexes before a detection
+Detected detected();
+
+//main.cpp's functions as they are, results in its globals (see detected())
+void detectPeaks(const std::vector<double>& resultArray);
+void detectNulls(const std::vector<double>& resultArray);
+void detectQuads(const std::vector<double>& resultArray);
+void scanPWM();                 //Scan the loaded curve, then the three above
+
+}
@@ -0,0 +1,397 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "../bias_controller_pico/bias_controller_pico.h"
+#include "hal_host.hpp"
+#include "mzm_plant.hpp"
+#include "sim_trial.hpp"
+
+/*
+Monte Carlo search for tolerance, quad_buffer, null_buffer and peak_buffer.
+
+Every candidate setting is run by the firmware (bias_controller_pico.c built with BIAS_HOST_BUILD) on the
+same set of randomized plants: phase drawn uniformly as in main.cpp, noise, drift and Vpi uniformly over
+the ranges below, setpoint mode uniformly from the four jumpers. A trial boots the controller on the
+plant, lets it lock, kicks the plant phase by --kick rad (random sign) and tracks for --seconds. Lock time is
+from the kick until the noise free output is inside the candidate's tolerance, residual the RMS of the
+noise free output against the setpoint from then on. A trial that never gets inside counts as --seconds.
+
+A wide tolerance locks at once and sits far off the setpoint, a tight one the other way round, so the
+result is the Pareto front of mean lock time against mean residual. The default settings always run as
+candidate 0 for reference. The point of the front nearest the ideal corner (both metrics scaled to the
+front's range) is written out as a console script.
+
+The firmware keeps its state in globals, so the trials run in processes: one fork server per pool thread,
+started before the threads, which forks a fresh child for each trial (sim_trial.hpp). The threads take
+trials from their own deque and steal from the others' when it runs dry. Plants and candidates come from
+--seed alone and every trial is deterministic, so the result does not depend on the thread count or the
+scheduling.
+
+GAIN is a compile time constant of the firmware and is not searched.
+
+USAGE: monte_carlo_tuner [--candidates n] [--plants n] [--seed n] [--threads n] [--seconds s] [--kick rad]
+                         [--rate Hz] [--script file]
+*/
+
+//Plant ranges
+#define PHASE_MIN    (-M_PI)
+#define PHASE_MAX    M_PI
+#define NOISE_MIN    0.001
+#define NOISE_MAX    0.02
+#define DRIFT_MAX    0.02                  //rad/s either way
+#define VPI_MIN      20000.0
+#define VPI_MAX      30000.0
+
+//Search ranges, from the SUGGESTED RANGE block of bias_controller_pico.c
+#define TOLERANCE_MIN     0.0032
+#define TOLERANCE_MAX     0.1
+#define QUAD_BUFFER_MIN   5
+#define QUAD_BUFFER_MAX   100
+#define HILL_BUFFER_MIN   25
+#define HILL_BUFFER_MAX   500
+
+struct Candidate {
+    double tolerance = 0.05;
+    int quad_buffer = 10;
+    int null_buffer = 50;
+    int peak_buffer = 50;
+};
+
+struct PlantCase {
+    MzmPlantConfig config;
+    enum setPoint mode;
+    double kick;
+    uint32_t seed;
+};
+
+//What a fork server is sent and sends back, plain bytes over a pipe
+struct Trial {
+    Candidate candidate;
+    PlantCase plant;
+    double seconds;
+    int rate;
+};
+
+struct TrialResult {
+    double lock_ms;
+    double residual_v;
+    bool locked;
+    bool finished;                         //False if the trial crashed or timed out
+};
+
+//Runs in a fresh child, the firmware state is whatever a boot leaves
+static TrialResult run_trial(const Trial& trial) {
+    MzmPlant plant(trial.plant.config, trial.plant.seed);
+    TrialResult result = {};
+    SimErrorAccumulator residual;
+
+    hal_host_attach(&plant);
+    hal_host_queue_input("set rate " + std::to_string(trial.rate) + "\n");
+
+    //Nothing in flash, so the boot keeps these
+    tolerance = volts_to_q16(static_cast<float>(trial.candidate.tolerance));
+    quad_buffer = trial.candidate.quad_buffer;
+    null_buffer = trial.candidate.null_buffer;
+    peak_buffer = trial.candidate.peak_buffer;
+
+    sim_boot(trial.plant.mode, trial.seconds);
+    plant.shift_phase(trial.plant.kick);
+
+    uint64_t kick_us = hal_host_time_us();
+    result.lock_ms = trial.seconds * 1000;
+
+    sim_track(trial.seconds, [&](double t) {
+        double error = sim_error(plant.voltage(t));
+        if (!result.locked && sim_inside(error)) {
+            result.locked = true;
+            result.lock_ms = (hal_host_time_us() - kick_us) / 1000.0;
+        }
+        if (result.locked) residual.add(error);
+    });
+
+    result.residual_v = residual.rms();
+    result.finished = true;
+    return result;
+}
+
+struct ForkServer {
+    pid_t pid;
+    int trial_fd;                          //Parent writes trials here
+    int result_fd;                         //And reads the results
+};
+
+//Started before any thread exists. The server closes the pipe ends of the servers started before it, or
+//they would never see end of file.
+static ForkServer start_server(const std::vector<ForkServer>& started) {
+    int to_server[2], from_server[2];
+
+    if (pipe(to_server) != 0 || pipe(from_server) != 0) {
+        std::perror("pipe");
+        std::exit(1);
+    }
+
+    std::fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        for (const ForkServer& s : started) {
+            close(s.trial_fd);
+            close(s.result_fd);
+        }
+        close(to_server[1]);
+        close(from_server[0]);
+        if (!std::freopen("/dev/null", "w", stdout)) _exit(1);   //Controller console output
+
+        Trial trial;
+        while (sim_read_full(to_server[0], &trial, sizeof(trial))) {
+            TrialResult result = sim_run_isolated<TrialResult>([&] { return run_trial(trial); });
+            if (!sim_write_full(from_server[1], &result, sizeof(result))) break;
+        }
+        _exit(0);
+    }
+
+    close(to_server[0]);
+    close(from_server[1]);
+    return ForkServer{pid, to_server[1], from_server[0]};
+}
+
+//Work stealing: each thread pops from the back of its own deque, an idle one takes from the front of the others
+class TrialPool {
+public:
+    explicit TrialPool(size_t threads) : queues_(threads) {}
+
+    void push(size_t queue, size_t trial) {
+        queues_[queue].trials.push_back(trial);
+    }
+
+    bool take(size_t self, size_t& trial) {
+        {
+            Queue& own = queues_[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.trials.empty()) {
+                trial = own.trials.back();
+                own.trials.pop_back();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < queues_.size(); i++) {
+            Queue& victim = queues_[(self + i) % queues_.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.trials.empty()) {
+                trial = victim.trials.front();
+                victim.trials.pop_front();
+                steals_++;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t steals() const {
+        return steals_;
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<size_t> trials;
+    };
+
+    std::deque<Queue> queues_;
+    std::atomic<size_t> steals_{0};
+};
+
+struct Score {
+    double lock_ms = 0;
+    double residual_v = 0;
+    double locked = 0;                     //Fraction of the plants
+    bool pareto = false;
+};
+
+static double log_uniform(std::mt19937& gen, double lo, double hi) {
+    return std::exp(std::uniform_real_distribution<>(std::log(lo), std::log(hi))(gen));
+}
+
+static int log_uniform_int(std::mt19937& gen, int lo, int hi) {
+    return std::min(hi, static_cast<int>(std::lround(log_uniform(gen, lo, hi))));
+}
+
+int main(int argc, char** argv) {
+    int candidate_count = 64;
+    int plant_count = 32;
+    uint32_t seed = 1;
+    int threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    double seconds = 20;
+    double kick = 0.5;
+    int rate = 100;
+    std::string script_path;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string key = argv[i];
+        const char* value = argv[i + 1];
+
+        if (key == "--candidates") candidate_count = std::max(1, std::atoi(value));
+        else if (key == "--plants") plant_count = std::max(1, std::atoi(value));
+        else if (key == "--seed") seed = static_cast<uint32_t>(std::atoi(value));
+        else if (key == "--threads") threads = std::max(1, std::atoi(value));
+        else if (key == "--seconds") seconds = std::atof(value);
+        else if (key == "--kick") kick = std::atof(value);
+        else if (key == "--rate") rate = std::atoi(value);
+        else if (key == "--script") script_path = value;
+        else {
+            std::cerr << "Unknown option: " << key << std::endl;
+            return 1;
+        }
+    }
+
+    //Plants and candidates from the seed alone
+    std::mt19937 gen(seed);
+    std::vector<PlantCase> plants(plant_count);
+    std::vector<Candidate> candidates(candidate_count);
+    const enum setPoint modes[] = {NULL_POINT, PEAK_POINT, QUAD_PLUS, QUAD_MINUS};
+
+    for (PlantCase& p : plants) {
+        p.config.phase = std::uniform_real_distribution<>(PHASE_MIN, PHASE_MAX)(gen);
+        p.config.noise = std::uniform_real_distribution<>(NOISE_MIN, NOISE_MAX)(gen);
+        p.config.drift = std::uniform_real_distribution<>(-DRIFT_MAX, DRIFT_MAX)(gen);
+        p.config.v_pi_steps = std::uniform_real_distribution<>(VPI_MIN, VPI_MAX)(gen);
+        p.mode = modes[std::uniform_int_distribution<>(0, 3)(gen)];
+        p.kick = std::bernoulli_distribution(0.5)(gen) ? kick : -kick;
+        p.seed = static_cast<uint32_t>(gen());
+    }
+    for (size_t c = 1; c < candidates.size(); c++) {       //0 keeps the defaults
+        candidates[c].tolerance = log_uniform(gen, TOLERANCE_MIN, TOLERANCE_MAX);
+        candidates[c].quad_buffer = log_uniform_int(gen, QUAD_BUFFER_MIN, QUAD_BUFFER_MAX);
+        candidates[c].null_buffer = log_uniform_int(gen, HILL_BUFFER_MIN, HILL_BUFFER_MAX);
+        candidates[c].peak_buffer = log_uniform_int(gen, HILL_BUFFER_MIN, HILL_BUFFER_MAX);
+    }
+
+    size_t trial_count = candidates.size() * plants.size();
+    std::vector<TrialResult> results(trial_count);
+    std::vector<ForkServer> servers;
+
+    for (int t = 0; t < threads; t++) servers.push_back(start_server(servers));
+
+    TrialPool pool(threads);
+    for (size_t i = 0; i < trial_count; i++) pool.push(i % threads, i);
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            size_t i;
+            while (pool.take(t, i)) {
+                Trial trial = {candidates[i / plants.size()], plants[i % plants.size()], seconds, rate};
+                if (!sim_write_full(servers[t].trial_fd, &trial, sizeof(trial)) ||
+                    !sim_read_full(servers[t].result_fd, &results[i], sizeof(results[i]))) {
+                    results[i] = TrialResult();
+                }
+            }
+        });
+    }
+    for (std::thread& w : workers) w.join();
+    for (ForkServer& s : servers) {
+        close(s.trial_fd);
+        close(s.result_fd);
+        waitpid(s.pid, nullptr, 0);
+    }
+
+    //Means over the plants, an unfinished trial counts as never locked
+    std::vector<Score> scores(candidates.size());
+    size_t unfinished = 0;
+
+    for (size_t c = 0; c < candidates.size(); c++) {
+        double residual_sum = 0;
+        int residual_n = 0;
+
+        for (size_t p = 0; p < plants.size(); p++) {
+            const TrialResult& r = results[c * plants.size() + p];
+            unfinished += !r.finished;
+            bool locked = r.finished && r.locked;
+            scores[c].lock_ms += (locked ? r.lock_ms : seconds * 1000) / plants.size();
+            scores[c].locked += locked / static_cast<double>(plants.size());
+            if (locked && !std::isnan(r.residual_v)) {
+                residual_sum += r.residual_v;
+                residual_n++;
+            }
+        }
+        scores[c].residual_v = residual_n ? residual_sum / residual_n : INFINITY;
+    }
+
+    //Pareto front: no other candidate is at least as good on both and better on one
+    std::vector<size_t> front;
+    for (size_t a = 0; a < scores.size(); a++) {
+        bool dominated = false;
+        for (size_t b = 0; b < scores.size() && !dominated; b++) {
+            dominated = scores[b].lock_ms <= scores[a].lock_ms && scores[b].residual_v <= scores[a].residual_v &&
+                        (scores[b].lock_ms < scores[a].lock_ms || scores[b].residual_v < scores[a].residual_v);
+        }
+        if (!dominated && std::isfinite(scores[a].residual_v)) {
+            scores[a].pareto = true;
+            front.push_back(a);
+        }
+    }
+    std::sort(front.begin(), front.end(), [&](size_t a, size_t b) { return scores[a].lock_ms < scores[b].lock_ms; });
+
+    std::printf("%zu candidates x %zu plants = %zu trials on %d threads, %zu stolen, %zu unfinished, seed %u\n\n",
+                candidates.size(), plants.size(), trial_count, threads, pool.steals(), unfinished, seed);
+    std::printf("%-6s%-12s%-8s%-8s%-8s%-12s%-14s%s\n", "cand", "tolerance", "quad", "null", "peak", "lock ms", "residual mV", "locked");
+
+    auto print_row = [&](size_t c) {
+        std::printf("%-6zu%-12.4f%-8d%-8d%-8d%-12.0f%-14.2f%.0f%%%s\n", c, candidates[c].tolerance, candidates[c].quad_buffer,
+                    candidates[c].null_buffer, candidates[c].peak_buffer, scores[c].lock_ms, scores[c].residual_v * 1000,
+                    scores[c].locked * 100, c == 0 ? "  (defaults)" : "");
+    };
+    for (size_t c : front) print_row(c);
+    if (!scores[0].pareto) {
+        std::printf("not on the front:\n");
+        print_row(0);
+    }
+    if (front.empty()) {
+        std::printf("\nNo candidate locked on any plant\n");
+        return 1;
+    }
+
+    //Knee: nearest the ideal corner with both metrics scaled to the front's range
+    double lock_lo = scores[front.front()].lock_ms, lock_hi = scores[front.back()].lock_ms;
+    double res_lo = INFINITY, res_hi = 0;
+    for (size_t c : front) {
+        res_lo = std::min(res_lo, scores[c].residual_v);
+        res_hi = std::max(res_hi, scores[c].residual_v);
+    }
+    size_t knee = front.front();
+    double best = INFINITY;
+    for (size_t c : front) {
+        double x = lock_hi > lock_lo ? (scores[c].lock_ms - lock_lo) / (lock_hi - lock_lo) : 0;
+        double y = res_hi > res_lo ? (scores[c].residual_v - res_lo) / (res_hi - res_lo) : 0;
+        if (x * x + y * y < best) {
+            best = x * x + y * y;
+            knee = c;
+        }
+    }
+
+    char script[256];
+    std::snprintf(script, sizeof(script), "set tolerance %.4f\nset quad_buffer %d\nset null_buffer %d\nset peak_buffer %d\nsave\n",
+                  candidates[knee].tolerance, candidates[knee].quad_buffer, candidates[knee].null_buffer, candidates[knee].peak_buffer);
+
+    std::printf("\nKnee of the front: candidate %zu\n", knee);
+    if (script_path.empty()) {
+        std::printf("%s", script);
+    } else {
+        std::ofstream(script_path) << script;
+        std::printf("Console script written to %s\n", script_path.c_str());
+    }
+
+    return 0;
+}
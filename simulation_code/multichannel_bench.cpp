@@ -0,0 +1,142 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "../bias_controller_pico/bias_controller_pico.h"
+#include "../bias_controller_pico/control_tick.h"
+#include "hal_host.hpp"
+#include "mzm_plant.hpp"
+#include "sim_trial.hpp"
+
+/*
+Multi-channel control on the simulated MZMs: one plant per channel, each with its own phase, drift and
+setpoint mode, run by the firmware (bias_controller_pico.c built with BIAS_HOST_BUILD) for 1 to
+CONTROLLER_CHANNELS channels at a few control rates. Reports the aggregate update rate (ticks x channels),
+the ADC samples each channel gets per read, tick load, and every channel's tracking error.
+
+Each configuration runs in a forked child (sim_trial.hpp) so it boots a fresh controller with empty flash.
+
+USAGE: multichannel_bench [--seconds s] [--noise V] [--seed n]
+*/
+
+extern "C" int tick_samples(void);     //ADC samples per channel and tick, bias_controller_pico.c
+
+struct ChannelSetup {
+    enum setPoint mode;
+    const char* name;
+    double phase;
+    double drift;
+};
+
+static const ChannelSetup setups[CONTROLLER_CHANNELS] = {
+    {QUAD_PLUS, "quad+", -1.45, 0.02},
+    {NULL_POINT, "null", -0.6, -0.015},
+    {QUAD_MINUS, "quad-", 0.4, 0.01},
+};
+
+//Sent back by each configuration's child
+struct RunResult {
+    bool finished;
+    double updates;                    //Channel updates per second
+    int samples;                       //ADC samples per channel and tick
+    uint32_t busy_max_us;
+    uint32_t overruns;
+    double setup_ms;
+    double rms_v[CONTROLLER_CHANNELS];
+    double inside[CONTROLLER_CHANNELS];
+};
+
+//One configuration, in the child
+static RunResult run(int channels, int rate, double seconds, double noise, uint32_t seed) {
+    const unsigned int pins[CONTROLLER_CHANNELS] = CHANNEL_PWM_PINS;
+    MzmPlant* plants[CONTROLLER_CHANNELS] = {};
+    SimErrorAccumulator error[CONTROLLER_CHANNELS];
+    RunResult result = {};
+
+    for (int i = 0; i < channels; i++) {
+        MzmPlantConfig config;
+        config.phase = setups[i].phase;
+        config.drift = setups[i].drift;
+        config.noise = noise;
+        plants[i] = new MzmPlant(config, seed + i);
+        hal_host_attach_channel(i, pins[i], plants[i]);
+    }
+
+    //Channel 0 takes its mode from the jumper, the others from their settings
+    channel_count = channels;
+    hal_host_queue_input("set rate " + std::to_string(rate) + "\n");
+    for (int i = 1; i < channels; i++) {
+        channel_select(i);
+        set_point = setups[i].mode;
+    }
+    channel_select(0);
+
+    sim_boot(setups[0].mode, seconds);
+    result.setup_ms = hal_host_time_us() / 1000.0;
+
+    sim_track(seconds, [&](double t) {
+        for (int i = 0; i < channels; i++) {
+            channel_select(i);
+            error[i].add(sim_error(plants[i]->voltage(t)));
+        }
+        channel_select(0);
+    });
+
+    result.updates = static_cast<double>(control_tick_stats.ticks) * channels / seconds;
+    result.samples = tick_samples();
+    result.busy_max_us = control_tick_stats.busy_max_us;
+    result.overruns = control_tick_stats.overruns;
+    for (int i = 0; i < channels; i++) {
+        result.rms_v[i] = error[i].rms();
+        result.inside[i] = error[i].inside_share();
+    }
+    result.finished = true;
+    return result;
+}
+
+int main(int argc, char** argv) {
+    double seconds = 30;
+    double noise = 0.005;
+    uint32_t seed = 1;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string key = argv[i];
+        const char* value = argv[i + 1];
+
+        if (key == "--seconds") seconds = std::atof(value);
+        else if (key == "--noise") noise = std::atof(value);
+        else if (key == "--seed") seed = static_cast<uint32_t>(std::atoi(value));
+        else {
+            std::cerr << "Unknown option: " << key << std::endl;
+            return 1;
+        }
+    }
+
+    const int rates[] = {100, 1000};
+
+    std::printf("%-9s%-9s%-12s%-10s%-10s%-10s%-10s  %s\n", "channels", "rate Hz", "updates/s", "samples", "busy us",
+                "overruns", "setup ms", "per channel: mode, error RMS, in tolerance");
+    std::fflush(stdout);
+
+    for (int rate : rates) {
+        for (int channels = 1; channels <= CONTROLLER_CHANNELS; channels++) {
+            RunResult r = sim_run_isolated<RunResult>([&] { return run(channels, rate, seconds, noise, seed); });
+
+            if (!r.finished) {
+                std::printf("%-9d%-9d%s\n", channels, rate, "did not finish");
+                continue;
+            }
+            std::printf("%-9d%-9d%-12.0f%-10d%-10lu%-10lu%-10.0f", channels, rate, r.updates, r.samples,
+                        (unsigned long)r.busy_max_us, (unsigned long)r.overruns, r.setup_ms);
+            for (int i = 0; i < channels; i++) {
+                std::printf("  %s %.1f mV %.0f%%", setups[i].name, 1000 * r.rms_v[i], 100 * r.inside[i]);
+            }
+            std::printf("\n");
+            std::fflush(stdout);
+        }
+    }
+
+    return 0;
+}
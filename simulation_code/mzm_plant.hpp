@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <random>
+
+#include "plant.hpp"
+
+/*
+Simulated MZM + photodiode + ADC seen by the firmware through hal_host.cpp.
+
+Detector voltage = offset + amplitude * (1 + sin(pi * dac / v_pi_steps + phase)) / 2
+The defaults match hardware_tests/MZM_TRANSFER_CURVE/sweep_new_mzm.csv: ~2.0 V peak near DAC 25000,
+~0.013 V null near DAC 51000. The phase can drift in time to exercise the tracking loops, linearly or with
+a rate that itself ramps up like a thermal run-in.
+
+adc_bits rounds every sample to an ADC of that resolution (in 12-bit counts, so 10 bits is steps of 4). The
+mean of n rounded samples is still drawn directly: from the exact mean and variance of one rounded sample
+while the noise is under a couple of steps (where rounding biases the mean), from the uniform rounding
+noise on top of the Gaussian above that.
+*/
+
+struct MzmPlantConfig {
+    double v_pi_steps  = 26000;     //DAC steps for a pi phase change (half a period)
+    double amplitude   = 2.0;       //Peak minus null in volts at the ADC
+    double offset      = 0.013;     //Null level in volts at the ADC
+    double phase       = -1.45;     //Bias phase at DAC 0 in radians
+    double drift       = 0.0;       //Phase drift in radians per second
+    double drift_ramp  = 0.0;       //Change of the drift rate in radians per second^2
+    double noise       = 0.005;     //RMS noise per ADC sample in volts
+    int adc_bits       = 0;         //ADC resolution the samples are rounded to, 0 for unquantized samples
+};
+
+class MzmPlant : public Plant {
+public:
+    explicit MzmPlant(const MzmPlantConfig& config, uint32_t seed = 1)
+        : config_(config), gen_(seed), normal_(0.0, 1.0) {}
+
+    void set_dac(uint16_t level) override {
+        dac_ = level;
+    }
+
+    uint16_t dac() const {
+        return dac_;
+    }
+
+    //Step change of the bias phase, e.g. a thermal jump
+    void shift_phase(double radians) {
+        config_.phase += radians;
+    }
+
+    double phase(double t_seconds) const {
+        return config_.phase + config_.drift * t_seconds + config_.drift_ramp * t_seconds * t_seconds / 2;
+    }
+
+    //Noise free detector voltage at a DAC level and time
+    double voltage_at(double dac, double t_seconds) const {
+        double v = config_.offset + config_.amplitude * (1 + std::sin(M_PI * dac / config_.v_pi_steps + phase(t_seconds))) / 2;
+        return std::min(PLANT_ADC_MAX_VOLTAGE, std::max(0.0, v));
+    }
+
+    double voltage(double t_seconds) const override {
+        return voltage_at(dac_, t_seconds);
+    }
+
+    //Mean of n back to back ADC samples in counts. The average of n noisy samples is drawn directly.
+    float mean_counts(uint32_t n, double t_seconds) override {
+        if (n == 0) return 0.0f;
+        double counts = voltage(t_seconds) / PLANT_ADC_MAX_VOLTAGE * PLANT_ADC_STEPS;
+        double noise = config_.noise / PLANT_ADC_MAX_VOLTAGE * PLANT_ADC_STEPS;
+
+        if (config_.adc_bits > 0) {
+            double step = PLANT_ADC_STEPS / std::ldexp(1.0, config_.adc_bits);
+            double mean, variance;
+            rounded_moments(counts / step, noise / step, mean, variance);
+            counts = (mean + std::sqrt(variance / n) * normal_(gen_)) * step;
+            return static_cast<float>(std::min(PLANT_ADC_STEPS - step, std::max(0.0, counts)));
+        }
+
+        counts += noise / std::sqrt(static_cast<double>(n)) * normal_(gen_);
+        return static_cast<float>(std::min(PLANT_ADC_STEPS - 1.0, std::max(0.0, counts)));
+    }
+
+    //Phase drift rate at a time, radians per second
+    double drift_rate(double t_seconds) const {
+        return config_.drift + config_.drift_ramp * t_seconds;
+    }
+
+    const MzmPlantConfig& config() const {
+        return config_;
+    }
+
+private:
+    //Mean and variance of round(level + noise) for Gaussian noise, all in ADC steps
+    static void rounded_moments(double level, double sigma, double& mean, double& variance) {
+        if (sigma > 2.0) {
+            mean = level;
+            variance = sigma * sigma + 1.0 / 12;
+            return;
+        }
+        if (sigma <= 0.0) {
+            mean = std::round(level);
+            variance = 0.0;
+            return;
+        }
+
+        double sum = 0, sum_squared = 0;
+        for (double k = std::floor(level - 6 * sigma); k <= std::ceil(level + 6 * sigma); k++) {
+            double p = (std::erf((k + 0.5 - level) / (sigma * M_SQRT2)) - std::erf((k - 0.5 - level) / (sigma * M_SQRT2))) / 2;
+            sum += p * k;
+            sum_squared += p * k * k;
+        }
+        mean = sum;
+        variance = std::max(0.0, sum_squared - sum * sum);
+    }
+
+    MzmPlantConfig config_;
+    uint16_t dac_ = 0;
+    std::mt19937 gen_;
+    std::normal_distribution<> normal_;
+};
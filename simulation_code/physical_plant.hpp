@@ -0,0 +1,296 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "plant.hpp"
+
+/*
+Time stepped MZM bias loop for soak tests: what mzm_plant.hpp leaves ideal is modelled here, state is carried
+in virtual time and only evaluated where the firmware looks, so an hour of closed loop takes seconds.
+
+DAC:   the PWM level drives an RC filter (first order, rc_tau_s). The filter output is exact between DAC
+       writes, an exponential towards the new level, plus the steady state carrier ripple, exponential
+       segments up while the output is high and down while it is low (about 65536 * D * (1 - D) * T / tau
+       steps peak to peak at duty D). For the dithered mode use a 488 kHz carrier and a tenth of the tau.
+MZM:   offset + amplitude * (1 + J0(m) sin(x) + h2 J0(2m) sin(2x + p2) + h3 J0(3m) sin(3x + p3)) / 2 with
+       x = pi * dac / v_pi_steps + phase and m the RF drive in radians. RF averages the curve over its cycle
+       and so lowers the fringes, the extinction ratio drop of hardware_tests/RF_TEST. The harmonic
+       defaults are what capture_analyze fits to sweep_new_mzm.csv.
+Drift: phase = phase + drift * t + drift_ramp * t^2 / 2 + dc_drift * (1 - exp(-t / dc_drift_tau_s))
+       + thermal_coefficient * (T - ambient). The chip temperature T follows the ambient through
+       thermal_tau_s, the ambient swings sinusoidally (air conditioning) and random walks on top.
+Light: relative intensity noise of the laser as a first order (Ornstein-Uhlenbeck) process on the power.
+Noise: per sample photodiode and amplifier noise, sqrt(noise^2 + shot * volts), and the ADC's own noise.
+ADC:   12 bits, with the wide codes of the RP2040 ADC at 512, 1536, 2560 and 3584 (erratum RP2040-E11),
+       each adc_dnl_lsb wider than a step and the width taken from the ADC_DNL_SPREAD codes either side.
+
+A read of n samples is split into up to ADC_SUBWINDOWS sub windows across its capture time, each is
+converted with the exact mean and variance of the ADC transfer for its level and noise, and the mean of the n
+samples is drawn from those. A sub window that spans a carrier cycle takes its level as the mean over
+RIPPLE_PHASES points of the cycle, as the ADC's hundreds of samples per cycle would: one point per sub window
+aliases the ripple into a slow wander of the reading. Far from the wide codes with a step or more of noise the ADC mean is the level
+itself, so most reads cost a few transcendental functions.
+*/
+
+#define ADC_SUBWINDOWS     8        //Sub windows a capture is spread over (ripple and drift within it)
+#define RIPPLE_PHASES      8        //Points of the carrier cycle a sub window averages
+#define ADC_DNL_SPREAD     16       //Codes either side of a wide code that give up its extra width
+#define ADC_SAMPLE_S       2e-6     //RP2040 ADC free-running at 500 ksps
+#define THERMAL_STEP_S     1.0      //Largest step of the temperature model
+#define PWM_FULL_SCALE     65536.0
+
+struct PhysicalPlantConfig {
+    //MZM, as in mzm_plant.hpp
+    double v_pi_steps  = 26000;     //DAC steps for a pi phase change (half a period)
+    double amplitude   = 2.0;       //Peak minus null in volts at the ADC
+    double offset      = 0.013;     //Null level in volts at the ADC
+    double phase       = -1.45;     //Bias phase at DAC 0 in radians
+    double harmonic2   = 0.018;     //Second harmonic, fraction of the fundamental
+    double harmonic3   = 0.005;     //Third harmonic
+    double harmonic2_phase = 0.0;   //Radians
+    double harmonic3_phase = 0.0;
+    double rf_depth    = 0.0;       //RF drive in radians of optical phase, 0 without RF
+
+    //DAC
+    double rc_tau_s    = 0.1 / 11;  //RC filter time constant (DAC_SETTLE_MS over DAC_SETTLE_TAUS)
+    double carrier_hz  = 125e6 / PWM_FULL_SCALE;   //PWM carrier, 16-bit wrap at 125 MHz
+
+    //Drift
+    double drift       = 0.0;       //Phase drift in radians per second
+    double drift_ramp  = 0.0;       //Change of the drift rate in radians per second^2
+    double dc_drift    = 0.3;       //Settling of the bias after power up in radians
+    double dc_drift_tau_s = 1800;   //Time constant of that settling
+    double thermal_coefficient = 0.05;  //Radians per kelvin
+    double thermal_tau_s  = 300;    //Chip temperature lag behind the ambient
+    double ambient_swing  = 1.0;    //Kelvin, amplitude of the ambient cycle
+    double ambient_period_s = 1800; //Period of the ambient cycle
+    double ambient_walk   = 0.01;   //Kelvin per sqrt(second) random walk of the ambient
+
+    //Light and detector
+    double rin         = 0.002;     //Relative RMS fluctuation of the laser power
+    double rin_tau_s   = 0.5;       //Its correlation time
+    double noise       = 0.003;     //RMS noise floor per ADC sample in volts
+    double shot        = 1e-5;      //Shot noise, variance per sample in volts^2 per volt of signal
+
+    //ADC
+    double adc_noise_lsb = 1.5;     //RMS noise of the ADC itself, 12-bit steps
+    double adc_dnl_lsb   = 8.0;     //Extra width of the wide codes, 0 for an ideal ADC
+};
+
+class PhysicalPlant : public Plant {
+public:
+    explicit PhysicalPlant(const PhysicalPlantConfig& config, uint32_t seed = 1)
+        : config_(config), gen_(seed), normal_(0.0, 1.0), edge_(PLANT_ADC_STEPS + 1) {
+        //Lower edge of every code, the wide codes take their width from the neighbours
+        std::vector<double> width(PLANT_ADC_STEPS, 1.0);
+        for (int code : wide_codes()) {
+            width[code] += config_.adc_dnl_lsb;
+            for (int j = 1; j <= ADC_DNL_SPREAD; j++) {
+                width[code - j] -= config_.adc_dnl_lsb / (2 * ADC_DNL_SPREAD);
+                width[code + j] -= config_.adc_dnl_lsb / (2 * ADC_DNL_SPREAD);
+            }
+        }
+        edge_[0] = -0.5;
+        for (int c = 0; c < PLANT_ADC_STEPS; c++) edge_[c + 1] = edge_[c] + width[c];
+
+        fringe_[0] = std::cyl_bessel_j(0.0, config_.rf_depth);
+        fringe_[1] = config_.harmonic2 * std::cyl_bessel_j(0.0, 2 * config_.rf_depth);
+        fringe_[2] = config_.harmonic3 * std::cyl_bessel_j(0.0, 3 * config_.rf_depth);
+    }
+
+    //Brings the drift and intensity state up to t, hal_host.cpp calls it before every DAC write
+    void advance(double t_seconds) override {
+        double dt = t_seconds - now_;
+        if (dt <= 0) return;
+
+        //Laser power, exact for any step
+        double decay = std::exp(-dt / config_.rin_tau_s);
+        rin_ = rin_ * decay + config_.rin * std::sqrt(1 - decay * decay) * normal_(gen_);
+
+        //Ambient and chip temperature, in steps short against the thermal lag
+        while (thermal_time_ < t_seconds) {
+            double h = std::min(THERMAL_STEP_S, t_seconds - thermal_time_);
+            thermal_time_ += h;
+            walk_ += config_.ambient_walk * std::sqrt(h) * normal_(gen_);
+            double ambient = config_.ambient_swing * std::sin(2 * M_PI * thermal_time_ / config_.ambient_period_s) + walk_;
+            temperature_ += (ambient - temperature_) * (1 - std::exp(-h / config_.thermal_tau_s));
+        }
+
+        now_ = t_seconds;
+    }
+
+    void set_dac(uint16_t level) override {
+        filter_start_ = filter_at(now_);
+        filter_time_ = now_;
+        dac_ = level;
+
+        //Steady state ripple: the output rises for D * T towards full scale and falls for (1 - D) * T to zero
+        double duty = dac_ / PWM_FULL_SCALE;
+        double period = 1 / config_.carrier_hz;
+        double rise = std::exp(-duty * period / config_.rc_tau_s);
+        double fall = std::exp(-(1 - duty) * period / config_.rc_tau_s);
+        ripple_low_ = PWM_FULL_SCALE * (1 - rise) * fall / (1 - rise * fall);
+        ripple_high_ = ripple_low_ / fall;
+    }
+
+    uint16_t dac() const {
+        return dac_;
+    }
+
+    //Step change of the bias phase, e.g. a thermal jump
+    void shift_phase(double radians) {
+        config_.phase += radians;
+    }
+
+    double phase(double t_seconds) const {
+        return config_.phase + config_.drift * t_seconds + config_.drift_ramp * t_seconds * t_seconds / 2 +
+               config_.dc_drift * (1 - std::exp(-t_seconds / config_.dc_drift_tau_s)) +
+               config_.thermal_coefficient * temperature_;
+    }
+
+    //Phase drift rate at a time, radians per second, the temperature part from the current lag to the ambient
+    double drift_rate(double t_seconds) const {
+        double ambient = config_.ambient_swing * std::sin(2 * M_PI * thermal_time_ / config_.ambient_period_s) + walk_;
+        return config_.drift + config_.drift_ramp * t_seconds +
+               config_.dc_drift * std::exp(-t_seconds / config_.dc_drift_tau_s) / config_.dc_drift_tau_s +
+               config_.thermal_coefficient * (ambient - temperature_) / config_.thermal_tau_s;
+    }
+
+    //Noise free detector voltage at a bias level (DAC steps after the filter) and time
+    double voltage_at(double level, double t_seconds) const {
+        double x = M_PI * level / config_.v_pi_steps + phase(t_seconds);
+        double curve = 1 + fringe_[0] * std::sin(x) + fringe_[1] * std::sin(2 * x + config_.harmonic2_phase) +
+                       fringe_[2] * std::sin(3 * x + config_.harmonic3_phase);
+        double v = config_.offset + config_.amplitude * curve / 2;
+        return std::min(PLANT_ADC_MAX_VOLTAGE, std::max(0.0, v));
+    }
+
+    //Without ripple, intensity noise or detector noise, at the filtered DAC level
+    double voltage(double t_seconds) const override {
+        return voltage_at(filter_at(t_seconds), t_seconds);
+    }
+
+    float mean_counts(uint32_t n, double t_seconds) override {
+        if (n == 0) return 0.0f;
+        advance(t_seconds);
+
+        //The capture ends now and started n samples ago
+        uint32_t windows = std::min<uint32_t>(n, ADC_SUBWINDOWS);
+        double length = n * ADC_SAMPLE_S;
+        double gain = (1 + rin_) * PLANT_ADC_STEPS / PLANT_ADC_MAX_VOLTAGE;
+        int phases = length / windows * config_.carrier_hz >= 1 ? RIPPLE_PHASES : 1;
+        double sum = 0, sum_variance = 0;
+
+        for (uint32_t w = 0; w < windows; w++) {
+            double t = t_seconds - length * (1 - (w + 0.5) / windows);
+            double volts = 0;
+            for (int k = 0; k < phases; k++) {
+                double cycle = ((k + 0.5) / phases - 0.5) / config_.carrier_hz;
+                volts += voltage_at(filter_at(t) + ripple_at(t + cycle), t) / phases;
+            }
+            double sigma = std::sqrt(config_.noise * config_.noise + config_.shot * volts) * gain;
+            double mean, variance;
+
+            adc_moments(volts * gain, std::hypot(sigma, config_.adc_noise_lsb), mean, variance);
+            sum += mean;
+            sum_variance += variance;
+        }
+
+        double counts = sum / windows + std::sqrt(sum_variance / windows / n) * normal_(gen_);
+        return static_cast<float>(std::min(PLANT_ADC_STEPS - 1.0, std::max(0.0, counts)));
+    }
+
+    //Chip temperature against the mean ambient, kelvin
+    double temperature() const {
+        return temperature_;
+    }
+
+    //Peak to peak carrier ripple at the current DAC level, DAC steps
+    double ripple_steps() const {
+        return ripple_high_ - ripple_low_;
+    }
+
+    const PhysicalPlantConfig& config() const {
+        return config_;
+    }
+
+private:
+    static std::vector<int> wide_codes() {
+        return {512, 1536, 2560, 3584};
+    }
+
+    double filter_at(double t_seconds) const {
+        double elapsed = std::max(0.0, t_seconds - filter_time_);
+        return dac_ + (filter_start_ - dac_) * std::exp(-elapsed / config_.rc_tau_s);
+    }
+
+    //Ripple about the filter output (the mean of the carrier cycle, the duty times full scale)
+    double ripple_at(double t_seconds) const {
+        double duty = dac_ / PWM_FULL_SCALE;
+        double cycle = t_seconds * config_.carrier_hz;
+        double p = cycle - std::floor(cycle);
+        double v;
+
+        if (duty <= 0 || duty >= 1) return 0;
+        if (p < duty) v = PWM_FULL_SCALE + (ripple_low_ - PWM_FULL_SCALE) * std::exp(-p / (config_.carrier_hz * config_.rc_tau_s));
+        else v = ripple_high_ * std::exp(-(p - duty) / (config_.carrier_hz * config_.rc_tau_s));
+        return v - dac_;
+    }
+
+    //Probability that level + N(0, sigma) falls below the edge
+    static double below(double edge, double level, double sigma) {
+        return 0.5 * std::erfc((level - edge) / (sigma * M_SQRT2));
+    }
+
+    //Mean and variance of the code for a level and Gaussian noise, in steps
+    void adc_moments(double level, double sigma, double& mean, double& variance) const {
+        //Under a step of noise the rounding shows, sum over the codes that can come up
+        if (sigma < 1.0) {
+            int first = std::max(0, static_cast<int>(std::floor(level - 6 * sigma - config_.adc_dnl_lsb)) - 1);
+            int last = std::min(PLANT_ADC_STEPS - 1, static_cast<int>(std::ceil(level + 6 * sigma + config_.adc_dnl_lsb)) + 1);
+            double sum = 0, sum_squared = 0, total = 0;
+
+            for (int c = first; c <= last; c++) {
+                double p = sigma > 0 ? below(edge_[c + 1], level, sigma) - below(edge_[c], level, sigma)
+                                     : (level >= edge_[c] && level < edge_[c + 1]);
+                sum += p * c;
+                sum_squared += p * c * c;
+                total += p;
+            }
+            mean = total > 0 ? sum / total : std::round(level);
+            variance = total > 0 ? std::max(0.0, sum_squared / total - mean * mean) : 0.0;
+            return;
+        }
+
+        //Above it an even ADC averages to the level, the wide codes move the edges near them
+        mean = level;
+        variance = sigma * sigma + 1.0 / 12;
+        for (int code : wide_codes()) {
+            if (std::abs(level - code) > 6 * sigma + ADC_DNL_SPREAD + config_.adc_dnl_lsb) continue;
+            for (int c = code - ADC_DNL_SPREAD; c <= code + ADC_DNL_SPREAD + 1; c++) {
+                mean += below(c - 0.5, level, sigma) - below(edge_[c], level, sigma);
+            }
+        }
+    }
+
+    PhysicalPlantConfig config_;
+    std::mt19937 gen_;
+    std::normal_distribution<> normal_;
+    std::vector<double> edge_;          //Lower edge of each code, steps
+    double fringe_[3];                  //Harmonic amplitudes left by the RF drive
+
+    uint16_t dac_ = 0;
+    double filter_start_ = 0;           //Filter output at the last DAC write
+    double filter_time_ = 0;
+    double ripple_low_ = 0;             //Steady state carrier ripple limits, DAC steps
+    double ripple_high_ = 0;
+    double now_ = 0;
+    double thermal_time_ = 0;
+    double temperature_ = 0;            //Against the mean ambient
+    double walk_ = 0;
+    double rin_ = 0;
+};
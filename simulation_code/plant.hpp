@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+What hal_host.cpp drives: a DAC input and a detector read through the ADC. Implemented by the analytic
+model in mzm_plant.hpp, the time stepped one in physical_plant.hpp and by the recorded curve in
+capture_plant.hpp.
+*/
+
+#define PLANT_ADC_MAX_VOLTAGE 3.3
+#define PLANT_ADC_STEPS       4096
+
+class Plant {
+public:
+    virtual ~Plant() = default;
+
+    //Called with the virtual time before every DAC write, for plants whose state moves on in time
+    virtual void advance(double) {}
+
+    virtual void set_dac(uint16_t level) = 0;
+
+    //Noise free detector voltage at the current DAC level and time
+    virtual double voltage(double t_seconds) const = 0;
+
+    //Mean of n back to back ADC samples in counts
+    virtual float mean_counts(uint32_t n, double t_seconds) = 0;
+};
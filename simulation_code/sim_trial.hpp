@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../bias_controller_pico/bias_controller_pico.h"
+#include "hal_host.hpp"
+
+/*
+What the host tools that run the firmware as trials share: booting it on attached plants, tracking for a
+while with the output's error against the setpoint accumulated, and running each trial in a forked child
+(the firmware keeps its state in globals) that sends its result struct back down a pipe. A child that
+crashes or runs past its deadline (hal_host exits) reads back as a default constructed result.
+*/
+
+#define SIM_TIMEOUT_S 3600                 //Virtual seconds a boot may take before the run is abandoned
+
+inline unsigned int sim_mode_pin(enum setPoint mode) {
+    switch (mode) {
+        case PEAK_POINT: return PEAK_PIN;
+        case QUAD_PLUS: return QUAD_PLUS_PIN;
+        case QUAD_MINUS: return QUAD_MINUS_PIN;
+        default: return NULL_PIN;
+    }
+}
+
+//Boot with the jumper of mode set, after the plants are attached. The deadline leaves track_seconds after it.
+inline void sim_boot(enum setPoint mode, double track_seconds) {
+    hal_host_set_pin(sim_mode_pin(mode), true);
+    hal_host_set_deadline_us(static_cast<uint64_t>((SIM_TIMEOUT_S + track_seconds) * 1e6));
+    controller_setup();
+}
+
+//Output against the active channel's setpoint, volts
+inline double sim_error(double output_v) {
+    return output_v - q16_to_volts(selected_setpoint);
+}
+
+inline bool sim_inside(double error_v) {
+    return std::abs(error_v) <= q16_to_volts(tolerance);
+}
+
+//RMS of the error and the share of the passes inside tolerance
+struct SimErrorAccumulator {
+    double sum_squared = 0;
+    uint64_t passes = 0;
+    uint64_t inside = 0;
+
+    void add(double error_v) {
+        sum_squared += error_v * error_v;
+        inside += sim_inside(error_v);
+        passes++;
+    }
+
+    double rms() const { return passes ? std::sqrt(sum_squared / passes) : NAN; }
+    double inside_share() const { return passes ? static_cast<double>(inside) / passes : 0; }
+};
+
+//controller_loop() for seconds of virtual time, pass(t) after each with the virtual time in seconds
+template <typename Pass>
+inline void sim_track(double seconds, Pass pass) {
+    uint64_t end_us = hal_host_time_us() + static_cast<uint64_t>(seconds * 1e6);
+
+    while (hal_host_time_us() < end_us) {
+        controller_loop();
+        pass(hal_host_time_us() * 1e-6);
+    }
+}
+
+inline bool sim_read_full(int fd, void* data, size_t length) {
+    char* p = static_cast<char*>(data);
+    while (length > 0) {
+        ssize_t n = read(fd, p, length);
+        if (n <= 0) return false;
+        p += n;
+        length -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+inline bool sim_write_full(int fd, const void* data, size_t length) {
+    const char* p = static_cast<const char*>(data);
+    while (length > 0) {
+        ssize_t n = write(fd, p, length);
+        if (n <= 0) return false;
+        p += n;
+        length -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+//A trial running in its child, collected with sim_collect()
+struct SimChild {
+    pid_t pid = -1;
+    int fd = -1;
+};
+
+//Start trial() in a forked child with the controller's console output discarded. Its return value, a plain
+//struct, is what sim_collect() reads back.
+template <typename Trial>
+inline SimChild sim_fork(Trial trial) {
+    int fds[2];
+
+    if (pipe(fds) != 0) return SimChild();
+
+    std::fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        if (!std::freopen("/dev/null", "w", stdout)) _exit(1);
+        auto result = trial();
+        _exit(sim_write_full(fds[1], &result, sizeof(result)) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    if (pid < 0) {
+        close(fds[0]);
+        return SimChild();
+    }
+    return SimChild{pid, fds[0]};
+}
+
+template <typename Result>
+inline Result sim_collect(const SimChild& child) {
+    Result result = Result();
+
+    if (child.fd < 0 || !sim_read_full(child.fd, &result, sizeof(result))) result = Result();
+    if (child.fd >= 0) close(child.fd);
+    if (child.pid > 0) waitpid(child.pid, nullptr, 0);
+    return result;
+}
+
+//One trial in its own child, waited for
+template <typename Result, typename Trial>
+inline Result sim_run_isolated(Trial trial) {
+    return sim_collect<Result>(sim_fork(trial));
+}
@@ -0,0 +1,139 @@
+#include <cmath>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../bias_controller_pico/bias_controller_pico.h"
+#include "capture_log.hpp"
+#include "capture_plant.hpp"
+#include "hal_host.hpp"
+
+/*
+Full resolution sweep against the coarse to fine sweep, both run by the firmware's sweep() on a plant
+that plays back a recorded curve. Reports the simulated sweep time, DAC points and the setpoints, and
+how far each coarse to fine result lands from the full sweep of the same seed.
+
+USAGE: sweep_bench hardware_tests/MZM_TRANSFER_CURVE/sweep_new_mzm.csv [noise V]
+*/
+
+#define BENCH_SEEDS 5
+
+struct Result {
+    double ms = 0;
+    double points = 0;
+    double peak = 0;
+    double null = 0;
+    double quad = 0;
+    double peak_step = 0;
+    double null_step = 0;
+    double vpi = 0;
+};
+
+//The firmware logs every sweep, keep the table readable
+class QuietStdout {
+public:
+    QuietStdout() {
+        std::fflush(stdout);
+        saved_ = dup(1);
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, 1);
+        close(null_fd);
+    }
+    ~QuietStdout() {
+        std::fflush(stdout);
+        dup2(saved_, 1);
+        close(saved_);
+    }
+private:
+    int saved_;
+};
+
+Result run(const std::vector<CapturePoint>& points, double noise, int fit, int coarse, uint32_t seed) {
+    CapturePlant plant(points, noise, seed);
+    Result result;
+
+    hal_host_reset();
+    hal_host_attach(&plant);
+
+    {
+        QuietStdout quiet;
+        char command[64];
+        std::snprintf(command, sizeof(command), "set fit %d", fit);
+        process_command(command);
+        std::snprintf(command, sizeof(command), "set coarse_points %d", coarse);
+        process_command(command);
+
+        sweep();
+    }
+
+    result.ms = (hal_host_time_us() - hal_host_stats().first_dac_us) / 1000.0;
+    result.points = static_cast<double>(hal_host_stats().dac_writes);
+    result.peak = q16_to_volts(peak_setpoint);
+    result.null = q16_to_volts(null_setpoint);
+    result.quad = q16_to_volts(quad_setpoint);
+    result.peak_step = peak_voltage_step;
+    result.null_step = null_voltage_step;
+    result.vpi = vpi_steps;
+    return result;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "USAGE: sweep_bench capture.log [noise V]" << std::endl;
+        return 1;
+    }
+
+    std::vector<CapturePoint> points = load_capture(argv[1]);
+    double noise = (argc > 2) ? std::atof(argv[2]) : 0.005;
+    if (points.size() < 2) {
+        std::cerr << argv[1] << ": no sweep data" << std::endl;
+        return 1;
+    }
+
+    const int coarse_settings[] = {0, 64, 128, 256};
+
+    std::cout << std::fixed;
+    std::cout << "Capture " << argv[1] << ", " << points.size() << " points, " << noise << " V noise per sample, "
+              << BENCH_SEEDS << " seeds" << std::endl;
+    std::cout << "fit coarse   sweep ms   points  speedup    peak V    null V    quad V  |dpeak| mV |dnull| mV |dquad| mV  |dstep| peak/null" << std::endl;
+
+    for (int fit = 1; fit >= 0; fit--) {
+        std::vector<Result> full(BENCH_SEEDS);
+        for (int seed = 0; seed < BENCH_SEEDS; seed++) full[seed] = run(points, noise, fit, 0, seed + 1);
+
+        for (int coarse : coarse_settings) {
+            Result mean, error;
+            for (int seed = 0; seed < BENCH_SEEDS; seed++) {
+                Result r = coarse ? run(points, noise, fit, coarse, seed + 1) : full[seed];
+                mean.ms += r.ms / BENCH_SEEDS;
+                mean.points += r.points / BENCH_SEEDS;
+                mean.peak += r.peak / BENCH_SEEDS;
+                mean.null += r.null / BENCH_SEEDS;
+                mean.quad += r.quad / BENCH_SEEDS;
+                error.peak += std::abs(r.peak - full[seed].peak) * 1000 / BENCH_SEEDS;
+                error.null += std::abs(r.null - full[seed].null) * 1000 / BENCH_SEEDS;
+                error.quad += std::abs(r.quad - full[seed].quad) * 1000 / BENCH_SEEDS;
+                error.peak_step += std::abs(r.peak_step - full[seed].peak_step) / BENCH_SEEDS;
+                error.null_step += std::abs(r.null_step - full[seed].null_step) / BENCH_SEEDS;
+            }
+
+            double full_ms = 0;
+            for (const Result& r : full) full_ms += r.ms / BENCH_SEEDS;
+
+            std::cout << std::setw(3) << fit << std::setw(7) << coarse
+                      << std::setprecision(1) << std::setw(11) << mean.ms
+                      << std::setprecision(0) << std::setw(9) << mean.points
+                      << std::setprecision(1) << std::setw(8) << full_ms / mean.ms << "x"
+                      << std::setprecision(4) << std::setw(10) << mean.peak << std::setw(10) << mean.null << std::setw(10) << mean.quad
+                      << std::setprecision(2) << std::setw(12) << error.peak << std::setw(11) << error.null << std::setw(11) << error.quad
+                      << std::setprecision(0) << std::setw(10) << error.peak_step << "/" << error.null_step << std::endl;
+        }
+    }
+
+    return 0;
+}
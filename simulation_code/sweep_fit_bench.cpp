@@ -0,0 +1,76 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../bias_controller_pico/sweep_fit.h"
+#include "capture_log.hpp"
+
+/*
+Runs the firmware's sweep_fit() on recorded sweeps and prints the fitted model, setpoints and lock
+points next to the raw max/min the old detect_peak()/detect_null() would use, plus the time per fit.
+
+USAGE: sweep_fit_bench capture.log [capture.log ...]
+*/
+
+#define BENCH_REPEATS 50
+#define NOISE_FLOOR   0.01f     //Same as the firmware, raw null ignores readings under it
+
+void print_steps(const char* name, const int* steps, int count) {
+    std::cout << "  " << std::left << std::setw(12) << name;
+    for (int i = 0; i < count; i++) std::cout << steps[i] << " ";
+    std::cout << std::endl;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "USAGE: sweep_fit_bench capture.log [capture.log ...]" << std::endl;
+        return 1;
+    }
+
+    int failures = 0;
+
+    for (int arg = 1; arg < argc; arg++) {
+        std::vector<CapturePoint> points = load_capture(argv[arg]);
+        if (points.size() < 2) {
+            std::cout << argv[arg] << ": no sweep data" << std::endl;
+            failures++;
+            continue;
+        }
+
+        std::vector<float> y = capture_voltages(points);
+        int step_size = points[1].step - points[0].step;
+
+        float raw_peak = 0, raw_null = 3.3f;
+        for (float v : y) {
+            raw_peak = std::max(raw_peak, v);
+            if (v >= NOISE_FLOOR) raw_null = std::min(raw_null, v);
+        }
+
+        sweep_fit_t fit;
+        bool ok = false;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < BENCH_REPEATS; i++) {
+            ok = sweep_fit(y.data(), static_cast<int>(y.size()), step_size, &fit);
+        }
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / BENCH_REPEATS;
+
+        std::cout << std::fixed << std::setprecision(4);
+        std::cout << argv[arg] << (ok ? "" : "  (FIT REJECTED)") << std::endl;
+        std::cout << "  model       offset " << fit.offset << " V, amplitude " << fit.amplitude << " V, Vpi "
+                  << std::setprecision(0) << fit.vpi_steps << std::setprecision(4) << " steps, phase " << fit.phase
+                  << " rad, rms residual " << fit.rms_residual << " V" << std::endl;
+        std::cout << "  setpoints   peak " << fit.peak_voltage << " V (raw " << raw_peak << "), null " << fit.null_voltage
+                  << " V (raw " << raw_null << "), quad " << fit.quad_voltage << " V (raw peak/2 " << raw_peak / 2 << ")" << std::endl;
+        print_steps("peaks", fit.peak_steps, fit.peak_count);
+        print_steps("nulls", fit.null_steps, fit.null_count);
+        print_steps("quad+", fit.quad_plus_steps, fit.quad_plus_count);
+        print_steps("quad-", fit.quad_minus_steps, fit.quad_minus_count);
+        std::cout << "  fit time    " << std::setprecision(1) << us << " us on this host" << std::endl;
+
+        failures += !ok;
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,70 @@
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "telemetry_log.hpp"
+
+/*
+Decodes a recording of the firmware's `stream on` output (serial capture, or host_controller stdout)
+into CSV, one row per ADC read. --capture prints only the sweep reads as "step:voltage" lines, the same
+format as the PuTTY logs under hardware_tests, so sweep_fit_bench and sweep_bench can read them.
+With several controller channels --channel keeps the frames of one of them.
+A summary with CRC errors and lost frames goes to stderr.
+
+USAGE: telemetry_decode [--capture] [--channel n] [file]        reads stdin without a file
+*/
+
+int main(int argc, char** argv) {
+    bool capture = false;
+    int channel = -1;
+    std::string path;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--capture") capture = true;
+        else if (arg == "--channel" && i + 1 < argc) channel = std::atoi(argv[++i]);
+        else path = arg;
+    }
+
+    std::vector<uint8_t> data;
+    if (path.empty()) {
+        data.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+    } else {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            std::cerr << path << ": cannot open" << std::endl;
+            return 1;
+        }
+        data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    TelemetryStats stats;
+    std::vector<telemetry_frame_t> frames = parse_telemetry(data.data(), data.data() + data.size(), stats);
+
+    if (!capture) std::printf("sequence,time_us,dac_step,adc_counts,voltage,error_v,mode,flags,channel\n");
+
+    for (const telemetry_frame_t& frame : frames) {
+        const telemetry_sample_t& s = frame.sample;
+        int frame_channel = s.mode >> TELEMETRY_CHANNEL_SHIFT;
+        unsigned int mode = s.mode & ((1u << TELEMETRY_CHANNEL_SHIFT) - 1);
+
+        if (channel >= 0 && frame_channel != channel) continue;
+
+        if (capture) {
+            if (s.flags & TELEMETRY_FLAG_SWEEP) std::printf("%u:%.4f\n", s.dac_step, telemetry_voltage(frame));
+        } else {
+            std::printf("%u,%u,%u,%.4f,%.4f,%.4f,%u,%u,%d\n", frame.sequence, s.time_us, s.dac_step, s.adc_x16 / 16.0,
+                        telemetry_voltage(frame), s.error_100uv / 10000.0, mode, s.flags, frame_channel);
+        }
+    }
+
+    std::fprintf(stderr, "%llu frames, %llu lost, %llu CRC errors, %llu text bytes\n",
+                 static_cast<unsigned long long>(stats.frames), static_cast<unsigned long long>(stats.lost),
+                 static_cast<unsigned long long>(stats.crc_errors), static_cast<unsigned long long>(stats.text_bytes));
+
+    return stats.crc_errors ? 1 : 0;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "../bias_controller_pico/crc32.h"
+#include "../bias_controller_pico/telemetry.h"
+
+/*
+Decoder for the firmware's binary telemetry stream (bias_controller_pico/telemetry.h). The stream shares
+the serial link with the text console, so anything that is not a sync word followed by a frame with a
+good CRC is skipped byte by byte and counted as text.
+*/
+
+struct TelemetryStats {
+    uint64_t frames = 0;
+    uint64_t crc_errors = 0;       //Sync and length matched but the CRC did not
+    uint64_t lost = 0;             //Frames missing from the sequence (dropped on the board or on the link)
+    uint64_t text_bytes = 0;       //Bytes outside frames, console output
+};
+
+inline std::vector<telemetry_frame_t> parse_telemetry(const uint8_t* begin, const uint8_t* end, TelemetryStats& stats) {
+    std::vector<telemetry_frame_t> frames;
+    const uint8_t* p = begin;
+    bool have_previous = false;
+    uint32_t previous = 0;
+
+    while (p < end) {
+        if (end - p >= static_cast<std::ptrdiff_t>(sizeof(telemetry_frame_t)) &&
+            p[0] == TELEMETRY_SYNC_0 && p[1] == TELEMETRY_SYNC_1 && p[3] == sizeof(telemetry_sample_t)) {
+            telemetry_frame_t frame;
+            std::memcpy(&frame, p, sizeof(frame));
+
+            uint32_t crc = crc32(&frame.type, offsetof(telemetry_frame_t, crc) - offsetof(telemetry_frame_t, type));
+            if (crc == frame.crc) {
+                if (have_previous) stats.lost += frame.sequence - previous - 1;
+                previous = frame.sequence;
+                have_previous = true;
+
+                frames.push_back(frame);
+                stats.frames++;
+                p += sizeof(frame);
+                continue;
+            }
+            stats.crc_errors++;
+        }
+
+        stats.text_bytes++;
+        p++;
+    }
+
+    return frames;
+}
+
+//Detector voltage of a frame, as the firmware's read_voltage_averaged() before rounding
+inline double telemetry_voltage(const telemetry_frame_t& frame) {
+    return frame.sample.adc_x16 / 16.0 * 3.3 / 4096;
+}